@@ -0,0 +1,548 @@
+/* convert.cpp
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "convert.h"
+
+#include <algorithm>	// std::min
+#include <cmath>		// std::lrint
+#include <cstdint>		// int32_t, uint8_t, uint32_t
+#include <cstring>		// memcpy
+
+#include "simd.h"
+
+bool hostIsBigEndian(void)
+{
+	const uint32_t one = 1;
+	uint8_t firstByte = 0;
+	memcpy(&firstByte, &one, 1);
+	return firstByte == 0;
+}
+
+// scalar building blocks; these are written byte by byte so they work for any alignment
+// and host byte order, and compilers turn them into plain (or byte-swapping) loads
+
+template<size_t kSize, bool kBigEndian>
+static inline
+int32_t readInt(const uint8_t* p)
+{
+	uint32_t v = 0;
+	for (size_t b = 0; b < kSize; ++b)
+	{
+		v |= (uint32_t)p[b] << (8 * (kBigEndian ? kSize - 1 - b : b));
+	}
+	// sign-extend from kSize bytes
+	return (int32_t)(v << (32 - 8 * kSize)) >> (32 - 8 * kSize);
+}
+
+template<size_t kSize, bool kBigEndian>
+static inline
+void writeInt(uint8_t* p, int32_t value)
+{
+	uint32_t v = (uint32_t)value;
+	for (size_t b = 0; b < kSize; ++b)
+	{
+		p[b] = (uint8_t)(v >> (8 * (kBigEndian ? kSize - 1 - b : b)));
+	}
+}
+
+template<bool kBigEndian>
+static inline
+float readFloat(const uint8_t* p)
+{
+	uint32_t v = (uint32_t)readInt<4, kBigEndian>(p);
+	float f;
+	memcpy(&f, &v, sizeof(f));
+	return f;
+}
+
+template<bool kBigEndian>
+static inline
+void writeFloat(uint8_t* p, float f)
+{
+	uint32_t v;
+	memcpy(&v, &f, sizeof(v));
+	writeInt<4, kBigEndian>(p, (int32_t)v);
+}
+
+template<size_t kSize>
+static inline
+float intScale(void)
+{
+	return (float)(1UL << (8 * kSize - 1));
+}
+
+template<size_t kSize>
+static inline
+float intCeiling(void)
+{
+	// the largest float that still fits once scaled; for 32-bit ints that's 2^31 - 128
+	return kSize == 4 ? 2147483520.0f : intScale<kSize>() - 1.0f;
+}
+
+template<size_t kSize>
+static inline
+int32_t quantize(float sample)
+{
+	float scaled = sample * intScale<kSize>();
+	scaled = scaled < -intScale<kSize>() ? -intScale<kSize>() : (scaled > intCeiling<kSize>() ? intCeiling<kSize>() : scaled);
+	return (int32_t)std::lrint(scaled);
+}
+
+// vector kernels for little-endian 16- and 32-bit integers, which is what nearly every
+// feed and device actually uses; each returns how many samples it handled, leaving the
+// rest to the scalar loops
+
+#if PIPEPLAYER_AVX2
+
+static
+size_t s16ToFloatVector(const uint8_t* input, float* output, size_t samples)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 32768.0f);
+	size_t i = 0;
+	for (; i + 8 <= samples; i += 8)
+	{
+		__m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(input + i * 2)));
+		_mm256_storeu_ps(output + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+	}
+	return i;
+}
+
+static
+size_t floatToS16Vector(const float* input, uint8_t* output, size_t samples)
+{
+	const __m256 scale = _mm256_set1_ps(32768.0f);
+	const __m256 floor = _mm256_set1_ps(-32768.0f);
+	const __m256 ceiling = _mm256_set1_ps(32767.0f);
+	size_t i = 0;
+	for (; i + 16 <= samples; i += 16)
+	{
+		__m256 a = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(input + i), scale), floor), ceiling);
+		__m256 b = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(input + i + 8), scale), floor), ceiling);
+		__m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(a), _mm256_cvtps_epi32(b));
+		// packs works within 128-bit lanes, so put the quarters back in order
+		_mm256_storeu_si256((__m256i*)(output + i * 2), _mm256_permute4x64_epi64(packed, 0xD8));
+	}
+	return i;
+}
+
+static
+size_t s32ToFloatVector(const uint8_t* input, float* output, size_t samples)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 2147483648.0f);
+	size_t i = 0;
+	for (; i + 8 <= samples; i += 8)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)(input + i * 4));
+		_mm256_storeu_ps(output + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+	}
+	return i;
+}
+
+static
+size_t floatToS32Vector(const float* input, uint8_t* output, size_t samples)
+{
+	const __m256 scale = _mm256_set1_ps(2147483648.0f);
+	const __m256 floor = _mm256_set1_ps(-2147483648.0f);
+	const __m256 ceiling = _mm256_set1_ps(2147483520.0f);
+	size_t i = 0;
+	for (; i + 8 <= samples; i += 8)
+	{
+		__m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(_mm256_loadu_ps(input + i), scale), floor), ceiling);
+		_mm256_storeu_si256((__m256i*)(output + i * 4), _mm256_cvtps_epi32(v));
+	}
+	return i;
+}
+
+#elif PIPEPLAYER_SSE2
+
+static
+size_t s16ToFloatVector(const uint8_t* input, float* output, size_t samples)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+	size_t i = 0;
+	for (; i + 8 <= samples; i += 8)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(input + i * 2));
+		// widen by putting each sample in the top half of a 32-bit lane and shifting it back down
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(output + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	return i;
+}
+
+static
+size_t floatToS16Vector(const float* input, uint8_t* output, size_t samples)
+{
+	const __m128 scale = _mm_set1_ps(32768.0f);
+	const __m128 floor = _mm_set1_ps(-32768.0f);
+	const __m128 ceiling = _mm_set1_ps(32767.0f);
+	size_t i = 0;
+	for (; i + 8 <= samples; i += 8)
+	{
+		__m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(input + i), scale), floor), ceiling);
+		__m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(input + i + 4), scale), floor), ceiling);
+		_mm_storeu_si128((__m128i*)(output + i * 2), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+	}
+	return i;
+}
+
+static
+size_t s32ToFloatVector(const uint8_t* input, float* output, size_t samples)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 2147483648.0f);
+	size_t i = 0;
+	for (; i + 4 <= samples; i += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(input + i * 4));
+		_mm_storeu_ps(output + i, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+	}
+	return i;
+}
+
+static
+size_t floatToS32Vector(const float* input, uint8_t* output, size_t samples)
+{
+	const __m128 scale = _mm_set1_ps(2147483648.0f);
+	const __m128 floor = _mm_set1_ps(-2147483648.0f);
+	const __m128 ceiling = _mm_set1_ps(2147483520.0f);
+	size_t i = 0;
+	for (; i + 4 <= samples; i += 4)
+	{
+		__m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(input + i), scale), floor), ceiling);
+		_mm_storeu_si128((__m128i*)(output + i * 4), _mm_cvtps_epi32(v));
+	}
+	return i;
+}
+
+#elif PIPEPLAYER_NEON
+
+static
+size_t s16ToFloatVector(const uint8_t* input, float* output, size_t samples)
+{
+	size_t i = 0;
+	for (; i + 8 <= samples; i += 8)
+	{
+		int16x8_t v = vreinterpretq_s16_u8(vld1q_u8(input + i * 2));
+		vst1q_f32(output + i, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(v))), 1.0f / 32768.0f));
+		vst1q_f32(output + i + 4, vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_high_s16(v))), 1.0f / 32768.0f));
+	}
+	return i;
+}
+
+static
+size_t floatToS16Vector(const float* input, uint8_t* output, size_t samples)
+{
+	size_t i = 0;
+	for (; i + 8 <= samples; i += 8)
+	{
+		// both the float to int conversion and the narrowing saturate on their own
+		int32x4_t a = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(input + i), 32768.0f));
+		int32x4_t b = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(input + i + 4), 32768.0f));
+		vst1q_u8(output + i * 2, vreinterpretq_u8_s16(vcombine_s16(vqmovn_s32(a), vqmovn_s32(b))));
+	}
+	return i;
+}
+
+static
+size_t s32ToFloatVector(const uint8_t* input, float* output, size_t samples)
+{
+	size_t i = 0;
+	for (; i + 4 <= samples; i += 4)
+	{
+		int32x4_t v = vreinterpretq_s32_u8(vld1q_u8(input + i * 4));
+		vst1q_f32(output + i, vmulq_n_f32(vcvtq_f32_s32(v), 1.0f / 2147483648.0f));
+	}
+	return i;
+}
+
+static
+size_t floatToS32Vector(const float* input, uint8_t* output, size_t samples)
+{
+	size_t i = 0;
+	for (; i + 4 <= samples; i += 4)
+	{
+		int32x4_t v = vcvtnq_s32_f32(vmulq_n_f32(vld1q_f32(input + i), 2147483648.0f));
+		vst1q_u8(output + i * 4, vreinterpretq_u8_s32(v));
+	}
+	return i;
+}
+
+#else
+
+static
+size_t s16ToFloatVector(const uint8_t* input, float* output, size_t samples)
+{
+	return 0;
+}
+
+static
+size_t floatToS16Vector(const float* input, uint8_t* output, size_t samples)
+{
+	return 0;
+}
+
+static
+size_t s32ToFloatVector(const uint8_t* input, float* output, size_t samples)
+{
+	return 0;
+}
+
+static
+size_t floatToS32Vector(const float* input, uint8_t* output, size_t samples)
+{
+	return 0;
+}
+
+#endif
+
+// to float
+
+static
+void u8ToFloat(const void* input, float* output, size_t samples)
+{
+	const uint8_t* in = (const uint8_t*)input;
+	for (size_t i = 0; i < samples; ++i)
+	{
+		output[i] = (float)((int)in[i] - 0x80) * (1.0f / 128.0f);
+	}
+}
+
+template<size_t kSize, bool kBigEndian>
+static
+void intToFloat(const void* input, float* output, size_t samples)
+{
+	const uint8_t* in = (const uint8_t*)input;
+	const float scale = 1.0f / intScale<kSize>();
+	size_t i = 0;
+	if (!kBigEndian && !hostIsBigEndian())
+	{
+		if (kSize == 2)
+		{
+			i = s16ToFloatVector(in, output, samples);
+		}
+		else if (kSize == 4)
+		{
+			i = s32ToFloatVector(in, output, samples);
+		}
+	}
+	for (; i < samples; ++i)
+	{
+		output[i] = (float)readInt<kSize, kBigEndian>(in + i * kSize) * scale;
+	}
+}
+
+template<bool kBigEndian>
+static
+void floatToFloat(const void* input, float* output, size_t samples)
+{
+	if (kBigEndian == hostIsBigEndian())
+	{
+		memcpy(output, input, samples * sizeof(float));
+		return;
+	}
+	const uint8_t* in = (const uint8_t*)input;
+	for (size_t i = 0; i < samples; ++i)
+	{
+		output[i] = readFloat<kBigEndian>(in + i * sizeof(float));
+	}
+}
+
+// from float
+
+static
+void floatToU8(const float* input, void* output, size_t samples)
+{
+	uint8_t* out = (uint8_t*)output;
+	for (size_t i = 0; i < samples; ++i)
+	{
+		out[i] = (uint8_t)(quantize<1>(input[i]) + 0x80);
+	}
+}
+
+template<size_t kSize, bool kBigEndian>
+static
+void floatToInt(const float* input, void* output, size_t samples)
+{
+	uint8_t* out = (uint8_t*)output;
+	size_t i = 0;
+	if (!kBigEndian && !hostIsBigEndian())
+	{
+		if (kSize == 2)
+		{
+			i = floatToS16Vector(input, out, samples);
+		}
+		else if (kSize == 4)
+		{
+			i = floatToS32Vector(input, out, samples);
+		}
+	}
+	for (; i < samples; ++i)
+	{
+		writeInt<kSize, kBigEndian>(out + i * kSize, quantize<kSize>(input[i]));
+	}
+}
+
+template<bool kBigEndian>
+static
+void floatFromFloat(const float* input, void* output, size_t samples)
+{
+	if (kBigEndian == hostIsBigEndian())
+	{
+		memcpy(output, input, samples * sizeof(float));
+		return;
+	}
+	uint8_t* out = (uint8_t*)output;
+	for (size_t i = 0; i < samples; ++i)
+	{
+		writeFloat<kBigEndian>(out + i * sizeof(float), input[i]);
+	}
+}
+
+// byte swapping
+
+template<size_t kSize>
+static
+void swapBytes(const void* input, void* output, size_t samples)
+{
+	const uint8_t* in = (const uint8_t*)input;
+	uint8_t* out = (uint8_t*)output;
+	for (size_t i = 0; i < samples; ++i)
+	{
+		for (size_t b = 0; b < kSize; ++b)
+		{
+			out[i * kSize + b] = in[i * kSize + kSize - 1 - b];
+		}
+	}
+}
+
+ToFloatFunction toFloatFunction(const SampleFormat& format)
+{
+	switch (format.sampleFormat)
+	{
+		case paUInt8:
+			return u8ToFloat;
+		case paInt8:
+			return intToFloat<1, false>;
+		case paInt16:
+			return format.bigEndian ? intToFloat<2, true> : intToFloat<2, false>;
+		case paInt24:
+			return format.bigEndian ? intToFloat<3, true> : intToFloat<3, false>;
+		case paInt32:
+			return format.bigEndian ? intToFloat<4, true> : intToFloat<4, false>;
+		case paFloat32:
+			return format.bigEndian ? floatToFloat<true> : floatToFloat<false>;
+		default:
+			return nullptr;
+	}
+}
+
+FromFloatFunction fromFloatFunction(const SampleFormat& format)
+{
+	switch (format.sampleFormat)
+	{
+		case paUInt8:
+			return floatToU8;
+		case paInt8:
+			return floatToInt<1, false>;
+		case paInt16:
+			return format.bigEndian ? floatToInt<2, true> : floatToInt<2, false>;
+		case paInt24:
+			return format.bigEndian ? floatToInt<3, true> : floatToInt<3, false>;
+		case paInt32:
+			return format.bigEndian ? floatToInt<4, true> : floatToInt<4, false>;
+		case paFloat32:
+			return format.bigEndian ? floatFromFloat<true> : floatFromFloat<false>;
+		default:
+			return nullptr;
+	}
+}
+
+static
+SwapFunction swapFunction(size_t sampleSize)
+{
+	switch (sampleSize)
+	{
+		case 2:
+			return swapBytes<2>;
+		case 3:
+			return swapBytes<3>;
+		case 4:
+			return swapBytes<4>;
+		default:
+			return nullptr;
+	}
+}
+
+bool initConverter(Converter& converter, const SampleFormat& input, const SampleFormat& output)
+{
+	converter.input = input;
+	converter.output = output;
+	converter.swap = nullptr;
+	converter.toFloat = nullptr;
+	converter.fromFloat = nullptr;
+	
+	if (input.sampleFormat == output.sampleFormat)
+	{
+		// byte order means nothing for single-byte samples
+		if (input.bigEndian == output.bigEndian || input.sampleSize == 1)
+		{
+			return true;
+		}
+		converter.swap = swapFunction(input.sampleSize);
+		return converter.swap != nullptr;
+	}
+	
+	converter.toFloat = toFloatFunction(input);
+	converter.fromFloat = fromFloatFunction(output);
+	return converter.toFloat != nullptr && converter.fromFloat != nullptr;
+}
+
+bool converterIsIdentity(const Converter& converter)
+{
+	return converter.swap == nullptr && converter.toFloat == nullptr;
+}
+
+void convertSamples(const Converter& converter, const void* input, void* output, size_t samples)
+{
+	if (converter.swap != nullptr)
+	{
+		converter.swap(input, output, samples);
+		return;
+	}
+	if (converter.toFloat == nullptr)
+	{
+		memcpy(output, input, samples * converter.input.sampleSize);
+		return;
+	}
+	
+	// go through float a cache-friendly chunk at a time
+	const size_t kChunkSamples = 1024;
+	float chunk[kChunkSamples];
+	const uint8_t* in = (const uint8_t*)input;
+	uint8_t* out = (uint8_t*)output;
+	while (samples > 0)
+	{
+		size_t count = std::min(samples, kChunkSamples);
+		converter.toFloat(in, chunk, count);
+		converter.fromFloat(chunk, out, count);
+		in += count * converter.input.sampleSize;
+		out += count * converter.output.sampleSize;
+		samples -= count;
+	}
+}
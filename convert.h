@@ -0,0 +1,63 @@
+/* convert.h
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPEPLAYER_CONVERT_H
+#define PIPEPLAYER_CONVERT_H
+
+#include <cstddef>		// size_t
+
+#include "portaudio.h"
+
+struct SampleFormat
+{
+	PaSampleFormat sampleFormat;
+	size_t sampleSize;
+	bool bigEndian;
+};
+
+typedef void (*ToFloatFunction)(const void* input, float* output, size_t samples);
+typedef void (*FromFloatFunction)(const float* input, void* output, size_t samples);
+typedef void (*SwapFunction)(const void* input, void* output, size_t samples);
+
+struct Converter
+{
+	SampleFormat input;
+	SampleFormat output;
+	
+	// exactly one of these setups is used: nothing at all when the formats match,
+	// a byte swap when only the endianness differs, or a trip through float otherwise
+	SwapFunction swap;
+	ToFloatFunction toFloat;
+	FromFloatFunction fromFloat;
+};
+
+bool hostIsBigEndian(void);
+
+// the per-format halves of a conversion through float, for stages that work in float
+ToFloatFunction toFloatFunction(const SampleFormat& format);
+FromFloatFunction fromFloatFunction(const SampleFormat& format);
+
+// returns false if either format isn't one we know how to handle
+bool initConverter(Converter& converter, const SampleFormat& input, const SampleFormat& output);
+
+bool converterIsIdentity(const Converter& converter);
+
+// converts samples (not frames) from converter.input to converter.output; the buffers
+// may not overlap, and neither needs any particular alignment
+void convertSamples(const Converter& converter, const void* input, void* output, size_t samples);
+
+#endif
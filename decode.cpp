@@ -0,0 +1,304 @@
+/* decode.cpp
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "decode.h"
+
+#include <cstring>		// memcpy, memset
+
+#if defined(PIPEPLAYER_FLAC)
+#include <FLAC/stream_decoder.h>	// FLAC__stream_decoder_*, FLAC__StreamDecoder, FLAC__Frame, FLAC__StreamMetadata
+#endif
+#if defined(PIPEPLAYER_OPUS)
+#include <opusfile.h>	// op_free, op_head, op_open_callbacks, op_read_float, OggOpusFile, OpusFileCallbacks, OP_HOLE
+#endif
+
+#if defined(PIPEPLAYER_FLAC)
+
+static
+void packSamples(const FLAC__int32* const planes[], int channels, size_t offset, size_t frames, unsigned shift, const SampleFormat& format, uint8_t* output)
+{
+	// interleaves libFLAC's per-channel samples into format, shifted up to its full width
+	for (size_t i = offset; i < offset + frames; ++i)
+	{
+		for (int channel = 0; channel < channels; ++channel)
+		{
+			int32_t sample = (int32_t)((uint32_t)planes[channel][i] << shift);
+			switch (format.sampleSize)
+			{
+				case 1:
+					*output = (uint8_t)(int8_t)sample;
+					break;
+				case 2:
+					{
+						int16_t value = (int16_t)sample;
+						memcpy(output, &value, sizeof(value));
+					}
+					break;
+				case 3:
+					for (size_t byte = 0; byte < 3; ++byte)
+					{
+						output[format.bigEndian ? 2 - byte : byte] = (uint8_t)(sample >> (8 * byte));
+					}
+					break;
+				default:
+					memcpy(output, &sample, sizeof(sample));
+					break;
+			}
+			output += format.sampleSize;
+		}
+	}
+}
+
+static
+FLAC__StreamDecoderReadStatus flacRead(const FLAC__StreamDecoder*, FLAC__byte buffer[], size_t* bytes, void* client)
+{
+	Decoder& decoder = *(Decoder*)client;
+	long bytesRead = decoder.read(decoder.context, buffer, *bytes);
+	*bytes = bytesRead > 0 ? (size_t)bytesRead : 0;
+	if (bytesRead < 0)
+	{
+		return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+	}
+	return bytesRead == 0 ? FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM : FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+static
+FLAC__StreamDecoderWriteStatus flacWrite(const FLAC__StreamDecoder*, const FLAC__Frame* frame, const FLAC__int32* const buffer[], void* client)
+{
+	Decoder& decoder = *(Decoder*)client;
+	if ((int)frame->header.channels != decoder.channels)
+	{
+		return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+	}
+	
+	unsigned shift = (unsigned)(decoder.format.sampleSize * 8 - frame->header.bits_per_sample);
+	size_t framesDone = 0;
+	while (framesDone < frame->header.blocksize)
+	{
+		size_t frames = frame->header.blocksize - framesDone;
+		uint8_t* output = (uint8_t*)decoder.space(decoder.context, frames);
+		if (output == nullptr)
+		{
+			decoder.stopped = true;
+			return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+		}
+		packSamples(buffer, decoder.channels, framesDone, frames, shift, decoder.format, output);
+		decoder.commit(decoder.context, frames);
+		framesDone += frames;
+	}
+	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static
+void flacMetadata(const FLAC__StreamDecoder*, const FLAC__StreamMetadata* metadata, void* client)
+{
+	Decoder& decoder = *(Decoder*)client;
+	if (metadata->type != FLAC__METADATA_TYPE_STREAMINFO)
+	{
+		return;
+	}
+	
+	const FLAC__StreamMetadata_StreamInfo& info = metadata->data.stream_info;
+	decoder.channels = (int)info.channels;
+	decoder.sampleRate = info.sample_rate;
+	decoder.format.sampleSize = (info.bits_per_sample + 7) / 8;
+	decoder.format.bigEndian = hostIsBigEndian();
+	switch (decoder.format.sampleSize)
+	{
+		case 1:
+			decoder.format.sampleFormat = paInt8;
+			break;
+		case 2:
+			decoder.format.sampleFormat = paInt16;
+			break;
+		case 3:
+			decoder.format.sampleFormat = paInt24;
+			break;
+		default:
+			decoder.format.sampleFormat = paInt32;
+			break;
+	}
+}
+
+static
+void flacError(const FLAC__StreamDecoder*, FLAC__StreamDecoderErrorStatus, void*)
+{
+	// lost sync or a bad frame; libFLAC finds the next good one by itself
+}
+
+#endif
+
+#if defined(PIPEPLAYER_OPUS)
+
+static const double kOpusRate = 48000.0;		// what Opus always decodes at, whatever the input was
+static const size_t kOpusMaxFrames = 5760;	// 120ms, the longest a packet can be
+
+static
+int opusRead(void* stream, unsigned char* buffer, int bytes)
+{
+	Decoder& decoder = *(Decoder*)stream;
+	long bytesRead = decoder.read(decoder.context, buffer, (size_t)bytes);
+	return bytesRead < 0 ? -1 : (int)bytesRead;
+}
+
+#endif
+
+bool codecAvailable(Codec codec)
+{
+	switch (codec)
+	{
+#if defined(PIPEPLAYER_FLAC)
+		case kCodecFlac:
+			return true;
+#endif
+#if defined(PIPEPLAYER_OPUS)
+		case kCodecOpus:
+			return true;
+#endif
+		default:
+			return false;
+	}
+}
+
+const char* codecName(Codec codec)
+{
+	return codec == kCodecFlac ? "FLAC" : "Opus";
+}
+
+bool openDecoder(Decoder& decoder, Codec codec, DecoderReadFunction read, DecoderSpaceFunction space, DecoderCommitFunction commit, void* context)
+{
+	memset(&decoder, 0, sizeof(decoder));
+	decoder.codec = codec;
+	decoder.read = read;
+	decoder.space = space;
+	decoder.commit = commit;
+	decoder.context = context;
+	
+	bool opened = false;
+	switch (codec)
+	{
+#if defined(PIPEPLAYER_FLAC)
+		case kCodecFlac:
+			{
+				FLAC__StreamDecoder* flac = FLAC__stream_decoder_new();
+				decoder.state = flac;
+				opened = flac != nullptr &&
+					FLAC__stream_decoder_init_stream(flac, flacRead, nullptr, nullptr, nullptr, nullptr, flacWrite, flacMetadata, flacError, &decoder) == FLAC__STREAM_DECODER_INIT_STATUS_OK &&
+					FLAC__stream_decoder_process_until_end_of_metadata(flac) &&
+					decoder.channels > 0;
+			}
+			break;
+#endif
+#if defined(PIPEPLAYER_OPUS)
+		case kCodecOpus:
+			{
+				OpusFileCallbacks callbacks = { opusRead, nullptr, nullptr, nullptr };
+				int error = 0;
+				OggOpusFile* file = op_open_callbacks(&decoder, &callbacks, nullptr, 0, &error);
+				decoder.state = file;
+				if (file != nullptr)
+				{
+					decoder.channels = op_head(file, -1)->channel_count;
+					decoder.sampleRate = kOpusRate;
+					decoder.format.sampleFormat = paFloat32;
+					decoder.format.sampleSize = sizeof(float);
+					decoder.format.bigEndian = hostIsBigEndian();
+					opened = decoder.channels > 0;
+				}
+			}
+			break;
+#endif
+		default:
+			break;
+	}
+	
+	if (!opened)
+	{
+		closeDecoder(decoder);
+	}
+	return opened;
+}
+
+bool runDecoder(Decoder& decoder)
+{
+	switch (decoder.codec)
+	{
+#if defined(PIPEPLAYER_FLAC)
+		case kCodecFlac:
+			return FLAC__stream_decoder_process_until_end_of_stream((FLAC__StreamDecoder*)decoder.state) || decoder.stopped;
+#endif
+#if defined(PIPEPLAYER_OPUS)
+		case kCodecOpus:
+			{
+				OggOpusFile* file = (OggOpusFile*)decoder.state;
+				for (;;)
+				{
+					size_t frames = kOpusMaxFrames;
+					float* output = (float*)decoder.space(decoder.context, frames);
+					if (output == nullptr)
+					{
+						decoder.stopped = true;
+						return true;
+					}
+					
+					// opusfile hangs on to whatever of a packet doesn't fit for next time
+					int link = -1;
+					int framesRead = op_read_float(file, output, (int)(frames * decoder.channels), &link);
+					if (framesRead == OP_HOLE)
+					{
+						continue;	// a gap in the stream, which we just play on through
+					}
+					if (framesRead <= 0)
+					{
+						return framesRead == 0;
+					}
+					if (op_head(file, link)->channel_count != decoder.channels)
+					{
+						return false;	// a chained stream's with a different layout
+					}
+					decoder.commit(decoder.context, (size_t)framesRead);
+				}
+			}
+#endif
+		default:
+			return false;
+	}
+}
+
+void closeDecoder(Decoder& decoder)
+{
+	if (decoder.state == nullptr)
+	{
+		return;
+	}
+	switch (decoder.codec)
+	{
+#if defined(PIPEPLAYER_FLAC)
+		case kCodecFlac:
+			FLAC__stream_decoder_delete((FLAC__StreamDecoder*)decoder.state);
+			break;
+#endif
+#if defined(PIPEPLAYER_OPUS)
+		case kCodecOpus:
+			op_free((OggOpusFile*)decoder.state);
+			break;
+#endif
+		default:
+			break;
+	}
+	decoder.state = nullptr;
+}
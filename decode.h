@@ -0,0 +1,75 @@
+/* decode.h
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPEPLAYER_DECODE_H
+#define PIPEPLAYER_DECODE_H
+
+#include <cstddef>		// size_t
+#include <cstdint>		// uint8_t
+
+#include "convert.h"
+
+enum Codec
+{
+	kCodecFlac,	// native FLAC, through libFLAC
+	kCodecOpus,	// Ogg Opus, through opusfile
+};
+
+// pulls compressed input like read() would, returning 0 at the end of it and -1 to give up
+typedef long (*DecoderReadFunction)(void* context, uint8_t* buffer, size_t bytes);
+
+// asks for somewhere to decode up to frames frames to, lowering frames to however many fit
+// (never to zero); returning nullptr stops decoding
+typedef void* (*DecoderSpaceFunction)(void* context, size_t& frames);
+
+// says how many frames were decoded into the space handed out last
+typedef void (*DecoderCommitFunction)(void* context, size_t frames);
+
+struct Decoder
+{
+	Codec codec;
+	
+	// what we decode to, known once the decoder's open: host-endian integers as wide as the
+	// stream's samples for FLAC, and float at 48kHz for Opus
+	SampleFormat format;
+	int channels;
+	double sampleRate;
+	
+	DecoderReadFunction read;
+	DecoderSpaceFunction space;
+	DecoderCommitFunction commit;
+	void* context;
+	
+	void* state;	// the library's own decoder
+	bool stopped;	// space returned nullptr
+};
+
+// whether this build can decode codec at all
+bool codecAvailable(Codec codec);
+
+const char* codecName(Codec codec);
+
+// opens a decoder and reads just far enough into the stream to know its format; the
+// decoder keeps a pointer to itself, so it mustn't move until it's been closed
+bool openDecoder(Decoder& decoder, Codec codec, DecoderReadFunction read, DecoderSpaceFunction space, DecoderCommitFunction commit, void* context);
+
+// decodes until the stream ends or space stops us, which isn't an error
+bool runDecoder(Decoder& decoder);
+
+void closeDecoder(Decoder& decoder);
+
+#endif
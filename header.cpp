@@ -0,0 +1,475 @@
+/* header.cpp
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "header.h"
+
+#include <algorithm>	// std::min
+#include <cerrno>		// errno, EINTR
+#include <cmath>		// std::ldexp
+#include <cstring>		// memcmp, memcpy, memmove, memset
+
+#include <unistd.h>		// read
+
+// the header so far, with what's been read past the part we're looking at kept after it
+struct HeaderReader
+{
+	int fd;
+	uint8_t* buffer;	// kHeaderPeekBytes
+	size_t start;		// where the part we're looking at begins
+	size_t end;			// how much of buffer has been read into
+};
+
+static
+bool readMore(HeaderReader& reader)
+{
+	// one read into whatever space is left, moving what we have to the front first
+	if (reader.start > 0)
+	{
+		memmove(reader.buffer, reader.buffer + reader.start, reader.end - reader.start);
+		reader.end -= reader.start;
+		reader.start = 0;
+	}
+	ssize_t bytesRead = 0;
+	do
+	{
+		bytesRead = read(reader.fd, reader.buffer + reader.end, kHeaderPeekBytes - reader.end);
+	} while (bytesRead < 0 && errno == EINTR);
+	if (bytesRead > 0)
+	{
+		reader.end += (size_t)bytesRead;
+	}
+	return bytesRead > 0;
+}
+
+static
+bool fill(HeaderReader& reader, size_t bytes)
+{
+	// makes sure the next bytes are in the buffer; false at EOF or if they'd never fit
+	if (bytes > kHeaderPeekBytes)
+	{
+		return false;
+	}
+	while (reader.end - reader.start < bytes)
+	{
+		if (!readMore(reader))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+static
+bool skip(HeaderReader& reader, uint64_t bytes)
+{
+	// passes over a chunk we don't need, however big, reading through it as we go
+	while (bytes > reader.end - reader.start)
+	{
+		bytes -= reader.end - reader.start;
+		reader.start = reader.end;
+		if (!readMore(reader))
+		{
+			return false;
+		}
+	}
+	reader.start += (size_t)bytes;
+	return true;
+}
+
+static
+uint32_t readLittle(const uint8_t* p, size_t bytes)
+{
+	uint32_t value = 0;
+	for (size_t i = bytes; i > 0; --i)
+	{
+		value = (value << 8) | p[i - 1];
+	}
+	return value;
+}
+
+static
+void writeLittle(uint8_t* p, uint32_t value, size_t bytes)
+{
+	for (size_t i = 0; i < bytes; ++i)
+	{
+		p[i] = (uint8_t)(value >> (8 * i));
+	}
+}
+
+static
+uint64_t readBig(const uint8_t* p, size_t bytes)
+{
+	uint64_t value = 0;
+	for (size_t i = 0; i < bytes; ++i)
+	{
+		value = (value << 8) | p[i];
+	}
+	return value;
+}
+
+static
+double readExtended(const uint8_t* p)
+{
+	// AIFF's 80-bit IEEE 754 extended precision sample rate
+	int exponent = (int)(readBig(p, 2) & 0x7fff);
+	uint64_t mantissa = readBig(p + 2, 8);
+	double value = exponent == 0 && mantissa == 0 ? 0.0 : std::ldexp((double)mantissa, exponent - 16383 - 63);
+	return (p[0] & 0x80) != 0 ? -value : value;
+}
+
+static
+bool makeFormat(SampleFormat& format, bool isFloat, bool isSigned, size_t sampleSize, bool bigEndian)
+{
+	// false for anything the converter can't take
+	format.sampleSize = sampleSize;
+	format.bigEndian = sampleSize > 1 && bigEndian;
+	if (isFloat)
+	{
+		format.sampleFormat = paFloat32;
+		return sampleSize == sizeof(float);
+	}
+	switch (sampleSize)
+	{
+		case 1:
+			format.sampleFormat = isSigned ? paInt8 : paUInt8;
+			return true;
+		case 2:
+			format.sampleFormat = paInt16;
+			return true;
+		case 3:
+			format.sampleFormat = paInt24;
+			return true;
+		case 4:
+			format.sampleFormat = paInt32;
+			return true;
+		default:
+			return false;
+	}
+}
+
+static
+bool sniffWave(HeaderReader& reader, InputHeader& header)
+{
+	reader.start += 12;
+	bool haveFormat = false;
+	while (fill(reader, 8))
+	{
+		const uint8_t* chunk = reader.buffer + reader.start;
+		uint32_t size = readLittle(chunk + 4, 4);
+		if (memcmp(chunk, "data", 4) == 0)
+		{
+			reader.start += 8;
+			header.dataBytes = size != 0xffffffff ? size : 0;	// streamed WAVs leave it zero or all ones
+			return haveFormat;
+		}
+		if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16)
+		{
+			if (!fill(reader, 8 + (size_t)size))
+			{
+				return false;
+			}
+			const uint8_t* fmt = reader.buffer + reader.start + 8;
+			uint32_t formatTag = readLittle(fmt, 2);
+			header.channels = (int)readLittle(fmt + 2, 2);
+			header.sampleRate = readLittle(fmt + 4, 4);
+			size_t blockAlign = readLittle(fmt + 12, 2);
+			if (formatTag == 0xfffe && size >= 40)
+			{
+				formatTag = readLittle(fmt + 24, 2);	// WAVE_FORMAT_EXTENSIBLE's subformat GUID starts with the real tag
+			}
+			if (header.channels <= 0 || blockAlign % header.channels != 0 || (formatTag != 1 && formatTag != 3) ||
+				!makeFormat(header.format, formatTag == 3, false, blockAlign / header.channels, false))
+			{
+				return false;
+			}
+			haveFormat = true;
+		}
+		if (!skip(reader, 8 + (uint64_t)size + (size & 1)))
+		{
+			return false;
+		}
+	}
+	return false;
+}
+
+static
+bool sniffAiff(HeaderReader& reader, InputHeader& header)
+{
+	bool isAifc = memcmp(reader.buffer + reader.start + 8, "AIFC", 4) == 0;
+	reader.start += 12;
+	bool haveFormat = false;
+	while (fill(reader, 8))
+	{
+		const uint8_t* chunk = reader.buffer + reader.start;
+		uint32_t size = (uint32_t)readBig(chunk + 4, 4);
+		if (memcmp(chunk, "SSND", 4) == 0 && size >= 8)
+		{
+			if (!fill(reader, 16))
+			{
+				return false;
+			}
+			uint32_t offset = (uint32_t)readBig(reader.buffer + reader.start + 8, 4);
+			reader.start += 16;
+			header.dataBytes = size - 8 >= offset ? size - 8 - offset : 0;
+			return haveFormat && skip(reader, offset);
+		}
+		if (memcmp(chunk, "COMM", 4) == 0 && size >= 18)
+		{
+			if (!fill(reader, isAifc ? 30 : 26))
+			{
+				return false;
+			}
+			const uint8_t* comm = reader.buffer + reader.start + 8;
+			header.channels = (int)readBig(comm, 2);
+			size_t sampleSize = ((size_t)readBig(comm + 6, 2) + 7) / 8;
+			header.sampleRate = readExtended(comm + 8);
+			
+			// plain AIFF is always big-endian signed integers; AIFC says what it is
+			bool isFloat = false;
+			bool isSigned = true;
+			bool bigEndian = true;
+			if (isAifc && size >= 22)
+			{
+				const uint8_t* compression = comm + 18;
+				if (memcmp(compression, "sowt", 4) == 0)
+				{
+					bigEndian = false;
+				}
+				else if (memcmp(compression, "fl32", 4) == 0 || memcmp(compression, "FL32", 4) == 0)
+				{
+					isFloat = true;
+				}
+				else if (memcmp(compression, "raw ", 4) == 0)
+				{
+					isSigned = false;
+				}
+				else if (memcmp(compression, "NONE", 4) != 0 && memcmp(compression, "twos", 4) != 0)
+				{
+					return false;	// actually compressed
+				}
+			}
+			if (header.channels <= 0 || header.sampleRate <= 0.0 || !makeFormat(header.format, isFloat, isSigned, sampleSize, bigEndian))
+			{
+				return false;
+			}
+			haveFormat = true;
+		}
+		if (!skip(reader, 8 + (uint64_t)size + (size & 1)))
+		{
+			return false;
+		}
+	}
+	return false;
+}
+
+static
+bool sniffCaf(HeaderReader& reader, InputHeader& header)
+{
+	reader.start += 8;
+	bool haveFormat = false;
+	while (fill(reader, 12))
+	{
+		const uint8_t* chunk = reader.buffer + reader.start;
+		uint64_t size = readBig(chunk + 4, 8);
+		if (memcmp(chunk, "data", 4) == 0 && fill(reader, 16))
+		{
+			reader.start += 16;	// past the edit count too
+			header.dataBytes = size != ~(uint64_t)0 && size >= 4 ? size - 4 : 0;
+			return haveFormat;
+		}
+		if (memcmp(chunk, "desc", 4) == 0 && size >= 32)
+		{
+			if (!fill(reader, 44))
+			{
+				return false;
+			}
+			const uint8_t* desc = reader.buffer + reader.start + 12;
+			uint64_t rateBits = readBig(desc, 8);
+			memcpy(&header.sampleRate, &rateBits, sizeof(header.sampleRate));
+			uint32_t formatFlags = (uint32_t)readBig(desc + 12, 4);
+			header.channels = (int)readBig(desc + 24, 4);
+			size_t bytesPerPacket = (size_t)readBig(desc + 16, 4);
+			if (memcmp(desc + 8, "lpcm", 4) != 0 || header.channels <= 0 || bytesPerPacket % header.channels != 0 ||
+				!(header.sampleRate > 0.0) ||
+				!makeFormat(header.format, (formatFlags & 1) != 0, true, bytesPerPacket / header.channels, (formatFlags & 2) == 0))
+			{
+				return false;
+			}
+			haveFormat = true;
+		}
+		if (size == ~(uint64_t)0 || !skip(reader, 12 + size))
+		{
+			return false;
+		}
+	}
+	return false;
+}
+
+bool parseClipHeader(const uint8_t* bytes, InputHeader& header)
+{
+	memset(&header, 0, sizeof(header));
+	header.type = kHeaderClip;
+	if (memcmp(bytes, "PPcl", 4) != 0 || bytes[7] != 0)
+	{
+		return false;
+	}
+	header.channels = (int)readLittle(bytes + 4, 2);
+	header.sampleRate = readLittle(bytes + 8, 4);
+	header.dataBytes = readLittle(bytes + 12, 4) | ((uint64_t)readLittle(bytes + 16, 4) << 32);
+	
+	// the codes go in the same order as -F's formats
+	static const size_t kSampleSizes[] = { 1, 1, 2, 3, 4, 4 };
+	uint8_t code = bytes[6] & 0x7f;
+	return header.channels > 0 && header.sampleRate > 0.0 && code < sizeof(kSampleSizes) / sizeof(kSampleSizes[0]) &&
+		makeFormat(header.format, code == 5, code != 0, kSampleSizes[code], (bytes[6] & 0x80) != 0);
+}
+
+bool makeWaveHeader(uint8_t* bytes, const SampleFormat& format, int channels, double sampleRate, uint64_t dataBytes)
+{
+	if (format.sampleFormat == paInt8 || format.bigEndian)
+	{
+		return false;
+	}
+	uint32_t blockAlign = (uint32_t)(format.sampleSize * channels);
+	uint32_t dataSize = (uint32_t)std::min(dataBytes, (uint64_t)(0xffffffffu - (kWaveHeaderBytes - 8)));
+	memcpy(bytes, "RIFF", 4);
+	writeLittle(bytes + 4, dataSize + (uint32_t)(kWaveHeaderBytes - 8), 4);
+	memcpy(bytes + 8, "WAVEfmt ", 8);
+	writeLittle(bytes + 16, 16, 4);
+	writeLittle(bytes + 20, format.sampleFormat == paFloat32 ? 3 : 1, 2);
+	writeLittle(bytes + 22, (uint32_t)channels, 2);
+	writeLittle(bytes + 24, (uint32_t)sampleRate, 4);
+	writeLittle(bytes + 28, (uint32_t)sampleRate * blockAlign, 4);
+	writeLittle(bytes + 32, blockAlign, 2);
+	writeLittle(bytes + 34, (uint32_t)(format.sampleSize * 8), 2);
+	memcpy(bytes + 36, "data", 4);
+	writeLittle(bytes + 40, dataSize, 4);
+	return true;
+}
+
+static
+bool couldMatch(const uint8_t* buffer, size_t bytes, size_t offset, const char* magic)
+{
+	// whether as much of the input as we have so far could still have magic at offset
+	size_t length = bytes > offset ? std::min(bytes - offset, (size_t)4) : 0;
+	return memcmp(buffer + offset, magic, length) == 0;
+}
+
+static
+HeaderType headerType(const uint8_t* buffer, size_t bytes)
+{
+	if (couldMatch(buffer, bytes, 0, "RIFF") && couldMatch(buffer, bytes, 8, "WAVE"))
+	{
+		return kHeaderWave;
+	}
+	if (couldMatch(buffer, bytes, 0, "FORM") && (couldMatch(buffer, bytes, 8, "AIFF") || couldMatch(buffer, bytes, 8, "AIFC")))
+	{
+		return kHeaderAiff;
+	}
+	if (couldMatch(buffer, bytes, 0, "caff"))
+	{
+		return kHeaderCaf;
+	}
+	if (couldMatch(buffer, bytes, 0, "fLaC"))
+	{
+		return kHeaderFlac;
+	}
+	if (couldMatch(buffer, bytes, 0, "OggS"))
+	{
+		return kHeaderOgg;
+	}
+	if (couldMatch(buffer, bytes, 0, "PPcl"))
+	{
+		return kHeaderClip;
+	}
+	return kHeaderNone;
+}
+
+const char* headerTypeName(HeaderType type)
+{
+	switch (type)
+	{
+		case kHeaderWave:
+			return "WAV";
+		case kHeaderAiff:
+			return "AIFF";
+		case kHeaderCaf:
+			return "CAF";
+		case kHeaderFlac:
+			return "FLAC";
+		case kHeaderOgg:
+			return "Ogg";
+		case kHeaderClip:
+			return "clip";
+		default:
+			return "raw";
+	}
+}
+
+bool sniffHeader(int fd, uint8_t* peek, size_t& peekBytes, InputHeader& header)
+{
+	memset(&header, 0, sizeof(header));
+	HeaderReader reader = { fd, peek, 0, 0 };
+	peekBytes = 0;
+	ssize_t bytesRead = 0;
+	do
+	{
+		bytesRead = read(fd, peek, kHeaderPeekBytes);
+	} while (bytesRead < 0 && errno == EINTR);
+	if (bytesRead <= 0)
+	{
+		return bytesRead == 0;	// nothing at all is just an empty raw stream
+	}
+	reader.end = (size_t)bytesRead;
+	
+	// a short first read only holds us up while it could still be the start of a header
+	const size_t kMagicBytes = 12;
+	HeaderType type = headerType(reader.buffer, reader.end);
+	while (type != kHeaderNone && reader.end < kMagicBytes && readMore(reader))
+	{
+		type = headerType(reader.buffer, reader.end);
+	}
+	if (reader.end < kMagicBytes)
+	{
+		type = kHeaderNone;
+	}
+	
+	bool playable = true;
+	header.type = type;
+	switch (type)
+	{
+		case kHeaderWave:
+			playable = sniffWave(reader, header);
+			break;
+		case kHeaderAiff:
+			playable = sniffAiff(reader, header);
+			break;
+		case kHeaderCaf:
+			playable = sniffCaf(reader, header);
+			break;
+		case kHeaderClip:
+			// the writer reads every clip's header itself, this one included
+			playable = fill(reader, kClipHeaderBytes) && parseClipHeader(reader.buffer, header);
+			break;
+		default:
+			break;
+	}
+	
+	peekBytes = reader.end - reader.start;
+	memmove(peek, peek + reader.start, peekBytes);
+	return playable;
+}
@@ -0,0 +1,80 @@
+/* header.h
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPEPLAYER_HEADER_H
+#define PIPEPLAYER_HEADER_H
+
+#include <cstddef>		// size_t
+#include <cstdint>		// uint8_t, uint64_t
+
+#include "convert.h"
+
+enum HeaderType
+{
+	kHeaderNone,	// raw PCM, as far as we can tell
+	kHeaderWave,	// RIFF/WAVE
+	kHeaderAiff,	// AIFF or AIFC
+	kHeaderCaf,		// Core Audio Format
+	kHeaderFlac,	// native FLAC, which has to be decoded
+	kHeaderOgg,		// Ogg, taken to be Opus, which has to be decoded
+	kHeaderClip,	// clips, each with its own format, played back to back
+};
+
+struct InputHeader
+{
+	HeaderType type;
+	SampleFormat format;
+	int channels;
+	double sampleRate;
+	uint64_t dataBytes;	// zero when the header doesn't say, as when it was written to a pipe
+};
+
+static const size_t kHeaderPeekBytes = 512;	// the most we read before knowing whether there's a header at all
+
+// input framed as clips, so a playlist in a mix of formats can play without a gap between
+// them; each clip is this header and then its PCM, the header being, all little-endian:
+//	0	"PPcl"
+//	4	channels (16 bits)
+//	6	sample format: 0 u8, 1 s8, 2 s16, 3 s24, 4 s32, or 5 float, plus 0x80 if big-endian
+//	7	zero
+//	8	sample rate in Hz (32 bits)
+//	12	bytes of PCM to follow (64 bits), or all ones for the rest of the input
+static const size_t kClipHeaderBytes = 20;
+static const uint64_t kClipToEnd = ~(uint64_t)0;
+
+const char* headerTypeName(HeaderType type);
+
+// reads the first chunk of fd into peek, which must hold kHeaderPeekBytes; if that starts a
+// header we know, keeps reading (skipping chunks we don't need) to the start of the audio
+// and fills in header, otherwise header.type is kHeaderNone and fd has been read just once.
+// either way, the peekBytes left at the start of peek are the first of the audio, except
+// that a compressed stream is left whole for its decoder, and header says nothing more
+// about it, and clips are left whole too, with header saying what the first one is.
+// returns false if reading failed, or with header.type set if the header is one we can't play
+bool sniffHeader(int fd, uint8_t* peek, size_t& peekBytes, InputHeader& header);
+
+// fills in header from the kClipHeaderBytes at bytes, with dataBytes possibly kClipToEnd;
+// returns false if they aren't a clip header, or not one for PCM we can play
+bool parseClipHeader(const uint8_t* bytes, InputHeader& header);
+
+// fills in the kWaveHeaderBytes at bytes with a plain RIFF/WAVE header for dataBytes of PCM
+// in format, clamped to what its 32-bit sizes can say; returns false if WAV can't hold the
+// format, as with signed 8-bit or anything big-endian
+static const size_t kWaveHeaderBytes = 44;
+bool makeWaveHeader(uint8_t* bytes, const SampleFormat& format, int channels, double sampleRate, uint64_t dataBytes);
+
+#endif
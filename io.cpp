@@ -0,0 +1,407 @@
+/* io.cpp
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "io.h"
+
+#include <algorithm>	// std::max, std::min
+#include <cerrno>		// errno, EBUSY, EINTR, ENOSYS, ETIME
+#include <cmath>		// std::ceil, std::isfinite
+#include <cstdint>		// uint8_t
+#include <fcntl.h>		// fcntl, F_SETFL, O_NONBLOCK
+#include <poll.h>		// poll, pollfd
+#include <unistd.h>		// close, pipe, read, write
+
+#if defined(PIPEPLAYER_URING)
+#include <climits>		// INT_MAX
+#include <csignal>		// _NSIG
+#include <cstdlib>		// calloc, free
+#include <cstring>		// memset
+#include <linux/io_uring.h>	// io_uring_cqe, io_uring_getevents_arg, io_uring_params, io_uring_sqe, IORING_*
+#include <sys/mman.h>	// mmap, munmap, MAP_FAILED, MAP_POPULATE, MAP_SHARED, PROT_READ, PROT_WRITE
+#include <sys/syscall.h>	// __NR_io_uring_enter, __NR_io_uring_register, __NR_io_uring_setup
+#include <sys/uio.h>	// iovec
+#endif
+
+bool openWakePipe(int fds[2])
+{
+	if (pipe(fds) != 0)
+	{
+		fds[0] = fds[1] = -1;
+		return false;
+	}
+	if (fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0 || fcntl(fds[1], F_SETFL, O_NONBLOCK) != 0)
+	{
+		int error = errno;
+		closeWakePipe(fds);
+		errno = error;
+		return false;
+	}
+	return true;
+}
+
+void closeWakePipe(int fds[2])
+{
+	for (int i = 0; i < 2; ++i)
+	{
+		if (fds[i] != -1)
+		{
+			close(fds[i]);
+			fds[i] = -1;
+		}
+	}
+}
+
+void wakeWriter(int wakeFd)
+{
+	// one byte is enough; if the pipe is somehow full, the writer is already due to wake up
+	uint8_t byte = 0;
+	if (write(wakeFd, &byte, 1) < 0)
+	{
+		// nothing we can do about it from here
+	}
+}
+
+void drainWakePipe(int wakeFd)
+{
+	uint8_t bytes[64];
+	while (read(wakeFd, bytes, sizeof(bytes)) > 0)
+	{
+	}
+}
+
+int waitForInput(int wakeFd, int inputFd, bool wantInput, int timeoutMs)
+{
+	pollfd fds[2] =
+	{
+		{ wakeFd, POLLIN, 0 },
+		{ inputFd, POLLIN, 0 },
+	};
+	int ready = poll(fds, wantInput ? 2 : 1, timeoutMs);	// poll ignores negative descriptors
+	if (ready < 0)
+	{
+		return errno == EINTR ? 0 : -1;
+	}
+	
+	if (fds[0].revents & POLLIN)
+	{
+		drainWakePipe(wakeFd);
+	}
+	return (wantInput && fds[1].revents != 0) ? 1 : 0;
+}
+
+#if defined(PIPEPLAYER_URING)
+
+// there's no libc wrapper for io_uring, and liburing would be a whole dependency for the
+// handful of calls we make
+
+static const unsigned kRingEntries = 4;	// a read, a wakeup poll, and a cancel, with room to spare
+static const __u64 kReadTag = 1;
+static const __u64 kWakeTag = 2;
+static const __u64 kCancelTag = 3;
+
+struct RingState
+{
+	int fd;
+	uint8_t* rings;		// the submission and completion queues, in one mapping
+	size_t ringsBytes;
+	io_uring_sqe* sqes;
+	size_t sqesBytes;
+	unsigned* sqHead;
+	unsigned* sqTail;
+	unsigned sqMask;
+	unsigned* sqArray;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned cqMask;
+	io_uring_cqe* cqes;
+	
+	int wakeFd;
+	bool polling;		// the wakeup pipe's poll is in flight
+	uint8_t* memory;	// registered as fixed buffer 0, unless registering it failed
+	size_t memoryBytes;
+	bool registered;
+};
+
+static
+io_uring_sqe* queueEntry(RingState& ring)
+{
+	// we're the only submitter, with never more than kRingEntries in flight, so there's
+	// always a free entry; the kernel sees it at the next io_uring_enter
+	unsigned tail = *ring.sqTail;
+	unsigned index = tail & ring.sqMask;
+	io_uring_sqe* sqe = &ring.sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring.sqArray[index] = index;
+	return sqe;
+}
+
+static
+void submitEntry(RingState& ring)
+{
+	__atomic_store_n(ring.sqTail, *ring.sqTail + 1, __ATOMIC_RELEASE);
+}
+
+static
+int enterRing(RingState& ring, int timeoutMs)
+{
+	// submits whatever's queued and waits for a completion, if there isn't one already
+	bool completed = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE) != *ring.cqHead;
+	unsigned submit = *ring.sqTail - __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE);
+	__kernel_timespec timeout = { timeoutMs / 1000, (long long)(timeoutMs % 1000) * 1000000 };
+	io_uring_getevents_arg arg = {};
+	arg.sigmask_sz = _NSIG / 8;
+	arg.ts = timeoutMs >= 0 ? (__u64)(uintptr_t)&timeout : 0;
+	if (submit == 0 && completed)
+	{
+		return 0;
+	}
+	return (int)syscall(__NR_io_uring_enter, ring.fd, submit, completed ? 0 : 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+}
+
+static
+void closeRing(RingState* ring)
+{
+	if (ring->sqes != nullptr && ring->sqes != MAP_FAILED)
+	{
+		munmap(ring->sqes, ring->sqesBytes);
+	}
+	if (ring->rings != nullptr && ring->rings != MAP_FAILED)
+	{
+		munmap(ring->rings, ring->ringsBytes);
+	}
+	if (ring->fd >= 0)
+	{
+		close(ring->fd);	// which cancels anything still in flight
+	}
+	free(ring);
+}
+
+bool openInputRing(InputRing& inputRing, int wakeFd, void* memory, size_t bytes)
+{
+	inputRing = InputRing();
+	RingState* ring = (RingState*)calloc(1, sizeof(RingState));
+	if (ring == nullptr)
+	{
+		return false;
+	}
+	
+	// completions are only ever reaped by this thread, in io_uring_enter, so the kernel can
+	// put off their work until then; older kernels just don't get to
+	const unsigned kSetupFlags[] = { IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN, IORING_SETUP_COOP_TASKRUN, 0 };
+	io_uring_params params;
+	ring->fd = -1;
+	for (size_t i = 0; i < sizeof(kSetupFlags) / sizeof(kSetupFlags[0]) && ring->fd < 0; ++i)
+	{
+		memset(&params, 0, sizeof(params));
+		params.flags = kSetupFlags[i];
+		ring->fd = (int)syscall(__NR_io_uring_setup, kRingEntries, &params);
+		if (ring->fd < 0 && errno != EINVAL)
+		{
+			break;
+		}
+	}
+	if (ring->fd >= 0 && (~params.features & (IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG)) != 0)
+	{
+		errno = ENOSYS;	// before 5.11, which we don't bother with
+		closeRing(ring);
+		return false;
+	}
+	if (ring->fd < 0)
+	{
+		int error = errno;
+		closeRing(ring);
+		errno = error;
+		return false;
+	}
+	
+	ring->ringsBytes = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned), params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+	ring->rings = (uint8_t*)mmap(nullptr, ring->ringsBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+	ring->sqes = (io_uring_sqe*)mmap(nullptr, ring->sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->rings == MAP_FAILED || ring->sqes == MAP_FAILED)
+	{
+		int error = errno;
+		closeRing(ring);
+		errno = error;
+		return false;
+	}
+	ring->sqHead = (unsigned*)(ring->rings + params.sq_off.head);
+	ring->sqTail = (unsigned*)(ring->rings + params.sq_off.tail);
+	ring->sqMask = *(unsigned*)(ring->rings + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned*)(ring->rings + params.sq_off.array);
+	ring->cqHead = (unsigned*)(ring->rings + params.cq_off.head);
+	ring->cqTail = (unsigned*)(ring->rings + params.cq_off.tail);
+	ring->cqMask = *(unsigned*)(ring->rings + params.cq_off.ring_mask);
+	ring->cqes = (io_uring_cqe*)(ring->rings + params.cq_off.cqes);
+	
+	// registering pins the memory, which RLIMIT_MEMLOCK may not allow; unregistered
+	// reads are only a little slower
+	iovec iov = { memory, bytes };
+	ring->memory = (uint8_t*)memory;
+	ring->memoryBytes = bytes;
+	ring->registered = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+	ring->wakeFd = wakeFd;
+	inputRing.state = ring;
+	return true;
+}
+
+void closeInputRing(InputRing& inputRing)
+{
+	if (inputRing.state != nullptr)
+	{
+		closeRing((RingState*)inputRing.state);
+	}
+	inputRing = InputRing();
+}
+
+static
+int reapRing(InputRing& inputRing, ssize_t& bytesRead)
+{
+	// returns 1 if the read landed
+	RingState& ring = *(RingState*)inputRing.state;
+	int result = 0;
+	unsigned head = *ring.cqHead;
+	unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head)
+	{
+		const io_uring_cqe& cqe = ring.cqes[head & ring.cqMask];
+		if (cqe.user_data == kReadTag)
+		{
+			inputRing.reading = false;
+			bytesRead = cqe.res;
+			if (cqe.res < 0)
+			{
+				errno = -cqe.res;
+				bytesRead = -1;
+			}
+			result = 1;
+		}
+		else if (cqe.user_data == kWakeTag)
+		{
+			ring.polling = false;
+			drainWakePipe(ring.wakeFd);
+		}
+	}
+	__atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+	return result;
+}
+
+int waitForInputRing(InputRing& inputRing, int inputFd, bool wantInput, void* buffer, size_t bytes, int timeoutMs, ssize_t& bytesRead)
+{
+	RingState& ring = *(RingState*)inputRing.state;
+	if (!ring.polling && ring.wakeFd >= 0)
+	{
+		io_uring_sqe* sqe = queueEntry(ring);
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = ring.wakeFd;
+		sqe->poll32_events = POLLIN;
+		sqe->user_data = kWakeTag;
+		submitEntry(ring);
+		ring.polling = true;
+	}
+	if (wantInput && !inputRing.reading)
+	{
+		uint8_t* target = (uint8_t*)buffer;
+		io_uring_sqe* sqe = queueEntry(ring);
+		sqe->opcode = IORING_OP_READ;
+		if (ring.registered && target >= ring.memory && target + bytes <= ring.memory + ring.memoryBytes)
+		{
+			sqe->opcode = IORING_OP_READ_FIXED;
+			sqe->buf_index = 0;
+		}
+		sqe->fd = inputFd;
+		sqe->addr = (__u64)(uintptr_t)buffer;
+		sqe->len = (__u32)std::min(bytes, (size_t)INT_MAX);
+		sqe->off = (__u64)-1;	// from the file position, as read() would, which pipes need
+		sqe->user_data = kReadTag;
+		submitEntry(ring);
+		inputRing.reading = true;
+	}
+	
+	if (enterRing(ring, timeoutMs) < 0 && errno != EINTR && errno != ETIME && errno != EBUSY)
+	{
+		return -1;
+	}
+	return reapRing(inputRing, bytesRead);
+}
+
+ssize_t cancelInputRing(InputRing& inputRing)
+{
+	if (inputRing.state == nullptr || !inputRing.reading)
+	{
+		return 0;
+	}
+	
+	RingState& ring = *(RingState*)inputRing.state;
+	io_uring_sqe* sqe = queueEntry(ring);
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = kReadTag;
+	sqe->user_data = kCancelTag;
+	submitEntry(ring);
+	
+	ssize_t bytesRead = 0;
+	while (inputRing.reading)
+	{
+		if (enterRing(ring, -1) < 0 && errno != EINTR && errno != EBUSY)
+		{
+			break;
+		}
+		reapRing(inputRing, bytesRead);
+	}
+	return std::max(bytesRead, (ssize_t)0);	// usually -1, with ECANCELED
+}
+
+#else
+
+bool openInputRing(InputRing& ring, int wakeFd, void* memory, size_t bytes)
+{
+	ring = InputRing();
+	errno = ENOSYS;
+	return false;
+}
+
+void closeInputRing(InputRing& ring)
+{
+}
+
+int waitForInputRing(InputRing& ring, int inputFd, bool wantInput, void* buffer, size_t bytes, int timeoutMs, ssize_t& bytesRead)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+ssize_t cancelInputRing(InputRing& ring)
+{
+	return 0;
+}
+
+#endif
+
+int pollTimeout(std::chrono::duration<double> timeout, std::chrono::duration<double> elapsed)
+{
+	if (!std::isfinite(timeout.count()))
+	{
+		return -1;
+	}
+	std::chrono::duration<double, std::milli> remaining(timeout - elapsed);
+	return (int)std::max(std::ceil(remaining.count()), 0.0);
+}
+
+int minTimeout(int a, int b)
+{
+	return a < 0 ? b : (b < 0 ? a : std::min(a, b));
+}
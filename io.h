@@ -0,0 +1,75 @@
+/* io.h
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPEPLAYER_IO_H
+#define PIPEPLAYER_IO_H
+
+#include <chrono>		// std::chrono
+#include <cstddef>		// size_t
+#include <sys/types.h>	// ssize_t
+
+// the waiting the writers do, on their input and on a wakeup pipe the stream callbacks (and
+// signal handlers) poke when there's room for more, kept here so the rest of pipeplayer
+// doesn't care how the platform does it; every wait is one poll(), which for the couple of
+// descriptors we watch, changing from one wait to the next, is as cheap as readiness gets,
+// short of an InputRing doing the read as well. Windows can't wait on an anonymous pipe,
+// so a backend there would be a thread doing blocking ReadFile()s that sets an event; there
+// isn't one yet, since the rest of pipeplayer still needs fork, mmap and sockets
+
+// creates a pipe with both ends nonblocking; returns false with errno set if it can't
+bool openWakePipe(int fds[2]);
+void closeWakePipe(int fds[2]);
+
+// safe from a stream callback or a signal handler
+void wakeWriter(int wakeFd);
+
+// empties the pipe so the next wait doesn't return straight away
+void drainWakePipe(int wakeFd);
+
+// blocks until inputFd is readable (if wantInput), wakeFd has been poked, or timeoutMs
+// passes (forever if negative), draining wakeFd; returns 1 if the input is ready, 0 if not,
+// -1 on error; either descriptor may be -1 to leave it out
+int waitForInput(int wakeFd, int inputFd, bool wantInput, int timeoutMs);
+
+// a Linux io_uring that keeps a read of the input in flight straight into memory registered
+// with it up front, along with a poll of the wakeup pipe, so queueing the next read and
+// waiting for that or a wakeup is a single io_uring_enter rather than a poll and a read
+struct InputRing
+{
+	void* state;	// null when it isn't open
+	bool reading;	// a read is in flight, into memory the caller mustn't touch until it lands
+};
+
+// false with errno set if this build or this kernel can't do it; memory is what reads go into
+bool openInputRing(InputRing& ring, int wakeFd, void* memory, size_t bytes);
+void closeInputRing(InputRing& ring);
+
+// like waitForInput, except that when wantInput and there isn't a read in flight, it first
+// queues one of up to bytes into buffer; returns 1 once a read lands, with bytesRead (and
+// errno) as read() would have returned them, 0 if woken or out of time first, -1 on error
+int waitForInputRing(InputRing& ring, int inputFd, bool wantInput, void* buffer, size_t bytes, int timeoutMs, ssize_t& bytesRead);
+
+// cancels the read in flight, if any, returning what it read if it landed anyway
+ssize_t cancelInputRing(InputRing& ring);
+
+// how long a wait may last before timeout runs out, given elapsed so far, or -1 for forever
+int pollTimeout(std::chrono::duration<double> timeout, std::chrono::duration<double> elapsed);
+
+// the sooner of two pollTimeout()s
+int minTimeout(int a, int b);
+
+#endif
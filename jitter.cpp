@@ -0,0 +1,168 @@
+/* jitter.cpp
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "jitter.h"
+
+#include <cstdlib>		// free, malloc
+#include <cstring>		// memcpy, memset
+
+bool parseRtp(const uint8_t* packet, size_t bytes, uint16_t& sequence, const uint8_t*& payload, size_t& payloadBytes)
+{
+	const size_t kHeaderBytes = 12;
+	if (bytes < kHeaderBytes || (packet[0] >> 6) != 2)
+	{
+		return false;
+	}
+	
+	size_t offset = kHeaderBytes + (size_t)(packet[0] & 0x0f) * 4;	// CSRCs
+	if ((packet[0] & 0x10) != 0 && offset + 4 <= bytes)
+	{
+		offset += 4 + (((size_t)packet[offset + 2] << 8) | packet[offset + 3]) * 4;	// extension header and its words
+	}
+	size_t end = bytes;
+	if ((packet[0] & 0x20) != 0 && packet[bytes - 1] <= bytes)
+	{
+		end -= packet[bytes - 1];	// padding, counted in its own last byte
+	}
+	if (offset >= end)
+	{
+		return false;
+	}
+	
+	sequence = (uint16_t)((packet[2] << 8) | packet[3]);
+	payload = packet + offset;
+	payloadBytes = end - offset;
+	return true;
+}
+
+bool initJitterBuffer(JitterBuffer& jitter, size_t maxPayloadBytes, size_t holdPackets)
+{
+	memset(&jitter, 0, sizeof(jitter));
+	jitter.maxPayloadBytes = maxPayloadBytes;
+	jitter.holdPackets = holdPackets > 0 ? holdPackets : 1;
+	jitter.payloads = (uint8_t*)malloc(JitterBuffer::kSlots * maxPayloadBytes);
+	jitter.silence = (uint8_t*)malloc(maxPayloadBytes);
+	jitter.last = (uint8_t*)malloc(maxPayloadBytes);
+	return jitter.payloads != nullptr && jitter.silence != nullptr && jitter.last != nullptr;
+}
+
+void freeJitterBuffer(JitterBuffer& jitter)
+{
+	free(jitter.payloads);
+	free(jitter.silence);
+	free(jitter.last);
+	jitter.payloads = nullptr;
+	jitter.silence = nullptr;
+	jitter.last = nullptr;
+}
+
+static
+size_t jitterSlot(uint16_t sequence)
+{
+	return sequence & (JitterBuffer::kSlots - 1);
+}
+
+void jitterInsert(JitterBuffer& jitter, uint16_t sequence, const uint8_t* payload, size_t bytes)
+{
+	if (bytes > jitter.maxPayloadBytes)
+	{
+		bytes = jitter.maxPayloadBytes;
+	}
+	if (!jitter.started)
+	{
+		jitter.started = true;
+		jitter.nextSequence = sequence;
+		jitter.highestSequence = sequence;
+	}
+	
+	// sequence numbers wrap, so everything is relative to the next one we're due to hand out
+	int16_t ahead = (int16_t)(uint16_t)(sequence - jitter.nextSequence);
+	if (ahead < 0 && (size_t)-ahead <= JitterBuffer::kSlots)
+	{
+		++jitter.late;
+		return;
+	}
+	if (ahead < 0 || (size_t)ahead >= JitterBuffer::kSlots)
+	{
+		// too far either way to be reordering: the sender restarted (at a sequence number of
+		// its own choosing, so as likely behind as ahead) or we lost a lot, so start over from here
+		++jitter.resyncs;
+		memset(jitter.payloadSizes, 0, sizeof(jitter.payloadSizes));
+		jitter.nextSequence = sequence;
+		jitter.highestSequence = sequence;
+		ahead = 0;
+	}
+	
+	size_t slot = jitterSlot(sequence);
+	if (jitter.payloadSizes[slot] != 0)
+	{
+		++jitter.duplicates;
+		return;
+	}
+	memcpy(jitter.payloads + slot * jitter.maxPayloadBytes, payload, bytes);
+	jitter.payloadSizes[slot] = bytes;
+	++jitter.received;
+	if ((int16_t)(uint16_t)(sequence - jitter.highestSequence) > 0)
+	{
+		jitter.highestSequence = sequence;
+	}
+}
+
+const uint8_t* jitterNext(JitterBuffer& jitter, size_t& bytes, bool& concealed)
+{
+	if (!jitter.started)
+	{
+		return nullptr;
+	}
+	
+	concealed = false;
+	size_t slot = jitterSlot(jitter.nextSequence);
+	if (jitter.payloadSizes[slot] != 0)
+	{
+		bytes = jitter.payloadSizes[slot];
+		return jitter.payloads + slot * jitter.maxPayloadBytes;
+	}
+	
+	// nothing to hand out at all (we're past the highest), or a gap we're still waiting to fill
+	int16_t ahead = (int16_t)(uint16_t)(jitter.highestSequence - jitter.nextSequence);
+	if (ahead < (int16_t)jitter.holdPackets)
+	{
+		return nullptr;
+	}
+	concealed = true;
+	bytes = jitter.lastBytes;
+	return jitter.lostRun == 0 ? jitter.last : jitter.silence;
+}
+
+void jitterAdvance(JitterBuffer& jitter)
+{
+	size_t slot = jitterSlot(jitter.nextSequence);
+	size_t bytes = jitter.payloadSizes[slot];
+	if (bytes != 0)
+	{
+		memcpy(jitter.last, jitter.payloads + slot * jitter.maxPayloadBytes, bytes);
+		jitter.lastBytes = bytes;
+		jitter.lostRun = 0;
+		jitter.payloadSizes[slot] = 0;
+	}
+	else
+	{
+		++jitter.lost;
+		++jitter.lostRun;
+	}
+	++jitter.nextSequence;
+}
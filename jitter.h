@@ -0,0 +1,67 @@
+/* jitter.h
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPEPLAYER_JITTER_H
+#define PIPEPLAYER_JITTER_H
+
+#include <cstddef>		// size_t
+#include <cstdint>		// uint8_t, uint16_t
+
+// pulls the sequence number and payload out of an RTP packet, skipping any CSRCs, header
+// extension, and padding; returns false if it isn't a version 2 packet with a payload
+bool parseRtp(const uint8_t* packet, size_t bytes, uint16_t& sequence, const uint8_t*& payload, size_t& payloadBytes);
+
+// puts packets back in sequence order, holding back a gap until holdPackets later packets
+// have arrived before giving up on it; a lost packet is concealed by repeating the one
+// before it, and any more in a row by silence, so the output keeps its timing either way
+struct JitterBuffer
+{
+	static const size_t kSlots = 256;	// packets in flight at once, a power of two
+	
+	uint8_t* payloads;			// kSlots of maxPayloadBytes each, indexed by sequence number
+	size_t payloadSizes[kSlots];	// zero for an empty slot
+	size_t maxPayloadBytes;
+	uint8_t* silence;			// maxPayloadBytes of silence in the payload's format, for the caller to fill in
+	uint8_t* last;				// the last payload handed out, for concealing the next if it's lost
+	size_t lastBytes;
+	int lostRun;				// how many we've concealed in a row
+	size_t holdPackets;			// at least one, and well under kSlots
+	
+	bool started;
+	uint16_t nextSequence;		// the next one to hand out
+	uint16_t highestSequence;
+	
+	unsigned long received;
+	unsigned long lost;
+	unsigned long late;			// arrived after we'd given up on them
+	unsigned long duplicates;
+	unsigned long resyncs;		// jumps too far ahead or behind to be reordering
+};
+
+// returns false if allocation fails
+bool initJitterBuffer(JitterBuffer& jitter, size_t maxPayloadBytes, size_t holdPackets);
+
+void freeJitterBuffer(JitterBuffer& jitter);
+
+void jitterInsert(JitterBuffer& jitter, uint16_t sequence, const uint8_t* payload, size_t bytes);
+
+// the next payload in sequence, or its concealment if we've given up on it (with concealed
+// set), or nullptr if there's nothing to hand out yet; it stays put until jitterAdvance
+const uint8_t* jitterNext(JitterBuffer& jitter, size_t& bytes, bool& concealed);
+void jitterAdvance(JitterBuffer& jitter);
+
+#endif
@@ -0,0 +1,299 @@
+/* mix.cpp
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "mix.h"
+
+#include <algorithm>	// std::max, std::min
+
+#include "simd.h"
+
+// vector kernels for the cases that matter: summing with matching channels, ramping a gain
+// over frames that fill whole vectors or pack evenly into one, and clamping; each returns
+// how many samples (or for ramps, frames) it handled, leaving the rest to the scalar loops
+
+#if PIPEPLAYER_AVX2
+
+static
+size_t mixVector(float* mix, const float* input, size_t samples, float gain)
+{
+	const __m256 g = _mm256_set1_ps(gain);
+	size_t i = 0;
+	for (; i + 8 <= samples; i += 8)
+	{
+		_mm256_storeu_ps(mix + i, _mm256_add_ps(_mm256_loadu_ps(mix + i), _mm256_mul_ps(_mm256_loadu_ps(input + i), g)));
+	}
+	return i;
+}
+
+static
+size_t rampVector(float* samples, size_t frames, int channels, float gain, float step)
+{
+	size_t f = 0;
+	if (channels % 8 == 0)
+	{
+		for (; f < frames; ++f)
+		{
+			const __m256 g = _mm256_set1_ps(gain + step * f);
+			float* s = samples + f * channels;
+			for (int c = 0; c < channels; c += 8)
+			{
+				_mm256_storeu_ps(s + c, _mm256_mul_ps(_mm256_loadu_ps(s + c), g));
+			}
+		}
+	}
+	else if (8 % channels == 0)
+	{
+		// each lane is a step further along for each frame it's into the vector
+		const size_t group = 8 / channels;
+		float offsets[8];
+		for (int k = 0; k < 8; ++k)
+		{
+			offsets[k] = step * (k / channels);
+		}
+		const __m256 ramp = _mm256_loadu_ps(offsets);
+		for (; f + group <= frames; f += group)
+		{
+			float* s = samples + f * channels;
+			_mm256_storeu_ps(s, _mm256_mul_ps(_mm256_loadu_ps(s), _mm256_add_ps(_mm256_set1_ps(gain + step * f), ramp)));
+		}
+	}
+	return f;
+}
+
+static
+size_t saturateVector(float* samples, size_t count)
+{
+	const __m256 floor = _mm256_set1_ps(-1.0f);
+	const __m256 ceiling = _mm256_set1_ps(1.0f);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		_mm256_storeu_ps(samples + i, _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(samples + i), floor), ceiling));
+	}
+	return i;
+}
+
+#elif PIPEPLAYER_SSE2
+
+static
+size_t mixVector(float* mix, const float* input, size_t samples, float gain)
+{
+	const __m128 g = _mm_set1_ps(gain);
+	size_t i = 0;
+	for (; i + 4 <= samples; i += 4)
+	{
+		_mm_storeu_ps(mix + i, _mm_add_ps(_mm_loadu_ps(mix + i), _mm_mul_ps(_mm_loadu_ps(input + i), g)));
+	}
+	return i;
+}
+
+static
+size_t rampVector(float* samples, size_t frames, int channels, float gain, float step)
+{
+	size_t f = 0;
+	if (channels % 4 == 0)
+	{
+		for (; f < frames; ++f)
+		{
+			const __m128 g = _mm_set1_ps(gain + step * f);
+			float* s = samples + f * channels;
+			for (int c = 0; c < channels; c += 4)
+			{
+				_mm_storeu_ps(s + c, _mm_mul_ps(_mm_loadu_ps(s + c), g));
+			}
+		}
+	}
+	else if (4 % channels == 0)
+	{
+		// each lane is a step further along for each frame it's into the vector
+		const size_t group = 4 / channels;
+		float offsets[4];
+		for (int k = 0; k < 4; ++k)
+		{
+			offsets[k] = step * (k / channels);
+		}
+		const __m128 ramp = _mm_loadu_ps(offsets);
+		for (; f + group <= frames; f += group)
+		{
+			float* s = samples + f * channels;
+			_mm_storeu_ps(s, _mm_mul_ps(_mm_loadu_ps(s), _mm_add_ps(_mm_set1_ps(gain + step * f), ramp)));
+		}
+	}
+	return f;
+}
+
+static
+size_t saturateVector(float* samples, size_t count)
+{
+	const __m128 floor = _mm_set1_ps(-1.0f);
+	const __m128 ceiling = _mm_set1_ps(1.0f);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		_mm_storeu_ps(samples + i, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(samples + i), floor), ceiling));
+	}
+	return i;
+}
+
+#elif PIPEPLAYER_NEON
+
+static
+size_t mixVector(float* mix, const float* input, size_t samples, float gain)
+{
+	size_t i = 0;
+	for (; i + 4 <= samples; i += 4)
+	{
+		vst1q_f32(mix + i, vfmaq_n_f32(vld1q_f32(mix + i), vld1q_f32(input + i), gain));
+	}
+	return i;
+}
+
+static
+size_t rampVector(float* samples, size_t frames, int channels, float gain, float step)
+{
+	size_t f = 0;
+	if (channels % 4 == 0)
+	{
+		for (; f < frames; ++f)
+		{
+			const float g = gain + step * f;
+			float* s = samples + f * channels;
+			for (int c = 0; c < channels; c += 4)
+			{
+				vst1q_f32(s + c, vmulq_n_f32(vld1q_f32(s + c), g));
+			}
+		}
+	}
+	else if (4 % channels == 0)
+	{
+		// each lane is a step further along for each frame it's into the vector
+		const size_t group = 4 / channels;
+		float offsets[4];
+		for (int k = 0; k < 4; ++k)
+		{
+			offsets[k] = step * (k / channels);
+		}
+		const float32x4_t ramp = vld1q_f32(offsets);
+		for (; f + group <= frames; f += group)
+		{
+			float* s = samples + f * channels;
+			vst1q_f32(s, vmulq_f32(vld1q_f32(s), vaddq_f32(vdupq_n_f32(gain + step * f), ramp)));
+		}
+	}
+	return f;
+}
+
+static
+size_t saturateVector(float* samples, size_t count)
+{
+	const float32x4_t floor = vdupq_n_f32(-1.0f);
+	const float32x4_t ceiling = vdupq_n_f32(1.0f);
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		vst1q_f32(samples + i, vminq_f32(vmaxq_f32(vld1q_f32(samples + i), floor), ceiling));
+	}
+	return i;
+}
+
+#else
+
+static
+size_t mixVector(float* mix, const float* input, size_t samples, float gain)
+{
+	return 0;
+}
+
+static
+size_t rampVector(float* samples, size_t frames, int channels, float gain, float step)
+{
+	return 0;
+}
+
+static
+size_t saturateVector(float* samples, size_t count)
+{
+	return 0;
+}
+
+#endif
+
+void mixInto(float* mix, const float* input, size_t frames, int inputChannels, int mixChannels, float gain)
+{
+	if (inputChannels == mixChannels)
+	{
+		size_t samples = frames * mixChannels;
+		for (size_t i = mixVector(mix, input, samples, gain); i < samples; ++i)
+		{
+			mix[i] += input[i] * gain;
+		}
+		return;
+	}
+	
+	for (size_t f = 0; f < frames; ++f)
+	{
+		const float* in = input + f * inputChannels;
+		float* out = mix + f * mixChannels;
+		if (inputChannels == 1)
+		{
+			for (int c = 0; c < mixChannels; ++c)
+			{
+				out[c] += in[0] * gain;
+			}
+		}
+		else
+		{
+			for (int c = 0; c < std::min(inputChannels, mixChannels); ++c)
+			{
+				out[c] += in[c] * gain;
+			}
+		}
+	}
+}
+
+float rampGain(float* samples, size_t frames, int channels, float gain, float step)
+{
+	if (step == 0.0f)
+	{
+		// every sample gets the same gain, so the channels don't matter
+		size_t count = frames * channels;
+		for (size_t i = rampVector(samples, count, 1, gain, 0.0f); i < count; ++i)
+		{
+			samples[i] *= gain;
+		}
+		return gain;
+	}
+	
+	for (size_t f = rampVector(samples, frames, channels, gain, step); f < frames; ++f)
+	{
+		const float g = gain + step * f;
+		float* s = samples + f * channels;
+		for (int c = 0; c < channels; ++c)
+		{
+			s[c] *= g;
+		}
+	}
+	return gain + step * frames;
+}
+
+void saturateSamples(float* samples, size_t count)
+{
+	for (size_t i = saturateVector(samples, count); i < count; ++i)
+	{
+		samples[i] = std::min(std::max(samples[i], -1.0f), 1.0f);
+	}
+}
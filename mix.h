@@ -0,0 +1,35 @@
+/* mix.h
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPEPLAYER_MIX_H
+#define PIPEPLAYER_MIX_H
+
+#include <cstddef>		// size_t
+
+// adds gain times frames of input into mix, which has mixChannels channels; input with the
+// same channel count is summed straight across, mono input is spread to every channel, and
+// anything else sums its first channels into the mix's first channels
+void mixInto(float* mix, const float* input, size_t frames, int inputChannels, int mixChannels, float gain);
+
+// multiplies frames of samples by a gain that starts out at gain and moves by step every frame,
+// returning the gain the next frame would get; with a step of zero it's just a scale
+float rampGain(float* samples, size_t frames, int channels, float gain, float step);
+
+// clamps samples to [-1, 1], so a hot mix clips rather than wrapping or overloading the device
+void saturateSamples(float* samples, size_t count);
+
+#endif
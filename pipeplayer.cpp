@@ -15,41 +15,497 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-#include <algorithm>	// std::min
+#include <algorithm>	// std::max, std::min
+#include <atomic>		// std::atomic, std::atomic_thread_fence
+#include <cerrno>		// errno, EAGAIN, ECONNABORTED, EINTR, ENAMETOOLONG, ESPIPE, EWOULDBLOCK
 #include <chrono>		// std::chrono
+#include <cctype>		// tolower
 #include <climits>		// CHAR_BIT
-#include <cstdio>		// fprintf
-#include <cstdlib>		// atof, atoi, free, malloc
-#include <cstring>		// memset, strcmp
+#include <cmath>		// std::ceil, std::fabs, std::pow, std::sin
+#include <cstdio>		// fflush, fprintf, printf, setvbuf, snprintf
+#include <cstdlib>		// atof, atoi, free, malloc, strtod, strtol
+#include <csignal>		// sig_atomic_t, sigaction, signal, SIGINT, SIGPIPE, SIGTERM, SIGUSR1, SIG_DFL, SIG_IGN
+#include <cstring>		// memchr, memcpy, memmove, memset, strcmp, strerror, strlen, strncpy, strrchr, strtok_r
 #include <limits>		// std::numeric_limits
-#include <thread>		// std::this_thread
-#include <type_traits>	// std::is_unsigned
-#include <unistd.h>		// getopt, fd_set, read, select, timeval
+#include <thread>		// std::thread
+#include <fcntl.h>		// fcntl, open, F_GETFL, O_CREAT, O_NONBLOCK, O_RDONLY, O_TRUNC, O_WRONLY
+#include <netdb.h>		// addrinfo, freeaddrinfo, gai_strerror, getaddrinfo
+#include <netinet/in.h>	// ip_mreq, ipv6_mreq, sockaddr_in, sockaddr_in6, IN_MULTICAST
+#include <poll.h>		// poll, pollfd
+#include <pthread.h>	// pthread_self, pthread_setschedparam
+#include <sched.h>		// sched_get_priority_max, sched_param, SCHED_FIFO
+#include <sys/ioctl.h>	// ioctl, FIONREAD
+#include <sys/mman.h>	// madvise, mmap, munmap
+#include <sys/socket.h>	// accept, bind, listen, recv, recvmmsg, setsockopt, socket, AF_UNIX, SOCK_DGRAM, SOCK_STREAM
+#include <sys/stat.h>	// fstat, stat, S_ISFIFO, S_ISREG, S_ISSOCK
+#include <sys/uio.h>	// iovec, readv
+#include <sys/un.h>		// sockaddr_un
+#include <sys/wait.h>	// waitpid
+#include <unistd.h>		// _exit, close, dup, dup2, fork, getopt, lseek, pipe, pwrite, read, sysconf, unlink, write
 
 #include "portaudio.h"
-#include "portaudio/src/common/pa_ringbuffer.h"
 #include "portaudio/src/common/pa_util.h"
 
+// only the host-API extensions this platform's PortAudio can actually have
+#if defined(_WIN32)
+#include "pa_win_wasapi.h"	// PaWasapiStreamInfo, paWinWasapiExclusive, paWinWasapiThreadPriority
+#elif defined(__APPLE__)
+#include "pa_mac_core.h"	// PaMacCore_SetupStreamInfo, PaMacCoreStreamInfo, paMacCorePro
+#elif defined(PIPEPLAYER_ALSA)
+#include "pa_linux_alsa.h"	// PaAlsa_EnableRealtimeScheduling
+#endif
+
+#include "convert.h"
+#include "decode.h"
+#include "header.h"
+#include "io.h"
+#include "jitter.h"
+#include "mix.h"
+#include "remap.h"
+#include "resample.h"
+#include "ring.h"
+#include "tee.h"
+
+static
+void makeSilence(PaSampleFormat sampleFormat, size_t sampleSize, uint8_t* buffer, size_t samples)
+{
+	// center is zero for all formats except unsigned 8-bit, where it is 128
+	uint8_t sample[sizeof(float)] = {0};
+	switch (sampleFormat)
+	{
+		case paUInt8:
+			sample[0] = 0x80;
+			break;
+		case paFloat32:
+			{
+				float center = 0.0f;
+				memcpy(sample, &center, sizeof(center));
+			}
+			break;
+		default:
+			break;
+	}
+	
+	for (size_t i = 0; i < samples; ++i)
+	{
+		memcpy(buffer + i * sampleSize, sample, sampleSize);
+	}
+}
+
+template<typename T>
+static
+void atomicMin(std::atomic<T>& a, T value)
+{
+	T current = a.load(std::memory_order_relaxed);
+	while (value < current && !a.compare_exchange_weak(current, value, std::memory_order_relaxed))
+	{
+	}
+}
+
 template<typename T>
 static
-T nextPowerOfTwo(T v)
+void atomicMax(std::atomic<T>& a, T value)
+{
+	T current = a.load(std::memory_order_relaxed);
+	while (value > current && !a.compare_exchange_weak(current, value, std::memory_order_relaxed))
+	{
+	}
+}
+
+struct Stats
+{
+	// bumped by the writer
+	std::atomic<unsigned long long> framesWritten;	// into our buffers from stdin
+	std::atomic<unsigned long long> readCalls;
+	std::atomic<unsigned long long> bytesRead;
+	
+	// bumped by the stream callback (or the blocking writer, on its behalf)
+	std::atomic<unsigned long long> framesPlayed;	// handed to PortAudio
+	std::atomic<unsigned long> underruns;	// callbacks with nothing at all to play
+	std::atomic<unsigned long> partialCallbacks;	// callbacks we could only partly fill
+	
+	// ring buffer fill seen by the stream callback since the last report
+	std::atomic<long> minFill;
+	std::atomic<long> maxFill;
+};
+
+static
+void resetFillStats(Stats& stats, long& minFill, long& maxFill)
+{
+	minFill = stats.minFill.exchange(std::numeric_limits<long>::max(), std::memory_order_relaxed);
+	maxFill = stats.maxFill.exchange(-1, std::memory_order_relaxed);
+	if (minFill > maxFill)
+	{
+		// no callbacks since last time
+		minFill = maxFill = -1;
+	}
+}
+
+static
+void printStats(Stats* const* outputStats, size_t outputCount, bool json)
+{
+	// the writer's counters live with the first output's; any others get a line of their own
+	Stats& stats = *outputStats[0];
+	unsigned long long readCalls = stats.readCalls.load(std::memory_order_relaxed);
+	unsigned long long bytesRead = stats.bytesRead.load(std::memory_order_relaxed);
+	double bytesPerRead = readCalls > 0 ? (double)bytesRead / readCalls : 0.0;
+	long minFill = 0;
+	long maxFill = 0;
+	resetFillStats(stats, minFill, maxFill);
+	
+	fprintf(stdout,
+		json ?
+			"{\"written\":%llu,\"played\":%llu,\"underruns\":%lu,\"partial\":%lu,\"minFill\":%ld,\"maxFill\":%ld,\"reads\":%llu,\"bytesPerRead\":%.1f}\n" :
+			"stats: written=%llu played=%llu underruns=%lu partial=%lu minFill=%ld maxFill=%ld reads=%llu bytesPerRead=%.1f\n",
+		stats.framesWritten.load(std::memory_order_relaxed),
+		stats.framesPlayed.load(std::memory_order_relaxed),
+		stats.underruns.load(std::memory_order_relaxed),
+		stats.partialCallbacks.load(std::memory_order_relaxed),
+		minFill,
+		maxFill,
+		readCalls,
+		bytesPerRead
+	);
+	for (size_t i = 1; i < outputCount; ++i)
+	{
+		Stats& output = *outputStats[i];
+		resetFillStats(output, minFill, maxFill);
+		fprintf(stdout,
+			json ?
+				"{\"output\":%zu,\"played\":%llu,\"underruns\":%lu,\"partial\":%lu,\"minFill\":%ld,\"maxFill\":%ld}\n" :
+				"stats: output=%zu played=%llu underruns=%lu partial=%lu minFill=%ld maxFill=%ld\n",
+			i,
+			output.framesPlayed.load(std::memory_order_relaxed),
+			output.underruns.load(std::memory_order_relaxed),
+			output.partialCallbacks.load(std::memory_order_relaxed),
+			minFill,
+			maxFill
+		);
+	}
+	fflush(stdout);
+}
+
+struct Histogram
+{
+	// log-linear buckets in the manner of HdrHistogram: values below 2^kSubBucketBits get
+	// a bucket each, and every power of two above that is split into 2^kSubBucketBits
+	// sub-buckets, so each bucket is within 1/8th of its value
+	static const int kSubBucketBits = 3;
+	static const int kBucketCount = 256;	// enough for values up to about 2^33
+	
+	std::atomic<unsigned long> counts[kBucketCount];
+	std::atomic<unsigned long> total;
+	std::atomic<unsigned long long> max;
+};
+
+static
+int histogramBucket(unsigned long long value)
+{
+	int msb = 0;
+	while ((value >> msb) > 1)
+	{
+		++msb;
+	}
+	if (msb < Histogram::kSubBucketBits)
+	{
+		return (int)value;
+	}
+	int shift = msb - Histogram::kSubBucketBits;
+	int bucket = ((shift + 1) << Histogram::kSubBucketBits) + (int)((value >> shift) - (1ULL << Histogram::kSubBucketBits));
+	return std::min(bucket, Histogram::kBucketCount - 1);
+}
+
+static
+unsigned long long histogramBucketLimit(int bucket)
+{
+	// the largest value that lands in this bucket
+	if (bucket < (1 << Histogram::kSubBucketBits))
+	{
+		return (unsigned long long)bucket;
+	}
+	int shift = (bucket >> Histogram::kSubBucketBits) - 1;
+	unsigned long long base = (unsigned long long)((bucket & ((1 << Histogram::kSubBucketBits) - 1)) + (1 << Histogram::kSubBucketBits));
+	return ((base + 1) << shift) - 1;
+}
+
+static
+void histogramRecord(Histogram& histogram, unsigned long long value)
+{
+	histogram.counts[histogramBucket(value)].fetch_add(1, std::memory_order_relaxed);
+	histogram.total.fetch_add(1, std::memory_order_relaxed);
+	atomicMax(histogram.max, value);
+}
+
+static
+unsigned long long histogramPercentile(const Histogram& histogram, double percentile)
+{
+	unsigned long total = histogram.total.load(std::memory_order_relaxed);
+	unsigned long wanted = (unsigned long)std::ceil(total * percentile / 100.0);
+	unsigned long seen = 0;
+	for (int i = 0; i < Histogram::kBucketCount; ++i)
+	{
+		seen += histogram.counts[i].load(std::memory_order_relaxed);
+		if (seen >= wanted && seen > 0)
+		{
+			return std::min(histogramBucketLimit(i), histogram.max.load(std::memory_order_relaxed));
+		}
+	}
+	return 0;
+}
+
+static
+void printHistogram(const char* name, const Histogram& histogram)
+{
+	fprintf(stdout, "%s: n=%lu p50=%lluus p90=%lluus p99=%lluus p99.9=%lluus max=%lluus\n",
+		name,
+		histogram.total.load(std::memory_order_relaxed),
+		histogramPercentile(histogram, 50.0),
+		histogramPercentile(histogram, 90.0),
+		histogramPercentile(histogram, 99.0),
+		histogramPercentile(histogram, 99.9),
+		histogram.max.load(std::memory_order_relaxed)
+	);
+}
+
+struct Timing
+{
+	Histogram jitter;	// how far each callback strayed from when the previous one said it would come
+	Histogram latency;	// from the callback to its output hitting the DAC
+	std::atomic<unsigned long> underflowFlags;
+	std::atomic<unsigned long> overflowFlags;
+	
+	// when the first callback came, and the first with any input to play, as
+	// high_resolution_clock ticks; zero until they have
+	std::atomic<long long> firstCallback;
+	std::atomic<long long> firstAudio;
+	
+	// only touched by the stream callback
+	double sampleRate;
+	PaTime lastCallbackTime;
+	unsigned long lastFramesPerBuffer;
+};
+
+static
+void recordTiming(Timing& timing, const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, unsigned long framesPerBuffer)
 {
-	static_assert(std::is_unsigned<T>::value, "T is not an unsigned type");
+	if (statusFlags & paOutputUnderflow)
+	{
+		timing.underflowFlags.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (statusFlags & paOutputOverflow)
+	{
+		timing.overflowFlags.fetch_add(1, std::memory_order_relaxed);
+	}
 	
-	--v;
-	for (size_t i = 1; i < (sizeof(v) * CHAR_BIT); i <<= 1)
+	// some host APIs don't keep time, and report zero
+	if (timeInfo == nullptr || timeInfo->currentTime <= 0.0)
+	{
+		return;
+	}
+	if (timing.lastCallbackTime > 0.0)
+	{
+		PaTime expected = timing.lastFramesPerBuffer / timing.sampleRate;
+		PaTime actual = timeInfo->currentTime - timing.lastCallbackTime;
+		histogramRecord(timing.jitter, (unsigned long long)(std::fabs(actual - expected) * 1e6));
+	}
+	if (timeInfo->outputBufferDacTime > timeInfo->currentTime)
 	{
-		v |= v >> i;
+		histogramRecord(timing.latency, (unsigned long long)((timeInfo->outputBufferDacTime - timeInfo->currentTime) * 1e6));
 	}
-	return ++v;
+	timing.lastCallbackTime = timeInfo->currentTime;
+	timing.lastFramesPerBuffer = framesPerBuffer;
 }
 
+static
+void recordFirstAudio(Timing& timing, bool audible)
+{
+	// after the first audible callback, this is just the one load
+	if (timing.firstAudio.load(std::memory_order_relaxed) != 0)
+	{
+		return;
+	}
+	long long now = (long long)std::chrono::high_resolution_clock::now().time_since_epoch().count();
+	if (timing.firstCallback.load(std::memory_order_relaxed) == 0)
+	{
+		timing.firstCallback.store(now, std::memory_order_relaxed);
+	}
+	if (audible)
+	{
+		timing.firstAudio.store(now, std::memory_order_relaxed);
+	}
+}
+
+static
+void printTiming(const Timing& timing)
+{
+	printHistogram("callback jitter", timing.jitter);
+	printHistogram("output latency", timing.latency);
+	fprintf(stdout, "output underflow flags: %lu, overflow flags: %lu\n",
+		timing.underflowFlags.load(std::memory_order_relaxed),
+		timing.overflowFlags.load(std::memory_order_relaxed)
+	);
+	fflush(stdout);
+}
+
+// set from a SIGUSR1 handler to ask the writer for a timing summary, along with a poke
+// of the writer's wakeup pipe so it doesn't sleep through the request
+static std::atomic<bool> timingRequested(false);
+static int signalWakeFd = -1;
+
+// likewise from SIGINT and SIGTERM when serving, since there's no EOF to stop us otherwise
+static std::atomic<bool> stopRequested(false);
+
+struct MixInput;
+
+static const size_t kGainCommands = 16;	// queued for a stream callback at once
+
+struct GainCommand
+{
+	float target;
+	unsigned long frames;	// to ramp there over; zero to jump straight there
+};
+
+struct GainControl
+{
+	// the control thread's commands for one stream callback, which alone keeps the ramp
+	// they set going, so it never has to wait on anyone to change the gain
+	FrameRing commands;
+	GainCommand commandMemory[kGainCommands];
+	float gain;
+	float target;
+	float step;					// per frame, while ramping
+	unsigned long rampFrames;	// left until gain reaches target
+	
+	// output that isn't mixed goes through float in buffer, bufferFrames at a time, to be
+	// scaled; at unity gain or muted it doesn't have to
+	int channels;
+	ToFloatFunction toFloat;
+	FromFloatFunction fromFloat;
+	float* buffer;
+	unsigned long bufferFrames;
+};
+
 struct CallbackData
 {
-	PaUtilRingBuffer ringBuffer;
-	uint8_t silenceByte;
+	FrameRing ringBuffer;
+	const uint8_t* silence;	// silenceFrames frames of silence in the stream's format
+	unsigned long silenceFrames;
+	Stats* stats;
+	Timing* timing;
+	
+	// the writer sets this before it blocks on a full ring buffer, and a stream callback
+	// clears it and pokes wakeFd once at least wakeThreshold frames are free; with several
+	// outputs they all share the one flag
+	std::atomic<bool>* writerWaiting;
+	size_t wakeThreshold;
+	int wakeFd;
+	
+	// set once the writer has queued the last of its input, so the stream callback can
+	// complete the stream after playing out what's left instead of padding with silence
+	std::atomic<bool> draining;
+	
+	// when stdin is a file we could map, we play straight out of that instead of the ring
+	// buffer; only the stream callback moves the cursor
+	const uint8_t* mapping;
+	size_t mappingFrames;
+	std::atomic<size_t> mappingCursor;
+	
+	// when mixing, the stream callback sums each input's ring buffer of float frames into
+	// mixBuffer instead, a mixBufferFrames chunk at a time, and converts that for the device
+	MixInput* mixInputs;
+	size_t mixInputCount;
+	float* mixBuffer;
+	unsigned long mixBufferFrames;
+	int channels;
+	FromFloatFunction fromFloat;
+	
+	GainControl* gainControl;	// null without a control channel
 };
 
+static
+void playSilence(const CallbackData& callbackData, uint8_t* output, unsigned long frames)
+{
+	size_t frameSize = callbackData.ringBuffer.frameSize;
+	while (frames > 0)
+	{
+		unsigned long chunk = std::min(frames, callbackData.silenceFrames);
+		memcpy(output, callbackData.silence, (size_t)chunk * frameSize);
+		output += (size_t)chunk * frameSize;
+		frames -= chunk;
+	}
+}
+
+static
+void takeGainCommands(GainControl& control)
+{
+	// only the latest command counts; a new ramp heads for its target from wherever the
+	// last one had got to
+	GainCommand command;
+	while (ringRead(control.commands, &command, 1) == 1)
+	{
+		control.target = command.target;
+		control.rampFrames = command.frames;
+		control.step = command.frames > 0 ? (command.target - control.gain) / command.frames : 0.0f;
+		if (command.frames == 0)
+		{
+			control.gain = command.target;
+		}
+	}
+}
+
+static
+void applyGain(GainControl& control, float* samples, unsigned long frames)
+{
+	// the rest of any ramp, then whatever gain it left us at
+	unsigned long rampFrames = std::min(frames, control.rampFrames);
+	if (rampFrames > 0)
+	{
+		control.gain = rampGain(samples, rampFrames, control.channels, control.gain, control.step);
+		control.rampFrames -= rampFrames;
+		if (control.rampFrames == 0)
+		{
+			control.gain = control.target;	// not quite where the steps add up to
+		}
+	}
+	if (frames > rampFrames && control.gain != 1.0f)
+	{
+		rampGain(samples + (size_t)rampFrames * control.channels, frames - rampFrames, control.channels, control.gain, 0.0f);
+	}
+}
+
+static
+void gainOutput(const CallbackData& callbackData, uint8_t* output, unsigned long frames)
+{
+	GainControl& control = *callbackData.gainControl;
+	takeGainCommands(control);
+	if (control.rampFrames == 0 && control.gain == 1.0f)
+	{
+		return;
+	}
+	else if (control.rampFrames == 0 && control.gain == 0.0f)
+	{
+		playSilence(callbackData, output, frames);
+		return;
+	}
+	
+	// a boost can take float output past full scale, which the integer formats clip anyway
+	bool boosting = control.gain > 1.0f || control.target > 1.0f;
+	size_t frameSize = callbackData.ringBuffer.frameSize;
+	for (unsigned long framesDone = 0; framesDone < frames; )
+	{
+		unsigned long chunk = std::min(frames - framesDone, control.bufferFrames);
+		uint8_t* out = output + (size_t)framesDone * frameSize;
+		control.toFloat(out, control.buffer, (size_t)chunk * control.channels);
+		applyGain(control, control.buffer, chunk);
+		if (boosting)
+		{
+			saturateSamples(control.buffer, (size_t)chunk * control.channels);
+		}
+		control.fromFloat(control.buffer, out, (size_t)chunk * control.channels);
+		framesDone += chunk;
+	}
+}
+
 static
 int streamCallback(
     const void* inputBuffer,
@@ -61,109 +517,742 @@ int streamCallback(
 )
 {
 	CallbackData* callbackData = (CallbackData*)userData;
-	PaUtilRingBuffer& ringBuffer = callbackData->ringBuffer;
-	// read as much as we can from the ring buffer directly into the output buffer
-	ring_buffer_size_t framesRead = PaUtil_ReadRingBuffer(
-		&ringBuffer,
-		outputBuffer,
-		std::min((ring_buffer_size_t)framesPerBuffer, PaUtil_GetRingBufferReadAvailable(&ringBuffer))
-	);
+	FrameRing& ringBuffer = callbackData->ringBuffer;
+	recordTiming(*callbackData->timing, timeInfo, statusFlags, framesPerBuffer);
+	bool draining = callbackData->draining.load(std::memory_order_acquire);	// before looking at the ring, so we see everything queued before it was set
+	
+	uint8_t* output = (uint8_t*)outputBuffer;
+	size_t framesAvailable = 0;
+	size_t framesRead = 0;
+	if (callbackData->mapping != nullptr)
+	{
+		size_t cursor = callbackData->mappingCursor.load(std::memory_order_relaxed);
+		framesAvailable = callbackData->mappingFrames - cursor;
+		framesRead = std::min((size_t)framesPerBuffer, framesAvailable);
+		memcpy(output, callbackData->mapping + cursor * ringBuffer.frameSize, framesRead * ringBuffer.frameSize);
+		callbackData->mappingCursor.store(cursor + framesRead, std::memory_order_relaxed);
+	}
+	else
+	{
+		// copy as much as we can straight out of the ring buffer's regions into the output buffer
+		const uint8_t* data1 = nullptr;
+		const uint8_t* data2 = nullptr;
+		size_t size1 = 0;
+		size_t size2 = 0;
+		framesAvailable = ringReadAvailable(ringBuffer);
+		framesRead = ringReadRegions(ringBuffer, framesPerBuffer, data1, size1, data2, size2);
+		
+		size_t bytes1 = size1 * ringBuffer.frameSize;
+		memcpy(output, data1, bytes1);
+		if (size2 > 0)
+		{
+			memcpy(output + bytes1, data2, size2 * ringBuffer.frameSize);
+		}
+		ringAdvanceRead(ringBuffer, framesRead);
+	}
+	
+	Stats& stats = *callbackData->stats;
+	stats.framesPlayed.fetch_add((unsigned long long)framesRead, std::memory_order_relaxed);
+	atomicMin(stats.minFill, (long)framesAvailable);
+	atomicMax(stats.maxFill, (long)framesAvailable);
+	
+	if ((unsigned long)framesRead < framesPerBuffer)
+	{
+		// we ran dry, so pad out the rest of the buffer with silence; the end of a drain doesn't count
+		if (!draining)
+		{
+			(framesRead == 0 ? stats.underruns : stats.partialCallbacks).fetch_add(1, std::memory_order_relaxed);
+		}
+		
+		playSilence(*callbackData, output + framesRead * ringBuffer.frameSize, framesPerBuffer - (unsigned long)framesRead);
+	}
+	recordFirstAudio(*callbackData->timing, framesRead > 0);
 	
-	size_t bytesRead = framesRead * ringBuffer.elementSizeBytes;
-	size_t bytesLeft = (framesPerBuffer * ringBuffer.elementSizeBytes) - bytesRead;
-	// fill the rest of the buffer (if any) with silence
-	memset((uint8_t*)outputBuffer + bytesRead, callbackData->silenceByte, bytesLeft);
+	if (callbackData->gainControl != nullptr)
+	{
+		gainOutput(*callbackData, (uint8_t*)outputBuffer, framesPerBuffer);
+	}
+	
+	// let the writer know if it's waiting on us for room; the fence orders our read index
+	// update against the flag, pairing with the one the writer issues after setting it
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (callbackData->writerWaiting->load(std::memory_order_relaxed) &&
+		ringWriteAvailable(ringBuffer) >= callbackData->wakeThreshold &&
+		callbackData->writerWaiting->exchange(false))
+	{
+		wakeWriter(callbackData->wakeFd);
+	}
 	
+	// a mapped file can't grow, and a draining writer has nothing more to give, so once
+	// we've played all there is we're done
+	if ((callbackData->mapping != nullptr || draining) && framesRead == framesAvailable)
+	{
+		return paComplete;
+	}
 	return paContinue;
 }
 
 static
-int stdinReady(void)
+void requestTiming(int signal)
 {
-	fd_set readfds;
-	FD_ZERO(&readfds);
-	FD_SET(STDIN_FILENO, &readfds);
-	timeval tv = {0};
-	
-	return select(STDIN_FILENO + 1, &readfds, nullptr, nullptr, &tv);
+	timingRequested = true;
+	if (signalWakeFd != -1)
+	{
+		wakeWriter(signalWakeFd);
+	}
 }
 
-struct Options
+static
+void requestStop(int signal)
 {
-	// the defaults here for channels, format, rate, and buffer size all
-	// correspond to the values used for Mac Sound Driver emulation, for which
-	// this utility was originally written ;)
+	stopRequested = true;
+	if (signalWakeFd != -1)
+	{
+		wakeWriter(signalWakeFd);
+	}
+}
+
+static
+void streamFinished(void* userData)
+{
+	// make sure the writer notices the stream going away even if it's waiting on us
+	wakeWriter(((CallbackData*)userData)->wakeFd);
+}
+
+static
+int readRingBufferAsync(InputRing& inputRing, int fd, bool wantInput, int timeoutMs, FrameRing& ringBuffer, ssize_t& bytesRead)
+{
+	// like readRingBuffer, but waiting as waitForInputRing does, with the read left in flight
+	// until it lands, which may take more than one call. A read only goes into the first
+	// free region, so where that stops at the end of the buffer, one that fills it is
+	// followed straight away by another into the start, much as readRingBuffer's readv
+	// would have gone on into the second
+	uint8_t* data1 = nullptr;
+	uint8_t* data2 = nullptr;
+	size_t size1 = 0;
+	size_t size2 = 0;
+	ringWriteRegions(ringBuffer, ringBuffer.bytes, data1, size1, data2, size2);
+	int ready = waitForInputRing(inputRing, fd, wantInput && size1 > 0, data1, size1, timeoutMs, bytesRead);
+	if (ready == 1 && bytesRead > 0)
+	{
+		ringAdvanceWrite(ringBuffer, (size_t)bytesRead);
+		ssize_t moreRead = 0;
+		if (wantInput && size2 > 0 && bytesRead == (ssize_t)size1 &&
+			waitForInputRing(inputRing, fd, true, data2, size2, 0, moreRead) == 1 && moreRead > 0)
+		{
+			// and if it doesn't land now, it will on the next call
+			ringAdvanceWrite(ringBuffer, (size_t)moreRead);
+			bytesRead += moreRead;
+		}
+	}
+	return ready;
+}
+
+struct Ingest
+{
+	// everything between reading stdin and handing frames to the ring buffer or the device
+	Converter converter;
+	int channels;		// of the input, which a channel map can make into outputChannels
+	int outputChannels;
+	SampleFormat format;	// of the input
+	size_t frameSize;	// of the input, which may not be what the device gets
+	size_t outputFrameSize;
+	uint8_t* buffer;	// staging area for input that needs converting or resampling first
+	size_t bufferFrames;
 	
-	int channels = 1;
-	PaSampleFormat sampleFormat = paUInt8;
-	size_t sampleSize = 1;
-	double sampleRate = 22256.0;
-	long framesPerBuffer = 370;
+	// when resampling, input goes through float on its way through the resampler instead
+	// of through the converter, a floatBuffer at a time
+	bool resampling;
+	bool flushed;		// the resampler's had its silence at the end of the input
+	Resampler resampler;
+	ToFloatFunction toFloat;
+	FromFloatFunction fromFloat;
+	float* floatBuffer;
+	size_t floatBufferFrames;
 	
-	// the rest of these defaults I just thought were reasonable :)
-	PaStreamFlags streamFlags = paNoFlag;
-	double timeout = std::numeric_limits<double>::infinity();
-	int verbosity = 1;
+	// a channel map works on chunks of input as soon as they're in float, or before they're
+	// converted at all when it just moves channels around, into a remapBuffer of the same
+	// floatBufferFrames
+	const ChannelMap* map;
+	float* remapBuffer;
+	
+	size_t bytesPreloaded;	// input put where the first read would have gone before there was one, like what came in with a header
+	uint64_t bytesLeft;		// of input to read before it's over, when a header says where its audio ends; kInputToEnd otherwise
 };
 
+static const uint64_t kInputToEnd = ~(uint64_t)0;
+
 static
-void printUsage(void)
+size_t inputWanted(const Ingest& ingest, size_t bytes)
 {
-	fprintf(stdout,
-		"usage: pipeplayer [-h] [-c <channels>] [-f <format>] [-r <sample rate>] [-b <buffer size>] [-d <feature>] [-t <timeout>] [-v <level>]\n"
-		"\t-h: prints this message and exits\n"
-		"\t-c <channels>: number of channels (integer), default: 1\n"
-		"\t-f <sample format>: sample format (f, s16, s32, s24, s8, u8), default: u8\n"
-		"\t-r <sample rate>: sample rate (double-precision floating point), default: 22256.0\n"
-		"\t-b <buffer size>: buffer size in samples (integer), default: 370\n"
-		"\t-d <feature>: feature to disable (clipping, dithering), default: none\n"
-		"\t-t <timeout>: timeout in seconds after no new data arrives (double-precision floating point), default: forever\n"
-		"\t-v <level>: log verbosity level (integer), default: 1\n"
-	);
+	// how much of bytes a read can take without going past the end of the input's audio,
+	// into whatever chunks a header has after it
+	return (size_t)std::min((uint64_t)bytes, ingest.bytesLeft);
 }
 
 static
-int getIntArg(char opt, int defaultArg)
+void inputTaken(Ingest& ingest, ssize_t bytesRead)
 {
-	int result = atoi(optarg);
-	if (result < 0)
+	if (bytesRead > 0 && ingest.bytesLeft != kInputToEnd)
 	{
-		fprintf(stderr, "argument %s to option '-%c' is invalid, using default: %d\n", optarg, opt, defaultArg);
-		result = defaultArg;
+		ingest.bytesLeft -= (uint64_t)bytesRead;
 	}
-	return result;
 }
 
 static
-double getDoubleArg(char opt, double defaultArg)
+ssize_t readRingBuffer(int fd, FrameRing& ringBuffer, Ingest& ingest, Tee* tee)
 {
-	double result = atof(optarg);
-	if (result < 0)
+	// read as much as we can from fd directly into the free space of the ring buffer; a
+	// trailing partial frame goes in with the rest, and the stream callbacks just don't see
+	// it until a later read finishes it. Reads through a tee can come up short of the free
+	// space, which the next read goes on from, and none go past the end of the audio, which
+	// reads as EOF
+	uint8_t* data1 = nullptr;
+	uint8_t* data2 = nullptr;
+	size_t size1 = 0;
+	size_t size2 = 0;
+	ringWriteRegions(ringBuffer, inputWanted(ingest, ringBuffer.bytes), data1, size1, data2, size2);
+	if (size1 == 0)
 	{
-		fprintf(stderr, "argument %s to option '-%c' is invalid, using default: %.1f\n", optarg, opt, defaultArg);
-		result = defaultArg;
+		return 0;
 	}
-	return result;
+	
+	iovec iov[2];
+	iov[0].iov_base = data1;
+	iov[0].iov_len = size1;
+	iov[1].iov_base = data2;
+	iov[1].iov_len = size2;
+	
+	ssize_t bytesRead = readvTee(tee, fd, iov, size2 > 0 ? 2 : 1);
+	if (bytesRead > 0)
+	{
+		ringAdvanceWrite(ringBuffer, (size_t)bytesRead);
+	}
+	inputTaken(ingest, bytesRead);
+	return bytesRead;
 }
 
 static
-int getOpts(int argc, char* argv[], Options& options)
+size_t inputFramesFor(const Ingest& ingest, size_t outputFrames)
 {
-	const size_t kFormatOptsCount = 6;
-	struct FormatOptMapping
+	return ingest.resampling ? resamplerInputNeeded(ingest.resampler, outputFrames) : outputFrames;
+}
+
+static
+size_t processInput(Ingest& ingest, const uint8_t* input, size_t inputFrames, uint8_t* output, size_t outputFrames, size_t& framesConsumed)
+{
+	// turns staged input into as many device frames as fit in output, returning how many it
+	// made; framesConsumed says how much input it used, which the resampler may hang on to
+	if (!ingest.resampling)
 	{
-		const char* optarg;
+		framesConsumed = std::min(inputFrames, outputFrames);
+		if (ingest.map == nullptr)
+		{
+			convertSamples(ingest.converter, input, output, framesConsumed * ingest.channels);
+		}
+		else if (ingest.map->permutation && converterIsIdentity(ingest.converter))
+		{
+			remapSamples(*ingest.map, input, output, framesConsumed, ingest.converter.input.sampleSize);
+		}
+		else
+		{
+			for (size_t done = 0; done < framesConsumed; )
+			{
+				size_t frames = std::min(framesConsumed - done, ingest.floatBufferFrames);
+				const uint8_t* in = input + done * ingest.frameSize;
+				uint8_t* out = output + done * ingest.outputFrameSize;
+				if (ingest.map->permutation)
+				{
+					remapSamples(*ingest.map, in, ingest.remapBuffer, frames, ingest.converter.input.sampleSize);
+					convertSamples(ingest.converter, ingest.remapBuffer, out, frames * ingest.outputChannels);
+				}
+				else
+				{
+					ingest.toFloat(in, ingest.floatBuffer, frames * ingest.channels);
+					remapFloat(*ingest.map, ingest.floatBuffer, ingest.remapBuffer, frames);
+					ingest.fromFloat(ingest.remapBuffer, out, frames * ingest.outputChannels);
+				}
+				done += frames;
+			}
+		}
+		return framesConsumed;
+	}
+	
+	size_t framesProduced = 0;
+	framesConsumed = 0;
+	while (framesProduced < outputFrames)
+	{
+		size_t framesIn = std::min(std::min(inputFrames - framesConsumed, ingest.floatBufferFrames), resamplerInputSpace(ingest.resampler));
+		if (framesIn > 0)
+		{
+			const float* samples = ingest.floatBuffer;
+			ingest.toFloat(input + framesConsumed * ingest.frameSize, ingest.floatBuffer, framesIn * ingest.channels);
+			if (ingest.map != nullptr)
+			{
+				if (ingest.map->permutation)
+				{
+					remapSamples(*ingest.map, ingest.floatBuffer, ingest.remapBuffer, framesIn, sizeof(float));
+				}
+				else
+				{
+					remapFloat(*ingest.map, ingest.floatBuffer, ingest.remapBuffer, framesIn);
+				}
+				samples = ingest.remapBuffer;
+			}
+			resamplerWrite(ingest.resampler, samples, framesIn);
+			framesConsumed += framesIn;
+		}
+		
+		size_t framesOut = resamplerRead(ingest.resampler, ingest.floatBuffer, std::min(outputFrames - framesProduced, ingest.floatBufferFrames));
+		if (framesIn == 0 && framesOut == 0)
+		{
+			break;	// out of input
+		}
+		ingest.fromFloat(ingest.floatBuffer, output + framesProduced * ingest.outputFrameSize, framesOut * ingest.outputChannels);
+		framesProduced += framesOut;
+	}
+	return framesProduced;
+}
+
+static
+void drainStaging(FrameRing& ringBuffer, Ingest& ingest, size_t& bytesStaged)
+{
+	// processes whole staged frames into the ring buffer's free space, keeping whatever
+	// doesn't fit (and any trailing partial frame) at the front of the staging area
+	size_t framesStaged = bytesStaged / ingest.frameSize;
+	if (framesStaged == 0)
+	{
+		return;
+	}
+	
+	uint8_t* data1 = nullptr;
+	uint8_t* data2 = nullptr;
+	size_t size1 = 0;
+	size_t size2 = 0;
+	ringWriteRegions(ringBuffer, ringBuffer.bytes, data1, size1, data2, size2);
+	size1 /= ringBuffer.frameSize;
+	size2 /= ringBuffer.frameSize;
+	size_t framesConsumed = 0;
+	size_t framesProduced = processInput(ingest, ingest.buffer, framesStaged, data1, size1, framesConsumed);
+	if (size2 > 0 && framesProduced == size1)
+	{
+		size_t moreConsumed = 0;
+		framesProduced += processInput(ingest, ingest.buffer + framesConsumed * ingest.frameSize, framesStaged - framesConsumed, data2, size2, moreConsumed);
+		framesConsumed += moreConsumed;
+	}
+	ringAdvanceWrite(ringBuffer, framesProduced * ringBuffer.frameSize);
+	
+	bytesStaged -= framesConsumed * ingest.frameSize;
+	memmove(ingest.buffer, ingest.buffer + framesConsumed * ingest.frameSize, bytesStaged);
+}
+
+static
+void flushStaging(Ingest& ingest, size_t& bytesStaged)
+{
+	// the resampler hangs on to the last half of its filter's worth of input until there's
+	// more after it, so once the input's over and everything staged has gone in, it gets
+	// that much silence to finish with, as a clip does before a change of format; a partial
+	// frame the input ended on goes with it
+	if (ingest.resampling && !ingest.flushed && bytesStaged < ingest.frameSize)
+	{
+		size_t padFrames = std::min((size_t)ingest.resampler.taps / 2, ingest.bufferFrames);
+		makeSilence(ingest.format.sampleFormat, ingest.format.sampleSize, ingest.buffer, padFrames * ingest.channels);
+		bytesStaged = padFrames * ingest.frameSize;
+		ingest.flushed = true;
+	}
+}
+
+static
+bool ingestDrained(const Ingest& ingest, size_t bytesStaged)
+{
+	// once the input's over, whether everything staged (and flushStaging's silence after it)
+	// has gone into the ring buffer; a partial frame it ended on never will
+	return ingest.buffer == nullptr || (bytesStaged < ingest.frameSize && (!ingest.resampling || ingest.flushed));
+}
+
+static
+ssize_t readConvertRingBuffer(int fd, FrameRing& ringBuffer, Ingest& ingest, size_t& bytesStaged, Tee* tee)
+{
+	// like readRingBuffer, but when the input isn't what the device takes we have to stage
+	// it and process it from there; bytesStaged may include whole frames that didn't fit
+	// last time, in which case we may have nothing to read
+	size_t framesWanted = std::min(inputFramesFor(ingest, ringWriteAvailable(ringBuffer)), ingest.bufferFrames);
+	if (framesWanted * ingest.frameSize <= bytesStaged)
+	{
+		errno = EAGAIN;
+		return -1;
+	}
+	size_t bytes = inputWanted(ingest, framesWanted * ingest.frameSize - bytesStaged);
+	if (bytes == 0)
+	{
+		return 0;	// the audio's over, even if the input isn't
+	}
+	ssize_t bytesRead = readTee(tee, fd, ingest.buffer + bytesStaged, bytes);
+	if (bytesRead > 0)
+	{
+		bytesStaged += (size_t)bytesRead;
+		drainStaging(ringBuffer, ingest, bytesStaged);
+	}
+	inputTaken(ingest, bytesRead);
+	return bytesRead;
+}
+
+struct DriftControl
+{
+	// nudges the resampling ratio to hold the queue at a target depth when the input is
+	// clocked independently of the device, so neither clock slowly wins
+	double targetFrames;	// in device frames
+	double nominalStep;		// what the resampler started with
+	double averageFrames;	// queue depth, smoothed over the ring buffer's refill sawtooth
+	double integral;		// queue error in seconds, integrated over time
+	double correction;		// fraction the step is currently off nominal
+};
+
+static const double kDriftInterval = 0.05;			// seconds between updates
+static const double kDriftSmoothing = 2.0;			// time constant of averageFrames, in seconds
+static const double kDriftGain = 0.01;				// correction per second of queue error
+static const double kDriftMaxCorrection = 0.002;	// 2000ppm, about 3.5 cents of pitch
+
+static
+double queuedFrames(int inputFd, const FrameRing& ringBuffer, const Ingest& ingest, size_t bytesStaged)
+{
+	// everything between the producer and the stream callback, in device frames: what's
+	// in the ring buffer, plus what's staged or still sitting in the pipe
+	int bytesPending = 0;
+	if (ioctl(inputFd, FIONREAD, &bytesPending) != 0)
+	{
+		bytesPending = 0;
+	}
+	double inputFrames = (double)(bytesStaged + (size_t)std::max(bytesPending, 0)) / ingest.frameSize;
+	return ringReadAvailable(ringBuffer) + inputFrames / ingest.resampler.step;
+}
+
+static
+void updateDrift(DriftControl& drift, Resampler& resampler, double frames, double sampleRate, double elapsed)
+{
+	drift.averageFrames += (frames - drift.averageFrames) * std::min(elapsed / kDriftSmoothing, 1.0);
+	
+	// a PI loop, critically damped; positive error means input is piling up, so we take
+	// more input frames per output frame until it drains back down
+	const double kIntegralGain = kDriftGain * kDriftGain / 4.0;
+	double error = (drift.averageFrames - drift.targetFrames) / sampleRate;
+	drift.integral += error * elapsed;
+	drift.integral = std::min(std::max(drift.integral, -kDriftMaxCorrection / kIntegralGain), kDriftMaxCorrection / kIntegralGain);	// no windup past what we can apply
+	drift.correction = std::min(std::max(kDriftGain * error + kIntegralGain * drift.integral, -kDriftMaxCorrection), kDriftMaxCorrection);
+	resampler.step = drift.nominalStep * (1.0 + drift.correction);
+}
+
+struct MixInput
+{
+	// one of several inputs we mix, with its own processing into a ring buffer of float
+	// frames at the stream rate; only the writer touches anything but ringBuffer and open
+	int fd;
+	float gain;
+	int channels;			// of its ring buffer's frames, which are the stream's once map has fit them to it
+	ChannelMap map;
+	Ingest ingest;
+	FrameRing ringBuffer;
+	void* ringMemory;
+	size_t byteIndex;
+	bool ended;				// the writer's seen EOF, and only keeps it open for what's still staged
+	std::atomic<bool> open;	// cleared once all of it's in the ring buffer, so a drained input isn't an underrun
+};
+
+static
+int mixCallback(
+    const void* inputBuffer,
+    void* outputBuffer,
+    unsigned long framesPerBuffer,
+    const PaStreamCallbackTimeInfo* timeInfo,
+    PaStreamCallbackFlags statusFlags,
+    void* userData
+)
+{
+	CallbackData* callbackData = (CallbackData*)userData;
+	recordTiming(*callbackData->timing, timeInfo, statusFlags, framesPerBuffer);
+	bool draining = callbackData->draining.load(std::memory_order_acquire);
+	
+	uint8_t* output = (uint8_t*)outputBuffer;
+	size_t frameSize = callbackData->ringBuffer.frameSize;
+	int channels = callbackData->channels;
+	bool anyShort = false;
+	bool allEmpty = true;
+	long minFill = std::numeric_limits<long>::max();
+	if (callbackData->gainControl != nullptr)
+	{
+		takeGainCommands(*callbackData->gainControl);
+	}
+	for (unsigned long framesDone = 0; framesDone < framesPerBuffer; )
+	{
+		unsigned long frames = std::min(framesPerBuffer - framesDone, callbackData->mixBufferFrames);
+		memset(callbackData->mixBuffer, 0, sizeof(float) * frames * channels);
+		for (size_t i = 0; i < callbackData->mixInputCount; ++i)
+		{
+			MixInput& input = callbackData->mixInputs[i];
+			const uint8_t* data1 = nullptr;
+			const uint8_t* data2 = nullptr;
+			size_t size1 = 0;
+			size_t size2 = 0;
+			minFill = std::min(minFill, (long)ringReadAvailable(input.ringBuffer));
+			size_t framesRead = ringReadRegions(input.ringBuffer, frames, data1, size1, data2, size2);
+			mixInto(callbackData->mixBuffer, (const float*)data1, size1, input.channels, channels, input.gain);
+			if (size2 > 0)
+			{
+				mixInto(callbackData->mixBuffer + size1 * channels, (const float*)data2, size2, input.channels, channels, input.gain);
+			}
+			ringAdvanceRead(input.ringBuffer, framesRead);
+			
+			if (framesRead > 0)
+			{
+				allEmpty = false;
+			}
+			if ((unsigned long)framesRead < frames && input.open.load(std::memory_order_relaxed))
+			{
+				anyShort = true;
+			}
+		}
+		if (callbackData->gainControl != nullptr)
+		{
+			applyGain(*callbackData->gainControl, callbackData->mixBuffer, frames);
+		}
+		saturateSamples(callbackData->mixBuffer, frames * channels);
+		callbackData->fromFloat(callbackData->mixBuffer, output + framesDone * frameSize, frames * channels);
+		framesDone += frames;
+	}
+	
+	Stats& stats = *callbackData->stats;
+	stats.framesPlayed.fetch_add(framesPerBuffer, std::memory_order_relaxed);
+	atomicMin(stats.minFill, minFill);
+	atomicMax(stats.maxFill, minFill);
+	if (anyShort && !draining)
+	{
+		(allEmpty ? stats.underruns : stats.partialCallbacks).fetch_add(1, std::memory_order_relaxed);
+	}
+	recordFirstAudio(*callbackData->timing, !allEmpty);
+	
+	// as in streamCallback, but any one input with room is worth waking the writer for
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (callbackData->writerWaiting->load(std::memory_order_relaxed))
+	{
+		for (size_t i = 0; i < callbackData->mixInputCount; ++i)
+		{
+			MixInput& input = callbackData->mixInputs[i];
+			if (ringWriteAvailable(input.ringBuffer) >= callbackData->wakeThreshold)
+			{
+				if (callbackData->writerWaiting->exchange(false))
+				{
+					wakeWriter(callbackData->wakeFd);
+				}
+				break;
+			}
+		}
+	}
+	
+	if (draining)
+	{
+		for (size_t i = 0; i < callbackData->mixInputCount; ++i)
+		{
+			if (ringReadAvailable(callbackData->mixInputs[i].ringBuffer) > 0)
+			{
+				return paContinue;
+			}
+		}
+		return paComplete;
+	}
+	return paContinue;
+}
+
+static const size_t kMaxOutputs = 8;
+static const size_t kMaxInputs = 8;	// counting the main input
+
+struct InputSpec
+{
+	// an extra input for mixing, from -M; zero fields mean the same as the main input's
+	const char* path;
+	int channels;
+	PaSampleFormat sampleFormat;
+	size_t sampleSize;
+	bool bigEndian;
+	double sampleRate;
+	float gain;
+};
+
+enum Engine
+{
+	kEngineCallback,	// stream callback pulling from our ring buffer
+	kEngineBlocking,	// Pa_WriteStream straight from what we read
+};
+
+enum InputReader
+{
+	kReaderPoll,	// poll() for the input, then read() it
+	kReaderUring,	// keep an io_uring read in flight, where the platform has it
+};
+
+enum HostApiMode
+{
+	kHostApiExclusive = 1 << 0,	// WASAPI: bypass the shared-mode mixer
+	kHostApiPro = 1 << 1,		// CoreAudio: change the device's own format instead of converting
+	kHostApiRealtime = 1 << 2,	// WASAPI, ALSA: run the host API's audio thread at real-time priority
+};
+
+struct Options
+{
+	// the defaults here for channels, format, rate, and buffer size all
+	// correspond to the values used for Mac Sound Driver emulation, for which
+	// this utility was originally written ;)
+	
+	int channels = 1;
+	PaSampleFormat sampleFormat = paUInt8;
+	size_t sampleSize = 1;
+	double sampleRate = 22256.0;
+	long framesPerBuffer = 370;
+	
+	// what's actually coming down the pipe, when it isn't what we're giving the device
+	PaSampleFormat inputSampleFormat = paUInt8;
+	size_t inputSampleSize = 1;
+	bool inputBigEndian = false;
+	bool outputFormatSet = false;	// whether -f was given, rather than the output following the input
+	bool channelsSet = false;		// likewise -c and -r, which clips otherwise take from the first of them
+	bool sampleRateSet = false;
+	
+	// the rest of these defaults I just thought were reasonable :)
+	PaStreamFlags streamFlags = paNoFlag;
+	double timeout = std::numeric_limits<double>::infinity();
+	int verbosity = 1;
+	double queueTime = 0.0;		// in milliseconds; never less than one buffer
+	double prefillTime = 0.0;	// in milliseconds; never more than the queue
+	Engine engine = kEngineCallback;
+	InputReader reader = kReaderPoll;	// for the callback engine's input
+	double statsInterval = 0.0;	// in seconds; zero for no stats
+	bool statsJSON = false;
+	ResampleQuality resampleQuality = kResampleOff;	// anything else plays at the device's own rate
+	double driftTarget = 0.0;	// in milliseconds; zero to trust the input's clock
+	const char* inputPath = nullptr;	// read from here instead of stdin
+	const char* teePath = nullptr;		// pass the input on to here as it's read
+	TeePolicy teePolicy = kTeeDrop;
+	const char* devices[kMaxOutputs] = {};	// indices or names, looked up once PortAudio is up
+	size_t deviceCount = 0;		// zero for just the default output device
+	double suggestedLatency = -1.0;	// in seconds; negative for each device's default low latency
+	bool listDevices = false;
+	unsigned hostApiModes = 0;	// any HostApiModes the devices' host APIs support
+	int writerPriority = 0;		// SCHED_FIFO priority for the writer; zero to leave it alone
+	double benchTime = 0.0;		// in seconds of audio; zero to play for real
+	const char* renderPath = nullptr;	// write what would have played to a file here instead, as fast as it'll go
+	bool profileStartup = false;	// report how long each step of starting up took
+	bool fastOpen = false;		// read input on a thread of its own while PortAudio starts up
+	bool drain = true;			// play out what's queued when input ends, rather than dropping it
+	bool readHeader = true;		// take the input's format from a WAV, AIFF or CAF header if it starts with one
+	const char* serverPath = nullptr;	// a Unix socket or FIFO to serve inputs from instead of reading stdin
+	const char* controlPath = nullptr;	// a Unix socket or FIFO to take gain commands on while playing
+	const char* networkAddress = nullptr;	// host:port to receive RTP on instead of reading stdin
+	double jitterTime = 20.0;	// in milliseconds
+	const char* channelMap = nullptr;	// how to make the device's channels out of the input's; null to play them as they are
+	InputSpec mixInputs[kMaxInputs - 1] = {};
+	size_t mixInputCount = 0;	// zero to play the main input alone
+};
+
+// these all expect an Options named options in scope, and FATAL an int named result
+#define PRINT(level, file, ...) if (options.verbosity >= level) { fprintf(file, __VA_ARGS__); }
+#define DEBUG(...) PRINT(4, stdout, __VA_ARGS__)
+#define INFO(...) PRINT(3, stdout, __VA_ARGS__)
+#define WARN(...) PRINT(2, stderr, __VA_ARGS__)
+#define ERROR(...) PRINT(1, stderr, __VA_ARGS__)
+#define FATAL(...) ERROR(__VA_ARGS__) result = 1;
+
+static
+void printUsage(void)
+{
+	fprintf(stdout,
+		"usage: pipeplayer [-h] [-l] [-n] [-H] [-T] [-Q] [-i <path>] [-w <path>] [-W <policy>] [-S <path>] [-C <path>] [-u <address>] [-J <latency>] [-M <input>] [-o <device>] [-L <latency>] [-c <channels>] [-m <map>] [-f <format>] [-F <format>] [-r <sample rate>] [-b <buffer size>] [-q <queue size>] [-p <prefill>] [-e <engine>] [-I <reader>] [-R <quality>] [-D <latency>] [-d <feature>] [-x <mode>] [-P <priority>] [-t <timeout>] [-B <duration>] [-O <path>] [-v <level>] [-s <interval>] [-j]\n"
+		"\t-h: prints this message and exits\n"
+		"\t-n: exits as soon as input ends, dropping whatever is still queued instead of playing it out\n"
+		"\t-H: plays the input as raw PCM even if it has a WAV/AIFF/CAF, FLAC/Opus or clip header\n"
+		"\t-T: prints how long each step of starting up took, up to the first callback with input to play, as milliseconds since pipeplayer started\n"
+		"\t-Q: opens fast, waiting for and reading input on a thread of its own while PortAudio initializes and the streams open, so the first callback has something to play; PortAudio still initializes every host API it was built with, so a build with only the one you use opens fastest\n"
+		"\t-i <path>: file or FIFO to read instead of stdin; regular files with no conversion to do are played straight from a memory mapping, default: stdin\n"
+		"\t-w <path>: passes the input on to a file, FIFO or descriptor number as it's read, default: none\n"
+		"\t-W <policy>: what -w does when where it goes can't keep up (drop, which drops whole frames from it until it catches up, or block, which waits for it, and can starve playback), default: drop\n"
+		"\t-S <path>: runs as a server, keeping the stream open and playing the input from each connection to a Unix socket at path (or everything written to a FIFO there) back to back, with silence in between, until SIGINT or SIGTERM, default: none (play stdin)\n"
+		"\t-C <path>: takes commands, one per line, to change the output's gain without reopening the stream from a FIFO at path (or a Unix socket created there, one connection at a time): gain <gain>, fade <gain> <milliseconds>, mute, and unmute, with gains linear or in dB (like -6dB) and up to +12dB, default: none\n"
+		"\t-u <address>: [host]:port to receive RTP on (a multicast group is joined) instead of reading stdin, with the payload in the input format (so s16be for L16), until SIGINT or SIGTERM, default: none (play stdin)\n"
+		"\t-J <latency>: milliseconds of reordering the RTP jitter buffer waits out before concealing a lost packet (double-precision floating point), default: 20.0\n"
+		"\t-M <path>[,c=<channels>][,f=<format>][,r=<sample rate>][,g=<gain>]: file or FIFO to mix in with the main input, taking its other settings from the main input's; repeatable, default: none\n"
+		"\t-l: lists host APIs and output devices, with their latencies and the sample rates they take in the chosen format, and exits\n"
+		"\t-o <device>: output device index, name, or part of a name; repeat to play to several devices at once, default: the default output device\n"
+		"\t-L <latency>: suggested output latency in seconds (double-precision floating point), default: the device's default low latency\n"
+		"\t-c <channels>: number of channels (integer), default: 1\n"
+		"\t-m <map>: channels to play, made from the input's: a downmix to stereo of 5.1 or 7.1 (in WAV order), mono for an even downmix of anything, or a comma-separated list with one sum of input channels (counting from 0, each optionally weighted as gain*channel, like 0+0.5*2) per output channel, so 1,0 swaps a stereo pair and 0,1 keeps the first two, default: the input's channels as they are\n"
+		"\t-f <sample format>: sample format of the output (f, s16, s32, s24, s8, u8), default: u8\n"
+		"\t-F <sample format>: sample format of the input, if it differs from the output (f, s16, s32, s24, s8, u8, or fbe, s16be, s32be, s24be for big-endian), default: same as output\n"
+		"\t-r <sample rate>: sample rate (double-precision floating point), default: 22256.0\n"
+		"\t-b <buffer size>: buffer size in samples (integer), default: 370\n"
+		"\t-q <queue size>: ring buffer size in milliseconds (double-precision floating point), default: one buffer\n"
+		"\t-p <prefill>: milliseconds of audio to queue up before starting playback (double-precision floating point), default: 0.0\n"
+		"\t-e <engine>: how to feed the device (callback, blocking), default: callback\n"
+		"\t-I <reader>: how the callback engine reads input that doesn't need converting (poll, or uring for a Linux io_uring reading straight into the ring buffer, falling back to poll where it can't), default: poll\n"
+		"\t-R <quality>: resample to the device's native rate instead of opening it at the sample rate (low, medium, high, best), default: off\n"
+		"\t-D <latency>: milliseconds of queued audio to hold by adjusting the resampling ratio, for input clocked independently of the device (double-precision floating point), default: 0.0 (off)\n"
+		"\t-d <feature>: feature to disable (clipping, dithering), default: none\n"
+		"\t-x <mode>: host-API-specific mode to request where the device's host API has it (exclusive for WASAPI, pro for CoreAudio, realtime for WASAPI and ALSA); repeatable, default: none\n"
+		"\t-P <priority>: real-time (SCHED_FIFO) priority for the thread feeding the stream (integer), default: 0 (normal scheduling)\n"
+		"\t-t <timeout>: timeout in seconds after no new data arrives (double-precision floating point), default: forever\n"
+		"\t-B <duration>: instead of playing, benchmarks this many seconds of generated input through the ingest and ring buffer into a null device clocked as fast as it'll go, and prints the throughput and callback cost (double-precision floating point), default: 0.0 (off)\n"
+		"\t-O <path>: renders to a file (WAV if it ends in .wav, raw otherwise) as fast as possible instead of playing, default: none\n"
+		"\t-v <level>: log verbosity level (integer), default: 1\n"
+		"\t-s <interval>: seconds between stats lines on stdout (double-precision floating point), default: 0.0 (never)\n"
+		"\t-j: prints stats lines as JSON\n"
+		"send SIGUSR1 for a summary of callback timing, which is also printed at exit at log level 3 and up\n"
+	);
+}
+
+static
+int getIntArg(char opt, int defaultArg)
+{
+	int result = atoi(optarg);
+	if (result < 0)
+	{
+		fprintf(stderr, "argument %s to option '-%c' is invalid, using default: %d\n", optarg, opt, defaultArg);
+		result = defaultArg;
+	}
+	return result;
+}
+
+static
+double getDoubleArg(char opt, double defaultArg)
+{
+	double result = atof(optarg);
+	if (result < 0)
+	{
+		fprintf(stderr, "argument %s to option '-%c' is invalid, using default: %.1f\n", optarg, opt, defaultArg);
+		result = defaultArg;
+	}
+	return result;
+}
+
+static
+int getOpts(int argc, char* argv[], Options& options)
+{
+	const size_t kFormatOptsCount = 10;
+	struct FormatOptMapping
+	{
+		const char* optarg;
 		PaSampleFormat sampleFormat;
 		size_t sampleSize;
+		bool bigEndian;	// only allowed for input; devices always take native byte order
 	};
 	FormatOptMapping formatOptMap[kFormatOptsCount] =
 	{
-		{ "f", paFloat32, 4 },
-		{ "s16", paInt16, 2 },
-		{ "s32", paInt32, 4 },
-		{ "s24", paInt24, 3 },
-		{ "s8", paInt8, 1 },
-		{ "u8", paUInt8, 1 },
+		{ "f", paFloat32, 4, false },
+		{ "s16", paInt16, 2, false },
+		{ "s32", paInt32, 4, false },
+		{ "s24", paInt24, 3, false },
+		{ "s8", paInt8, 1, false },
+		{ "u8", paUInt8, 1, false },
+		{ "fbe", paFloat32, 4, true },
+		{ "s16be", paInt16, 2, true },
+		{ "s32be", paInt32, 4, true },
+		{ "s24be", paInt24, 3, true },
 	};
 	
 	const size_t kDisableOptsCount = 2;
@@ -178,295 +1267,4781 @@ int getOpts(int argc, char* argv[], Options& options)
 		{ "dithering", paDitherOff },
 	};
 	
-	Options defaults;
+	const size_t kHostApiOptsCount = 3;
+	struct HostApiOptMapping
+	{
+		const char* optarg;
+		HostApiMode hostApiMode;
+	};
+	HostApiOptMapping hostApiOptMap[kHostApiOptsCount] =
+	{
+		{ "exclusive", kHostApiExclusive },
+		{ "pro", kHostApiPro },
+		{ "realtime", kHostApiRealtime },
+	};
+	
+	const size_t kEngineOptsCount = 2;
+	struct EngineOptMapping
+	{
+		const char* optarg;
+		Engine engine;
+	};
+	EngineOptMapping engineOptMap[kEngineOptsCount] =
+	{
+		{ "callback", kEngineCallback },
+		{ "blocking", kEngineBlocking },
+	};
+	
+	const size_t kReaderOptsCount = 2;
+	struct ReaderOptMapping
+	{
+		const char* optarg;
+		InputReader reader;
+	};
+	ReaderOptMapping readerOptMap[kReaderOptsCount] =
+	{
+		{ "poll", kReaderPoll },
+		{ "uring", kReaderUring },
+	};
+	
+	const size_t kTeeOptsCount = 2;
+	struct TeeOptMapping
+	{
+		const char* optarg;
+		TeePolicy teePolicy;
+	};
+	TeeOptMapping teeOptMap[kTeeOptsCount] =
+	{
+		{ "drop", kTeeDrop },
+		{ "block", kTeeBlock },
+	};
+	
+	const size_t kResampleOptsCount = 5;
+	struct ResampleOptMapping
+	{
+		const char* optarg;
+		ResampleQuality resampleQuality;
+	};
+	ResampleOptMapping resampleOptMap[kResampleOptsCount] =
+	{
+		{ "off", kResampleOff },
+		{ "low", kResampleLow },
+		{ "medium", kResampleMedium },
+		{ "high", kResampleHigh },
+		{ "best", kResampleBest },
+	};
+	
+	Options defaults;
+	bool outputFormatSet = false;
+	bool inputFormatSet = false;
+	
+	int opt = -1;
+	// all options have required arguments except '-h', '-l', '-n', '-H', '-T', '-Q' and '-j'
+	while ((opt = getopt(argc, argv, ":hlnHTQi:w:W:S:C:u:J:M:o:L:c:m:f:F:r:b:q:p:e:I:R:D:d:x:P:t:B:O:v:s:j")) != -1)
+	{
+		switch (opt)
+		{
+			case 'h':
+				printUsage();
+				exit(0);
+			case 'l':
+				options.listDevices = true;
+				break;
+			case 'n':
+				options.drain = false;
+				break;
+			case 'H':
+				options.readHeader = false;
+				break;
+			case 'T':
+				options.profileStartup = true;
+				break;
+			case 'Q':
+				options.fastOpen = true;
+				break;
+			case 'i':
+				options.inputPath = optarg;
+				break;
+			case 'w':
+				options.teePath = optarg;
+				break;
+			case 'W':
+				{
+					size_t i = 0;
+					for (; i < kTeeOptsCount; ++i)
+					{
+						TeeOptMapping& mapping = teeOptMap[i];
+						if (strcmp(mapping.optarg, optarg) == 0)
+						{
+							options.teePolicy = mapping.teePolicy;
+							break;
+						}
+					}
+					if (i == kTeeOptsCount)
+					{
+						fprintf(stderr, "argument %s to option '-%c' is invalid, using default: %s\n", optarg, opt, teeOptMap[defaults.teePolicy].optarg);
+					}
+				}
+				break;
+			case 'S':
+				options.serverPath = optarg;
+				break;
+			case 'C':
+				options.controlPath = optarg;
+				break;
+			case 'u':
+				options.networkAddress = optarg;
+				break;
+			case 'J':
+				options.jitterTime = getDoubleArg(opt, defaults.jitterTime);
+				break;
+			case 'L':
+				options.suggestedLatency = getDoubleArg(opt, 0.0);
+				break;
+			case 'M':
+				if (options.mixInputCount < kMaxInputs - 1)
+				{
+					InputSpec& spec = options.mixInputs[options.mixInputCount++];
+					spec.gain = 1.0f;
+					spec.path = strtok(optarg, ",");
+					for (char* field = strtok(nullptr, ","); field != nullptr; field = strtok(nullptr, ","))
+					{
+						if (strncmp(field, "c=", 2) == 0)
+						{
+							spec.channels = atoi(field + 2);
+						}
+						else if (strncmp(field, "r=", 2) == 0)
+						{
+							spec.sampleRate = atof(field + 2);
+						}
+						else if (strncmp(field, "g=", 2) == 0)
+						{
+							spec.gain = (float)atof(field + 2);
+						}
+						else if (strncmp(field, "f=", 2) == 0)
+						{
+							size_t i = 0;
+							for (; i < kFormatOptsCount; ++i)
+							{
+								FormatOptMapping& mapping = formatOptMap[i];
+								if (strcmp(mapping.optarg, field + 2) == 0)
+								{
+									spec.sampleFormat = mapping.sampleFormat;
+									spec.sampleSize = mapping.sampleSize;
+									spec.bigEndian = mapping.bigEndian;
+									break;
+								}
+							}
+							if (i == kFormatOptsCount)
+							{
+								fprintf(stderr, "format %s for input %s is invalid, using the main input's\n", field + 2, spec.path);
+							}
+						}
+						else
+						{
+							fprintf(stderr, "setting %s for input %s is invalid\n", field, spec.path);
+						}
+					}
+					if (spec.path == nullptr || spec.channels < 0 || spec.sampleRate < 0.0)
+					{
+						fprintf(stderr, "argument to option '-%c' is invalid\n", opt);
+						printUsage();
+						return 1;
+					}
+				}
+				else
+				{
+					fprintf(stderr, "too many inputs, ignoring %s\n", optarg);
+				}
+				break;
+			case 'o':
+				if (options.deviceCount < kMaxOutputs)
+				{
+					options.devices[options.deviceCount++] = optarg;
+				}
+				else
+				{
+					fprintf(stderr, "too many output devices, ignoring %s\n", optarg);
+				}
+				break;
+			case 'c':
+				options.channels = getIntArg(opt, defaults.channels);
+				options.channelsSet = true;
+				break;
+			case 'm':
+				options.channelMap = optarg;
+				break;
+			case 'f':
+			case 'F':
+				{
+					size_t i = 0;
+					for (; i < kFormatOptsCount; ++i)
+					{
+						FormatOptMapping& mapping = formatOptMap[i];
+						if (strcmp(mapping.optarg, optarg) == 0 && (opt == 'F' || !mapping.bigEndian))
+						{
+							if (opt == 'F')
+							{
+								options.inputSampleFormat = mapping.sampleFormat;
+								options.inputSampleSize = mapping.sampleSize;
+								options.inputBigEndian = mapping.bigEndian;
+								inputFormatSet = true;
+							}
+							else
+							{
+								options.sampleFormat = mapping.sampleFormat;
+								options.sampleSize = mapping.sampleSize;
+								outputFormatSet = true;
+							}
+							break;
+						}
+					}
+					if (i == kFormatOptsCount)
+					{
+						for (i = 0; i < kFormatOptsCount; ++i)
+						{
+							FormatOptMapping& mapping = formatOptMap[i];
+							if (mapping.sampleFormat == defaults.sampleFormat)
+							{
+								fprintf(stderr, "argument %s to option '-%c' is invalid, using default: %s\n", optarg, opt, mapping.optarg);
+								break;
+							}
+						}
+					}
+				}
+				break;
+			case 'r':
+				options.sampleRate = getDoubleArg(opt, defaults.sampleRate);
+				options.sampleRateSet = true;
+				break;
+			case 'b':
+				options.framesPerBuffer = getIntArg(opt, defaults.framesPerBuffer);
+				break;
+			case 'q':
+				options.queueTime = getDoubleArg(opt, defaults.queueTime);
+				break;
+			case 'p':
+				options.prefillTime = getDoubleArg(opt, defaults.prefillTime);
+				break;
+			case 'e':
+				{
+					size_t i = 0;
+					for (; i < kEngineOptsCount; ++i)
+					{
+						EngineOptMapping& mapping = engineOptMap[i];
+						if (strcmp(mapping.optarg, optarg) == 0)
+						{
+							options.engine = mapping.engine;
+							break;
+						}
+					}
+					if (i == kEngineOptsCount)
+					{
+						fprintf(stderr, "argument %s to option '-%c' is invalid, using default: %s\n", optarg, opt, engineOptMap[defaults.engine].optarg);
+					}
+				}
+				break;
+			case 'I':
+				{
+					size_t i = 0;
+					for (; i < kReaderOptsCount; ++i)
+					{
+						ReaderOptMapping& mapping = readerOptMap[i];
+						if (strcmp(mapping.optarg, optarg) == 0)
+						{
+							options.reader = mapping.reader;
+							break;
+						}
+					}
+					if (i == kReaderOptsCount)
+					{
+						fprintf(stderr, "argument %s to option '-%c' is invalid, using default: %s\n", optarg, opt, readerOptMap[defaults.reader].optarg);
+					}
+				}
+				break;
+			case 'R':
+				{
+					size_t i = 0;
+					for (; i < kResampleOptsCount; ++i)
+					{
+						ResampleOptMapping& mapping = resampleOptMap[i];
+						if (strcmp(mapping.optarg, optarg) == 0)
+						{
+							options.resampleQuality = mapping.resampleQuality;
+							break;
+						}
+					}
+					if (i == kResampleOptsCount)
+					{
+						fprintf(stderr, "argument %s to option '-%c' is invalid, using default: %s\n", optarg, opt, resampleOptMap[defaults.resampleQuality].optarg);
+					}
+				}
+				break;
+			case 'D':
+				options.driftTarget = getDoubleArg(opt, defaults.driftTarget);
+				break;
+			case 'd':
+				{
+					size_t i = 0;
+					for (; i < kDisableOptsCount; ++i)
+					{
+						DisableOptMapping& mapping = disableOptMap[i];
+						if (strcmp(mapping.optarg, optarg) == 0)
+						{
+							options.streamFlags |= mapping.streamFlags;
+							break;
+						}
+					}
+					if (i == kDisableOptsCount)
+					{
+						fprintf(stderr, "argument %s to option '-%c' is invalid\n", optarg, opt);
+					}
+				}
+				break;
+			case 'x':
+				{
+					size_t i = 0;
+					for (; i < kHostApiOptsCount; ++i)
+					{
+						HostApiOptMapping& mapping = hostApiOptMap[i];
+						if (strcmp(mapping.optarg, optarg) == 0)
+						{
+							options.hostApiModes |= mapping.hostApiMode;
+							break;
+						}
+					}
+					if (i == kHostApiOptsCount)
+					{
+						fprintf(stderr, "argument %s to option '-%c' is invalid\n", optarg, opt);
+					}
+				}
+				break;
+			case 'P':
+				options.writerPriority = getIntArg(opt, defaults.writerPriority);
+				break;
+			case 't':
+				options.timeout = getDoubleArg(opt, defaults.timeout);
+				break;
+			case 'B':
+				options.benchTime = getDoubleArg(opt, defaults.benchTime);
+				break;
+			case 'O':
+				options.renderPath = optarg;
+				break;
+			case 'v':
+				options.verbosity = getIntArg(opt, defaults.verbosity);
+				break;
+			case 's':
+				options.statsInterval = getDoubleArg(opt, defaults.statsInterval);
+				break;
+			case 'j':
+				options.statsJSON = true;
+				break;
+			case ':':
+				fprintf(stderr, "missing argument for option '-%c'\n", optopt);
+				printUsage();
+				return 1;
+			case '?':
+				fprintf(stderr, "unknown option: -%c\n", optopt);
+				printUsage();
+				return 1;
+		}
+	}
+	
+	// with just one of -f and -F, both sides use the same format
+	options.outputFormatSet = outputFormatSet;
+	if (!inputFormatSet)
+	{
+		options.inputSampleFormat = options.sampleFormat;
+		options.inputSampleSize = options.sampleSize;
+		options.inputBigEndian = hostIsBigEndian();
+	}
+	else if (!outputFormatSet)
+	{
+		options.sampleFormat = options.inputSampleFormat;
+		options.sampleSize = options.inputSampleSize;
+	}
+	
+	if (options.renderPath != nullptr)
+	{
+		// there's no device to take its time, so nothing that waits on one or on the network
+		if (options.engine != kEngineCallback)
+		{
+			fprintf(stderr, "rendering needs the callback engine, using it\n");
+			options.engine = kEngineCallback;
+		}
+		if (options.deviceCount > 0 || options.serverPath != nullptr || options.networkAddress != nullptr)
+		{
+			fprintf(stderr, "options '-o', '-S' and '-u' don't work when rendering, ignoring\n");
+			options.deviceCount = defaults.deviceCount;
+			options.serverPath = defaults.serverPath;
+			options.networkAddress = defaults.networkAddress;
+		}
+		if (options.driftTarget > 0.0)
+		{
+			fprintf(stderr, "option '-D' doesn't work when rendering, ignoring\n");
+			options.driftTarget = defaults.driftTarget;
+		}
+	}
+	
+	if (options.networkAddress != nullptr)
+	{
+		if (options.engine != kEngineCallback)
+		{
+			fprintf(stderr, "receiving RTP needs the callback engine, using it\n");
+			options.engine = kEngineCallback;
+		}
+		if (options.inputPath != nullptr || options.serverPath != nullptr || options.mixInputCount > 0)
+		{
+			fprintf(stderr, "options '-i', '-S' and '-M' don't work when receiving RTP, ignoring\n");
+			options.inputPath = defaults.inputPath;
+			options.serverPath = defaults.serverPath;
+			options.mixInputCount = defaults.mixInputCount;
+		}
+		if (options.driftTarget > 0.0)
+		{
+			fprintf(stderr, "option '-D' doesn't work when receiving RTP, ignoring\n");
+			options.driftTarget = defaults.driftTarget;
+		}
+	}
+	
+	if (options.serverPath != nullptr)
+	{
+		if (options.engine != kEngineCallback)
+		{
+			fprintf(stderr, "serving needs the callback engine, using it\n");
+			options.engine = kEngineCallback;
+		}
+		if (options.inputPath != nullptr)
+		{
+			fprintf(stderr, "option '-i' doesn't work when serving, ignoring\n");
+			options.inputPath = defaults.inputPath;
+		}
+		if (options.mixInputCount > 0)
+		{
+			fprintf(stderr, "option '-M' doesn't work when serving, ignoring\n");
+			options.mixInputCount = defaults.mixInputCount;
+		}
+	}
+	
+	if (options.mixInputCount > 0)
+	{
+		if (options.engine != kEngineCallback)
+		{
+			fprintf(stderr, "mixing needs the callback engine, using it\n");
+			options.engine = kEngineCallback;
+		}
+		if (options.deviceCount > 1)
+		{
+			fprintf(stderr, "mixing plays to a single device, using only the first\n");
+			options.deviceCount = 1;
+		}
+		if (options.driftTarget > 0.0)
+		{
+			fprintf(stderr, "option '-D' doesn't work when mixing, ignoring\n");
+			options.driftTarget = defaults.driftTarget;
+		}
+		if (options.channelMap != nullptr)
+		{
+			fprintf(stderr, "option '-m' doesn't work when mixing, ignoring\n");
+			options.channelMap = defaults.channelMap;
+		}
+	}
+	
+	if (options.controlPath != nullptr && options.engine != kEngineCallback)
+	{
+		fprintf(stderr, "gain control needs the callback engine, using it\n");
+		options.engine = kEngineCallback;
+	}
+	
+	if (options.deviceCount > 1 && options.engine != kEngineCallback)
+	{
+		fprintf(stderr, "playing to several devices needs the callback engine, using only the first\n");
+		options.deviceCount = 1;
+	}
+	
+	if (options.driftTarget > 0.0)
+	{
+		if (options.engine != kEngineCallback)
+		{
+			fprintf(stderr, "option '-D' needs the callback engine, ignoring\n");
+			options.driftTarget = defaults.driftTarget;
+		}
+		else
+		{
+			// leave room to swing either side of the target, and start out on it
+			options.queueTime = std::max(options.queueTime, 2.0 * options.driftTarget);
+			if (options.prefillTime == defaults.prefillTime)
+			{
+				options.prefillTime = options.driftTarget;
+			}
+		}
+	}
+	
+	return 0;
+}
+
+static
+int initIngest(const Options& options, Ingest& ingest, const SampleFormat& inputFormat, const SampleFormat& outputFormat, int channels, const ChannelMap* map, double inputRate, double streamRate, bool resample, bool stage, size_t ringFrames, size_t preloadBytes)
+{
+	// sets up whatever it takes to turn input of channels in inputFormat at inputRate into up
+	// to ringFrames frames of outputFormat at streamRate, through map if there is one, with
+	// room to stage preloadBytes already read if it comes to that; with stage, the input is
+	// staged even if there's nothing to do to it
+	int result = 0;
+	ingest.bytesLeft = kInputToEnd;
+	ingest.format = inputFormat;
+	ingest.channels = channels;
+	ingest.outputChannels = map != nullptr ? map->outputChannels : channels;
+	ingest.frameSize = inputFormat.sampleSize * channels;
+	ingest.outputFrameSize = outputFormat.sampleSize * ingest.outputChannels;
+	ingest.resampling = resample;
+	ingest.flushed = false;
+	ingest.map = map;
+	if (ingest.resampling || ingest.map != nullptr)
+	{
+		ingest.toFloat = toFloatFunction(inputFormat);
+		ingest.fromFloat = fromFloatFunction(outputFormat);
+		
+		// big enough for a chunk on either side of the channel map
+		const size_t kFloatBufferSamples = 4096;
+		int mostChannels = std::max(channels, ingest.outputChannels);
+		ingest.floatBufferFrames = std::max(kFloatBufferSamples / mostChannels, (size_t)1);
+		ingest.floatBuffer = (float*)malloc(sizeof(float) * ingest.floatBufferFrames * mostChannels);
+		if (ingest.floatBuffer == nullptr)
+		{
+			FATAL("could not allocate memory for float buffer\n");
+		}
+	}
+	if (result == 0 && ingest.map != nullptr)
+	{
+		DEBUG("allocating %zu frame buffer for %d to %d channel map\n", ingest.floatBufferFrames, channels, ingest.outputChannels);
+		ingest.remapBuffer = (float*)malloc(sizeof(float) * ingest.floatBufferFrames * ingest.outputChannels);
+		if (ingest.remapBuffer == nullptr)
+		{
+			FATAL("could not allocate memory for channel map\n");
+		}
+	}
+	if (result == 0 && ingest.resampling)
+	{
+		DEBUG("allocating %zu frame resampler for %gHz to %gHz\n", ingest.floatBufferFrames, inputRate, streamRate);
+		if (!initResampler(ingest.resampler, ingest.outputChannels, inputRate, streamRate,
+			options.resampleQuality != kResampleOff ? options.resampleQuality : kResampleMedium, ingest.floatBufferFrames))
+		{
+			FATAL("could not allocate memory for resampler\n");
+		}
+	}
+	if (result == 0)
+	{
+		initConverter(ingest.converter, inputFormat, outputFormat);
+		if (!converterIsIdentity(ingest.converter) || ingest.resampling || ingest.map != nullptr || stage)
+		{
+			// as long as the ring buffer, so one read can always fill it
+			ingest.bufferFrames = std::max(inputFramesFor(ingest, ringFrames), (preloadBytes + ingest.frameSize - 1) / ingest.frameSize);
+			size_t inputBufferSize = ingest.bufferFrames * ingest.frameSize;
+			DEBUG("allocating %zu frame (%zu byte) conversion buffer for %s%zu-bit %s input\n",
+				ingest.bufferFrames,
+				inputBufferSize,
+				inputFormat.bigEndian ? "big-endian " : "",
+				inputFormat.sampleSize * CHAR_BIT,
+				inputFormat.sampleFormat == paFloat32 ? "float" : "integer");
+			ingest.buffer = (uint8_t*)malloc(inputBufferSize);
+			if (ingest.buffer == nullptr)
+			{
+				FATAL("could not allocate memory for conversion buffer\n");
+			}
+		}
+	}
+	return result;
+}
+
+static
+void freeIngest(const Options& options, Ingest& ingest)
+{
+	if (ingest.buffer != nullptr)
+	{
+		DEBUG("freeing conversion buffer\n");
+		free(ingest.buffer);
+		ingest.buffer = nullptr;
+	}
+	
+	if (ingest.resampling)
+	{
+		DEBUG("freeing resampler\n");
+		freeResampler(ingest.resampler);
+		ingest.resampling = false;
+	}
+	
+	if (ingest.map != nullptr)
+	{
+		DEBUG("freeing channel map buffer\n");
+		free(ingest.remapBuffer);
+		ingest.remapBuffer = nullptr;
+		ingest.map = nullptr;
+	}
+	
+	free(ingest.floatBuffer);
+	ingest.floatBuffer = nullptr;
+}
+
+struct ClipInput
+{
+	// input framed as clips, played back to back through the one ingest, which is set up
+	// afresh for each clip whose format differs from the last one's
+	const Options* options;
+	SampleFormat format;		// of the clip playing, or of the stream before the first
+	int channels;
+	double sampleRate;
+	SampleFormat outputFormat;
+	int outputChannels;
+	double streamRate;
+	size_t ringFrames;
+	ChannelMap map;				// from the clip's channels to the stream's, when they differ
+	
+	const uint8_t* peek;		// read before we knew these were clips, which we read first
+	size_t peekBytes;
+	Tee* tee;					// what the rest is read through
+	
+	uint8_t header[kClipHeaderBytes];
+	size_t headerBytes;			// of the next clip's header, read so far
+	uint64_t bytesLeft;			// of the clip playing, still to be staged
+	bool switching;				// read the next clip's header, but the last clip's still to be played out
+	unsigned long clips;
+};
+
+static
+ssize_t readClip(ClipInput& clips, int fd, void* buffer, size_t bytes)
+{
+	if (clips.peekBytes > 0)
+	{
+		size_t peeked = std::min(bytes, clips.peekBytes);
+		memcpy(buffer, clips.peek, peeked);
+		clips.peek += peeked;
+		clips.peekBytes -= peeked;
+		return (ssize_t)peeked;
+	}
+	return readTee(clips.tee, fd, buffer, bytes);
+}
+
+static
+bool sameClipFormat(const ClipInput& clips, const InputHeader& header)
+{
+	return header.format.sampleFormat == clips.format.sampleFormat && header.format.sampleSize == clips.format.sampleSize &&
+		header.format.bigEndian == clips.format.bigEndian && header.channels == clips.channels && header.sampleRate == clips.sampleRate;
+}
+
+static
+bool startClip(ClipInput& clips, Ingest& ingest, size_t& bytesStaged)
+{
+	// sets the ingest up for the clip whose header we just read, once anything left of the
+	// clip before it has been played out
+	const Options& options = *clips.options;
+	InputHeader header;
+	parseClipHeader(clips.header, header);
+	clips.headerBytes = 0;
+	clips.bytesLeft = header.dataBytes;
+	++clips.clips;
+	if (sameClipFormat(clips, header))
+	{
+		DEBUG("clip %lu: %llu bytes, same format as the last\n", clips.clips, (unsigned long long)header.dataBytes);
+		return true;
+	}
+	
+	int result = 0;
+	const ChannelMap* map = nullptr;
+	if (header.channels != clips.outputChannels)
+	{
+		if (!fitChannelMap(clips.map, header.channels, clips.outputChannels))
+		{
+			ERROR("clip %lu's %d channels can't be made into %d\n", clips.clips, header.channels, clips.outputChannels);
+			return false;
+		}
+		map = &clips.map;
+	}
+	freeIngest(options, ingest);
+	result = initIngest(options, ingest, header.format, clips.outputFormat, header.channels, map, header.sampleRate, clips.streamRate,
+		header.sampleRate != clips.streamRate, true, clips.ringFrames, 0);
+	bytesStaged = 0;
+	clips.format = header.format;
+	clips.channels = header.channels;
+	clips.sampleRate = header.sampleRate;
+	DEBUG("clip %lu: %llu bytes of %d channels of %s%zu-bit %s at %gHz\n",
+		clips.clips,
+		(unsigned long long)header.dataBytes,
+		header.channels,
+		header.format.bigEndian ? "big-endian " : "",
+		header.format.sampleSize * CHAR_BIT,
+		header.format.sampleFormat == paFloat32 ? "float" : "integer",
+		header.sampleRate);
+	return result == 0;
+}
+
+static
+ssize_t readClipRingBuffer(int fd, FrameRing& ringBuffer, Ingest& ingest, size_t& bytesStaged, ClipInput& clips)
+{
+	// like readConvertRingBuffer, but a clip at a time: a clip's PCM is staged only as far
+	// as its end, and the next clip's format only takes over once that's all been played.
+	// stopping at the end of a clip, or after a header, would leave the ring buffer short
+	// until the stream callbacks next wake the writer, so we go on to the next clip's
+	// header and PCM in the same call, as long as there's more to read already
+	const Options& options = *clips.options;
+	ssize_t bytesRead = 0;
+	for (;;)
+	{
+		if (clips.bytesLeft == 0)
+		{
+			// the clip before has to be played out first, except for a partial frame it may
+			// have ended on, which is just dropped
+			if (bytesStaged >= ingest.frameSize)
+			{
+				break;
+			}
+			bytesStaged = 0;
+			if (clips.switching)
+			{
+				clips.switching = false;
+				if (!startClip(clips, ingest, bytesStaged))
+				{
+					errno = EINVAL;
+					return -1;
+				}
+			}
+		}
+		
+		if (clips.bytesLeft > 0)
+		{
+			size_t framesWanted = std::min(inputFramesFor(ingest, ringWriteAvailable(ringBuffer)), ingest.bufferFrames);
+			if (framesWanted * ingest.frameSize <= bytesStaged)
+			{
+				break;
+			}
+			size_t bytes = (size_t)std::min((uint64_t)(framesWanted * ingest.frameSize - bytesStaged), clips.bytesLeft);
+			ssize_t pcmRead = readClip(clips, fd, ingest.buffer + bytesStaged, bytes);
+			if (pcmRead <= 0)
+			{
+				return bytesRead > 0 ? bytesRead : pcmRead;
+			}
+			bytesRead += pcmRead;
+			bytesStaged += (size_t)pcmRead;
+			if (clips.bytesLeft != kClipToEnd)
+			{
+				clips.bytesLeft -= (uint64_t)pcmRead;
+			}
+			drainStaging(ringBuffer, ingest, bytesStaged);
+			if (clips.bytesLeft > 0 || (clips.peekBytes == 0 && waitForInput(-1, fd, true, 0) != 1))
+			{
+				return bytesRead;
+			}
+			continue;
+		}
+		
+		ssize_t headerRead = readClip(clips, fd, clips.header + clips.headerBytes, kClipHeaderBytes - clips.headerBytes);
+		if (headerRead <= 0)
+		{
+			return bytesRead > 0 ? bytesRead : headerRead;
+		}
+		bytesRead += headerRead;
+		clips.headerBytes += (size_t)headerRead;
+		if (clips.headerBytes < kClipHeaderBytes)
+		{
+			return bytesRead;
+		}
+		
+		InputHeader header;
+		if (!parseClipHeader(clips.header, header))
+		{
+			ERROR("clip %lu's header isn't one for PCM we can play\n", clips.clips + 1);
+			errno = EINVAL;
+			return -1;
+		}
+		
+		// the resampler hangs on to the last half of its filter's worth of input until there's
+		// more after it, so we give it that much silence to finish this clip with first
+		if (ingest.resampling && clips.clips > 0 && !sameClipFormat(clips, header))
+		{
+			size_t padFrames = std::min((size_t)ingest.resampler.taps / 2, ingest.bufferFrames);
+			makeSilence(clips.format.sampleFormat, clips.format.sampleSize, ingest.buffer, padFrames * ingest.channels);
+			bytesStaged = padFrames * ingest.frameSize;
+			drainStaging(ringBuffer, ingest, bytesStaged);
+			clips.switching = true;
+		}
+		else if (!startClip(clips, ingest, bytesStaged))
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		if (clips.peekBytes == 0 && waitForInput(-1, fd, true, 0) != 1)
+		{
+			return bytesRead;
+		}
+	}
+	
+	if (bytesRead > 0)
+	{
+		return bytesRead;
+	}
+	errno = EAGAIN;
+	return -1;
+}
+
+struct Output
+{
+	// one device we play to; with several, each has its own stream and its own view of
+	// the writer's ring buffer memory, read at its own pace
+	PaDeviceIndex device;
+	PaStream* stream;
+	CallbackData callbackData;
+	Stats stats;
+	Timing timing;
+};
+
+static
+void syncFanoutRing(FrameRing& ringBuffer, Output* outputs, size_t outputCount)
+{
+	// the writer's ring buffer shares its memory with every output's, so it can only reuse
+	// what the output furthest behind has finished with
+	size_t writeIndex = ringBuffer.writeIndex.load(std::memory_order_relaxed);
+	size_t mostUnread = 0;
+	for (size_t i = 0; i < outputCount; ++i)
+	{
+		size_t readIndex = outputs[i].callbackData.ringBuffer.readIndex.load(std::memory_order_acquire);
+		size_t unread = ringSpan(ringBuffer, readIndex, writeIndex);
+		if (i == 0 || unread > mostUnread)
+		{
+			mostUnread = unread;
+			ringBuffer.readIndex.store(readIndex, std::memory_order_relaxed);
+		}
+	}
+}
+
+static
+void publishFanoutRing(FrameRing& ringBuffer, Output* outputs, size_t outputCount)
+{
+	// hand whatever the writer has added since last time to every output
+	size_t writeIndex = ringBuffer.writeIndex.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < outputCount; ++i)
+	{
+		FrameRing& output = outputs[i].callbackData.ringBuffer;
+		if (output.writeIndex.load(std::memory_order_relaxed) != writeIndex)
+		{
+			output.writeIndex.store(writeIndex, std::memory_order_release);
+		}
+	}
+}
+
+static
+void printOutputTiming(const Output* outputs, size_t outputCount)
+{
+	for (size_t i = 0; i < outputCount; ++i)
+	{
+		if (outputCount > 1)
+		{
+			fprintf(stdout, "device %d:\n", outputs[i].device);
+		}
+		printTiming(outputs[i].timing);
+	}
+}
+
+static
+PaError outputsActive(Output* outputs, size_t outputCount)
+{
+	for (size_t i = 0; i < outputCount; ++i)
+	{
+		PaError active = Pa_IsStreamActive(outputs[i].stream);
+		if (active != 1)
+		{
+			return active;
+		}
+	}
+	return 1;
+}
+
+static
+bool outputQueued(const CallbackData& callbackData)
+{
+	if (callbackData.mixInputCount > 0)
+	{
+		for (size_t i = 0; i < callbackData.mixInputCount; ++i)
+		{
+			if (ringReadAvailable(callbackData.mixInputs[i].ringBuffer) > 0)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+	if (callbackData.mapping != nullptr)
+	{
+		return callbackData.mappingCursor.load(std::memory_order_relaxed) < callbackData.mappingFrames;
+	}
+	return ringReadAvailable(callbackData.ringBuffer) > 0;
+}
+
+static
+int drainOutputs(const Options& options, Output* outputs, size_t outputCount, int wakeFd)
+{
+	// has each stream callback complete its stream once it has played out everything queued,
+	// which wakes us through streamFinished, then stops them all; the blocking engine has no
+	// callback, but Pa_StopStream itself waits for whatever was written to play
+	int result = 0;
+	PaError error = paNoError;
+	for (size_t i = 0; i < outputCount && result == 0; ++i)
+	{
+		Output& output = outputs[i];
+		output.callbackData.draining.store(true, std::memory_order_release);
+		if (options.engine == kEngineCallback && Pa_IsStreamStopped(output.stream) == 1 && outputQueued(output.callbackData))
+		{
+			// input ended before we'd prefilled enough to start
+			DEBUG("starting stream: Hope you hear a pop.\n");
+			error = Pa_StartStream(output.stream);
+			if (error != paNoError)
+			{
+				FATAL("could not start stream for device %d: %s\n", output.device, Pa_GetErrorText(error));
+			}
+		}
+	}
+	
+	if (result == 0 && options.engine == kEngineCallback)
+	{
+		// the whole ring buffer and then some is as long as this should ever take
+		const PaStreamInfo* streamInfo = Pa_GetStreamInfo(outputs[0].stream);
+		double drainTime = (double)(outputs[0].callbackData.ringBuffer.bytes / outputs[0].callbackData.ringBuffer.frameSize) / outputs[0].timing.sampleRate + (streamInfo != nullptr ? streamInfo->outputLatency : 0.0) + 1.0;
+		DEBUG("draining up to %gs of queued audio\n", drainTime);
+		
+		std::chrono::duration<double> timeout(drainTime);
+		std::chrono::time_point<std::chrono::high_resolution_clock> start = std::chrono::high_resolution_clock::now();
+		std::chrono::time_point<std::chrono::high_resolution_clock> now = start;
+		for (size_t i = 0; i < outputCount && result == 0; ++i)
+		{
+			while ((error = Pa_IsStreamActive(outputs[i].stream)) == 1 && now - start < timeout)
+			{
+				if (waitForInput(wakeFd, -1, false, pollTimeout(timeout, now - start)) < 0)
+				{
+					FATAL("error when waiting for stream to drain\n");
+					break;
+				}
+				now = std::chrono::high_resolution_clock::now();
+			}
+			if (error == 1)
+			{
+				WARN("gave up waiting for device %d to drain\n", outputs[i].device);
+			}
+			else if (error < 0)
+			{
+				FATAL("stream unexpectedly stopped: %s\n", Pa_GetErrorText(error));
+			}
+		}
+	}
+	
+	for (size_t i = 0; i < outputCount; ++i)
+	{
+		error = Pa_StopStream(outputs[i].stream);
+		if (error != paNoError && error != paStreamIsStopped)
+		{
+			ERROR("could not stop stream: %s\n", Pa_GetErrorText(error));
+		}
+	}
+	return result;
+}
+
+static
+int runCallbackWriter(const Options& options, Output* outputs, size_t outputCount, FrameRing& ringBuffer, Ingest& ingest, ClipInput* clips, Tee* tee, int inputFd, int wakeFd, size_t prefillFrames, bool streamStarted)
+{
+	// reads inputFd until EOF, a clip at a time if there are clips, through tee if there's
+	// one; the server passes streamStarted to keep its streams going from one input to the next
+	int result = 0;
+	PaError error = paNoError;
+	CallbackData& callbackData = outputs[0].callbackData;
+	Stats& stats = outputs[0].stats;
+	std::chrono::duration<double> timeout(options.timeout);
+	std::chrono::duration<double> statsInterval(options.statsInterval > 0.0 ? options.statsInterval : std::numeric_limits<double>::infinity());
+	Stats* outputStats[kMaxOutputs] = {};
+	for (size_t i = 0; i < outputCount; ++i)
+	{
+		outputStats[i] = &outputs[i].stats;
+	}
+	
+	std::chrono::time_point<std::chrono::high_resolution_clock> now = std::chrono::high_resolution_clock::now();
+	std::chrono::time_point<std::chrono::high_resolution_clock> then = now;
+	std::chrono::time_point<std::chrono::high_resolution_clock> lastStats = now;
+	
+	double sampleRate = outputs[0].timing.sampleRate;
+	DriftControl drift = {};
+	drift.targetFrames = options.driftTarget * sampleRate / 1000.0;
+	drift.nominalStep = ingest.resampler.step;
+	drift.averageFrames = drift.targetFrames;
+	std::chrono::duration<double> driftInterval(options.driftTarget > 0.0 ? kDriftInterval : std::numeric_limits<double>::infinity());
+	std::chrono::time_point<std::chrono::high_resolution_clock> lastDrift = now;
+	unsigned long driftUpdates = 0;
+	
+	DEBUG("entering callback writer loop for %zu output(s) with a prefill of %ld frames, wake threshold of %ld frames and timeout of %gs\n",
+		outputCount,
+		(long)prefillFrames,
+		(long)callbackData.wakeThreshold,
+		timeout.count());
+	
+	size_t byteIndex = ingest.bytesPreloaded;	// everything staged, when processing; a partial frame read straight in just waits in the ring
+	ingest.bytesPreloaded = 0;
+	ingest.flushed = false;	// a server's resampler is flushed at the end of each of its inputs
+	bool inputOpen = true;
+	
+	// an io_uring can only read straight into the ring buffer, and only from a blocking
+	// input, whose reads it leaves waiting in the kernel rather than failing with EAGAIN
+	InputRing inputRing = {};
+	if (options.reader == kReaderUring)
+	{
+		int flags = fcntl(inputFd, F_GETFL);
+		if (ingest.buffer != nullptr)
+		{
+			WARN("input needs converting first, so reading it with poll instead of io_uring\n");
+		}
+		else if (tee != nullptr)
+		{
+			WARN("input is teed as it's read, so reading it with poll instead of io_uring\n");
+		}
+		else if (ingest.bytesLeft != kInputToEnd)
+		{
+			WARN("input's header says where its audio ends, so reading it with poll instead of io_uring\n");
+		}
+		else if (flags < 0 || (flags & O_NONBLOCK) != 0)
+		{
+			WARN("input is nonblocking, so reading it with poll instead of io_uring\n");
+		}
+		else if (!openInputRing(inputRing, wakeFd, ringBuffer.buffer, ringBuffer.bytes))
+		{
+			WARN("could not set up io_uring (%s), so reading input with poll instead\n", strerror(errno));
+		}
+		else
+		{
+			DEBUG("reading input with io_uring\n");
+		}
+	}
+	unsigned long underrunsSeen[kMaxOutputs] = {};
+	for (size_t i = 0; i < outputCount; ++i)
+	{
+		underrunsSeen[i] = outputs[i].stats.underruns.load(std::memory_order_relaxed) + outputs[i].stats.partialCallbacks.load(std::memory_order_relaxed);
+	}
+	
+	// when draining, we keep going after EOF until whatever is staged has made it into the
+	// ring buffer, so the stream callbacks can play it out
+	while (result == 0 && !stopRequested.load(std::memory_order_relaxed) &&
+		(inputOpen || (options.drain && !ingestDrained(ingest, byteIndex))) &&
+		(!inputOpen || (now - then) < timeout) &&
+		(!streamStarted || (error = outputsActive(outputs, outputCount)) == 1))
+	{
+		// whatever didn't fit last time (or what -Q read ahead) goes in before we look at the
+		// prefill, since it may be enough on its own to fill the ring buffer; and until the
+		// streams start there's nothing to make room, so one that fills up short of the prefill
+		// starts them anyway
+		syncFanoutRing(ringBuffer, outputs, outputCount);
+		if (ingest.buffer != nullptr)
+		{
+			if (!inputOpen)
+			{
+				flushStaging(ingest, byteIndex);
+			}
+			drainStaging(ringBuffer, ingest, byteIndex);
+			publishFanoutRing(ringBuffer, outputs, outputCount);
+		}
+		if (!streamStarted && (ringReadAvailable(ringBuffer) >= prefillFrames || !inputOpen || ringWriteAvailable(ringBuffer) == 0))
+		{
+			DEBUG("starting stream: Hope you hear a pop.\n");
+			for (size_t i = 0; i < outputCount && result == 0; ++i)
+			{
+				error = Pa_StartStream(outputs[i].stream);
+				if (error != paNoError)
+				{
+					FATAL("could not start stream for device %d: %s\n", outputs[i].device, Pa_GetErrorText(error));
+				}
+			}
+			streamStarted = true;
+			continue;
+		}
+		
+		// a server's FIFO goes quiet between inputs, and running dry with nothing more on the
+		// way is just the end of one of them; so is the silence until the next one arrives,
+		// which we catch below when we read into an empty ring buffer
+		int bytesPending = 0;
+		bool idle = options.serverPath != nullptr && ringReadAvailable(ringBuffer) == 0 &&
+			(ingest.buffer == nullptr || byteIndex < ingest.frameSize) &&
+			ioctl(inputFd, FIONREAD, &bytesPending) == 0 && bytesPending == 0;
+		for (size_t i = 0; i < outputCount; ++i)
+		{
+			Stats& output = outputs[i].stats;
+			unsigned long underruns = output.underruns.load(std::memory_order_relaxed) + output.partialCallbacks.load(std::memory_order_relaxed);
+			if (underruns != underrunsSeen[i] && !idle)
+			{
+				if (outputCount > 1)
+				{
+					WARN("ring buffer starved for device %d! (%lu underruns so far)\n", outputs[i].device, underruns);
+				}
+				else
+				{
+					WARN("ring buffer starved! (%lu underruns so far)\n", underruns);
+				}
+			}
+			underrunsSeen[i] = underruns;
+		}
+		
+		size_t framesAvailable = ringWriteAvailable(ringBuffer);
+		
+		// the same goes for waiting on room: before the streams start, any room at all is
+		// worth reading into, or we'd wait on callbacks that aren't coming
+		size_t roomWanted = streamStarted ? callbackData.wakeThreshold : 1;
+		bool roomForInput = inputOpen && framesAvailable >= roomWanted;
+		if (!roomForInput)
+		{
+			// ask the stream callbacks to wake us once they've made room, then check again in
+			// case they already did so before they could see our request
+			callbackData.writerWaiting->store(true);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			syncFanoutRing(ringBuffer, outputs, outputCount);
+			roomForInput = inputOpen && ringWriteAvailable(ringBuffer) >= roomWanted;
+		}
+		
+		int waitTimeout = minTimeout(inputOpen ? pollTimeout(timeout, now - then) : -1, minTimeout(pollTimeout(statsInterval, now - lastStats), pollTimeout(driftInterval, now - lastDrift)));
+		size_t partialBytes = ingest.buffer == nullptr ? ringPartialBytes(ringBuffer) : byteIndex % ingest.frameSize;
+		ssize_t bytesRead = 0;
+		int ready = inputRing.state != nullptr ?
+			readRingBufferAsync(inputRing, inputFd, roomForInput, waitTimeout, ringBuffer, bytesRead) :
+			waitForInput(wakeFd, inputFd, roomForInput, waitTimeout);
+		switch (ready)
+		{
+			case -1:
+				FATAL("error when waiting for input pipe\n");
+				break;
+			case 0:
+				break;
+			default:
+				{
+					// an io_uring read has already landed by now, so the ring buffer being
+					// empty before it means holding nothing else
+					size_t framesLanded = inputRing.state != nullptr && bytesRead > 0 ? (partialBytes + (size_t)bytesRead) / ingest.frameSize : 0;
+					if (options.serverPath != nullptr && ringReadAvailable(ringBuffer) <= framesLanded)
+					{
+						for (size_t i = 0; i < outputCount; ++i)
+						{
+							underrunsSeen[i] = outputs[i].stats.underruns.load(std::memory_order_relaxed) + outputs[i].stats.partialCallbacks.load(std::memory_order_relaxed);
+						}
+					}
+					if (inputRing.state == nullptr)
+					{
+						if (clips != nullptr)
+						{
+							bytesRead = readClipRingBuffer(inputFd, ringBuffer, ingest, byteIndex, *clips);
+						}
+						else
+						{
+							bytesRead = ingest.buffer == nullptr ?
+								readRingBuffer(inputFd, ringBuffer, ingest, tee) :
+								readConvertRingBuffer(inputFd, ringBuffer, ingest, byteIndex, tee);
+						}
+					}
+					publishFanoutRing(ringBuffer, outputs, outputCount);
+					stats.readCalls.fetch_add(1, std::memory_order_relaxed);
+					if (bytesRead < 0 && errno != EINTR && errno != EAGAIN)
+					{
+						FATAL("error when reading input pipe\n");
+					}
+					if (bytesRead > 0)
+					{
+						stats.bytesRead.fetch_add((unsigned long long)bytesRead, std::memory_order_relaxed);
+						stats.framesWritten.fetch_add((partialBytes + (size_t)bytesRead) / ingest.frameSize, std::memory_order_relaxed);
+					}
+					inputOpen = bytesRead != 0;	// check for EOF
+					then = std::chrono::high_resolution_clock::now();	// reset our timeout timer after we successfully read from the input
+				}
+				break;
+		}
+		
+		now = std::chrono::high_resolution_clock::now();
+		if (now - lastStats >= statsInterval)
+		{
+			printStats(outputStats, outputCount, options.statsJSON);
+			lastStats = now;
+		}
+		if (timingRequested.exchange(false))
+		{
+			printOutputTiming(outputs, outputCount);
+		}
+		if (now - lastDrift >= driftInterval)
+		{
+			if (streamStarted)
+			{
+				double frames = queuedFrames(inputFd, ringBuffer, ingest, byteIndex);
+				updateDrift(drift, ingest.resampler, frames, sampleRate, std::chrono::duration<double>(now - lastDrift).count());
+				if (++driftUpdates % 20 == 0)
+				{
+					DEBUG("drift: queued %.1fms, average %.1fms, target %.1fms, correction %+.0fppm\n",
+						frames * 1000.0 / sampleRate,
+						drift.averageFrames * 1000.0 / sampleRate,
+						options.driftTarget,
+						drift.correction * 1e6);
+				}
+			}
+			lastDrift = now;
+		}
+	}
+	
+	// whatever the last read managed before we called it off still gets played, as it
+	// would have had we read it ourselves
+	if (inputRing.state != nullptr)
+	{
+		size_t partialBytes = ringPartialBytes(ringBuffer);
+		ssize_t bytesRead = cancelInputRing(inputRing);
+		if (bytesRead > 0)
+		{
+			ringAdvanceWrite(ringBuffer, (size_t)bytesRead);
+			stats.bytesRead.fetch_add((unsigned long long)bytesRead, std::memory_order_relaxed);
+			stats.framesWritten.fetch_add((partialBytes + (size_t)bytesRead) / ingest.frameSize, std::memory_order_relaxed);
+		}
+		closeInputRing(inputRing);
+	}
+	
+	// and a partial frame the input ended on never will be; a server's next input starts
+	// on a whole frame
+	if (ingest.buffer == nullptr)
+	{
+		ringDropPartialFrame(ringBuffer);
+	}
+	publishFanoutRing(ringBuffer, outputs, outputCount);
+	
+	if (inputOpen && (now - then) >= timeout)
+	{
+		INFO("timed out waiting for input pipe\n");
+	}
+	else if (!inputOpen)
+	{
+		INFO("input pipe closed\n");
+	}
+	
+	if (error < 0)
+	{
+		FATAL("stream unexpectedly stopped: %s\n", Pa_GetErrorText(error));
+	}
+	
+	return result;
+}
+
+static const int kServerBacklog = 16;	// clients waiting their turn to play
+
+static const size_t kNetworkBatch = 16;		// packets per receive call
+static const size_t kMaxPacketBytes = 2048;	// anything bigger is truncated
+
+static
+int openReceiver(const Options& options)
+{
+	// binds a UDP socket to host:port, an empty host meaning any address, and joins the
+	// group if it's a multicast one; returns -1 with an error already printed on failure
+	const char* separator = strrchr(options.networkAddress, ':');
+	if (separator == nullptr)
+	{
+		ERROR("network address %s has no port\n", options.networkAddress);
+		return -1;
+	}
+	char host[256] = {};
+	size_t hostLength = std::min((size_t)(separator - options.networkAddress), sizeof(host) - 1);
+	memcpy(host, options.networkAddress, hostLength);
+	if (hostLength >= 2 && host[0] == '[' && host[hostLength - 1] == ']')
+	{
+		memmove(host, host + 1, hostLength - 2);	// a bracketed IPv6 address
+		host[hostLength - 2] = '\0';
+	}
+	
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE;
+	addrinfo* addresses = nullptr;
+	int error = getaddrinfo(host[0] != '\0' ? host : nullptr, separator + 1, &hints, &addresses);
+	if (error != 0)
+	{
+		ERROR("could not resolve %s: %s\n", options.networkAddress, gai_strerror(error));
+		return -1;
+	}
+	
+	int socketFd = -1;
+	for (addrinfo* address = addresses; address != nullptr && socketFd < 0; address = address->ai_next)
+	{
+		socketFd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+		if (socketFd < 0)
+		{
+			continue;
+		}
+		
+		// room for a good burst of packets while we're busy, and others may share a group
+		int enable = 1;
+		int receiveBuffer = 1 << 20;
+		setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+		setsockopt(socketFd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+		
+		bool joined = true;
+		if (bind(socketFd, address->ai_addr, address->ai_addrlen) == 0)
+		{
+			if (address->ai_family == AF_INET && IN_MULTICAST(ntohl(((sockaddr_in*)address->ai_addr)->sin_addr.s_addr)))
+			{
+				ip_mreq request = {};
+				request.imr_multiaddr = ((sockaddr_in*)address->ai_addr)->sin_addr;
+				request.imr_interface.s_addr = htonl(INADDR_ANY);
+				joined = setsockopt(socketFd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) == 0;
+			}
+			else if (address->ai_family == AF_INET6 && IN6_IS_ADDR_MULTICAST(&((sockaddr_in6*)address->ai_addr)->sin6_addr))
+			{
+				ipv6_mreq request = {};
+				request.ipv6mr_multiaddr = ((sockaddr_in6*)address->ai_addr)->sin6_addr;
+				joined = setsockopt(socketFd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &request, sizeof(request)) == 0;
+			}
+			if (joined && fcntl(socketFd, F_SETFL, O_NONBLOCK) == 0)
+			{
+				break;
+			}
+		}
+		close(socketFd);
+		socketFd = -1;
+	}
+	freeaddrinfo(addresses);
+	
+	if (socketFd < 0)
+	{
+		ERROR("could not receive on %s: %s\n", options.networkAddress, strerror(errno));
+	}
+	return socketFd;
+}
+
+static
+int receivePackets(int socketFd, uint8_t* packets, size_t* packetSizes)
+{
+	// up to kNetworkBatch packets of kMaxPacketBytes each in one go where we can; returns
+	// how many, or -1 with errno set
+#if defined(__linux__)
+	mmsghdr messages[kNetworkBatch];
+	iovec iov[kNetworkBatch];
+	memset(messages, 0, sizeof(messages));
+	for (size_t i = 0; i < kNetworkBatch; ++i)
+	{
+		iov[i].iov_base = packets + i * kMaxPacketBytes;
+		iov[i].iov_len = kMaxPacketBytes;
+		messages[i].msg_hdr.msg_iov = &iov[i];
+		messages[i].msg_hdr.msg_iovlen = 1;
+	}
+	int count = recvmmsg(socketFd, messages, kNetworkBatch, MSG_DONTWAIT, nullptr);
+	for (int i = 0; i < count; ++i)
+	{
+		packetSizes[i] = messages[i].msg_len;
+	}
+	return count;
+#else
+	ssize_t bytes = recv(socketFd, packets, kMaxPacketBytes, MSG_DONTWAIT);
+	if (bytes < 0)
+	{
+		return -1;
+	}
+	packetSizes[0] = (size_t)bytes;
+	return 1;
+#endif
+}
+
+static
+bool writeInput(FrameRing& ringBuffer, Ingest& ingest, const uint8_t* input, size_t bytes, size_t& bytesStaged)
+{
+	// the in-memory counterpart to readConvertRingBuffer, all or nothing: returns false
+	// without taking any of input if there's no room for it yet
+	if (ingest.buffer == nullptr)
+	{
+		size_t frames = bytes / ingest.frameSize;
+		if (ringWriteAvailable(ringBuffer) < frames)
+		{
+			return false;
+		}
+		ringWrite(ringBuffer, input, frames);
+		return true;
+	}
+	
+	drainStaging(ringBuffer, ingest, bytesStaged);
+	if (bytesStaged + bytes > ingest.bufferFrames * ingest.frameSize)
+	{
+		return false;
+	}
+	memcpy(ingest.buffer + bytesStaged, input, bytes);
+	bytesStaged += bytes;
+	drainStaging(ringBuffer, ingest, bytesStaged);
+	return true;
+}
+
+static
+int runNetworkWriter(const Options& options, Output* outputs, size_t outputCount, FrameRing& ringBuffer, Ingest& ingest, int socketFd, int wakeFd, size_t prefillFrames)
+{
+	// like runCallbackWriter, but with RTP packets put back in order by a jitter buffer
+	// ahead of the ring buffer; we always take packets off the socket as they come, so the
+	// kernel never drops them for us, and only hand them on as there's room
+	int result = 0;
+	PaError error = paNoError;
+	CallbackData& callbackData = outputs[0].callbackData;
+	Stats& stats = outputs[0].stats;
+	std::chrono::duration<double> timeout(options.timeout);
+	std::chrono::duration<double> statsInterval(options.statsInterval > 0.0 ? options.statsInterval : std::numeric_limits<double>::infinity());
+	Stats* outputStats[kMaxOutputs] = {};
+	for (size_t i = 0; i < outputCount; ++i)
+	{
+		outputStats[i] = &outputs[i].stats;
+	}
+	
+	std::chrono::time_point<std::chrono::high_resolution_clock> now = std::chrono::high_resolution_clock::now();
+	std::chrono::time_point<std::chrono::high_resolution_clock> then = now;
+	std::chrono::time_point<std::chrono::high_resolution_clock> lastStats = now;
+	
+	JitterBuffer jitter;
+	uint8_t* packets = (uint8_t*)malloc(kNetworkBatch * kMaxPacketBytes);
+	if (!initJitterBuffer(jitter, kMaxPacketBytes, 1) || packets == nullptr)
+	{
+		FATAL("could not allocate memory for jitter buffer\n");
+	}
+	else
+	{
+		makeSilence(options.inputSampleFormat, options.inputSampleSize, jitter.silence, kMaxPacketBytes / options.inputSampleSize);
+	}
+	
+	DEBUG("entering network writer loop with a prefill of %ld frames, jitter buffer of %gms and timeout of %gs\n",
+		(long)prefillFrames,
+		options.jitterTime,
+		timeout.count());
+	
+	size_t bytesStaged = 0;
+	bool streamStarted = false;
+	unsigned long concealed = 0;
+	unsigned long underrunsSeen[kMaxOutputs] = {};
+	while (result == 0 && !stopRequested.load(std::memory_order_relaxed) && (now - then) < timeout && (!streamStarted || (error = outputsActive(outputs, outputCount)) == 1))
+	{
+		syncFanoutRing(ringBuffer, outputs, outputCount);
+		size_t bytes = 0;
+		bool isConcealment = false;
+		const uint8_t* payload = nullptr;
+		while ((payload = jitterNext(jitter, bytes, isConcealment)) != nullptr && writeInput(ringBuffer, ingest, payload, bytes, bytesStaged))
+		{
+			stats.framesWritten.fetch_add(bytes / ingest.frameSize, std::memory_order_relaxed);
+			concealed += isConcealment ? 1 : 0;
+			jitterAdvance(jitter);
+		}
+		publishFanoutRing(ringBuffer, outputs, outputCount);
+		if (payload != nullptr)
+		{
+			// the next packet's waiting on room, so have the stream callbacks tell us once there is
+			callbackData.writerWaiting->store(true);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+		}
+		
+		if (!streamStarted && ringReadAvailable(ringBuffer) >= prefillFrames && ringReadAvailable(ringBuffer) > 0)
+		{
+			DEBUG("starting stream: Hope you hear a pop.\n");
+			for (size_t i = 0; i < outputCount && result == 0; ++i)
+			{
+				error = Pa_StartStream(outputs[i].stream);
+				if (error != paNoError)
+				{
+					FATAL("could not start stream for device %d: %s\n", outputs[i].device, Pa_GetErrorText(error));
+				}
+			}
+			streamStarted = true;
+			continue;
+		}
+		
+		for (size_t i = 0; i < outputCount; ++i)
+		{
+			Stats& output = outputs[i].stats;
+			unsigned long underruns = output.underruns.load(std::memory_order_relaxed) + output.partialCallbacks.load(std::memory_order_relaxed);
+			if (underruns != underrunsSeen[i])
+			{
+				WARN("ring buffer starved for device %d! (%lu underruns so far)\n", outputs[i].device, underruns);
+				underrunsSeen[i] = underruns;
+			}
+		}
+		
+		switch (waitForInput(wakeFd, socketFd, true, minTimeout(pollTimeout(timeout, now - then), pollTimeout(statsInterval, now - lastStats))))
+		{
+			case -1:
+				FATAL("error when waiting for packets\n");
+				break;
+			case 0:
+				break;
+			default:
+				{
+					size_t packetSizes[kNetworkBatch];
+					int count = receivePackets(socketFd, packets, packetSizes);
+					stats.readCalls.fetch_add(1, std::memory_order_relaxed);
+					if (count < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)
+					{
+						FATAL("error when receiving packets: %s\n", strerror(errno));
+					}
+					for (int i = 0; i < count; ++i)
+					{
+						uint16_t sequence = 0;
+						const uint8_t* packetPayload = nullptr;
+						size_t payloadBytes = 0;
+						if (!parseRtp(packets + (size_t)i * kMaxPacketBytes, packetSizes[i], sequence, packetPayload, payloadBytes))
+						{
+							continue;
+						}
+						if (!jitter.started)
+						{
+							// now we know how long a packet is, we know how many make up the jitter buffer
+							double packetFrames = std::max((double)(payloadBytes / ingest.frameSize), 1.0);
+							jitter.holdPackets = std::min(std::max((size_t)std::ceil(options.jitterTime * options.sampleRate / 1000.0 / packetFrames), (size_t)1), JitterBuffer::kSlots / 2);
+							INFO("receiving %g-frame packets, holding up to %zu for reordering\n", packetFrames, jitter.holdPackets);
+						}
+						jitterInsert(jitter, sequence, packetPayload, payloadBytes);
+						stats.bytesRead.fetch_add((unsigned long long)payloadBytes, std::memory_order_relaxed);
+					}
+					if (count > 0)
+					{
+						then = std::chrono::high_resolution_clock::now();	// reset our timeout timer after we successfully receive packets
+					}
+				}
+				break;
+		}
+		
+		now = std::chrono::high_resolution_clock::now();
+		if (now - lastStats >= statsInterval)
+		{
+			printStats(outputStats, outputCount, options.statsJSON);
+			lastStats = now;
+		}
+		if (timingRequested.exchange(false))
+		{
+			printOutputTiming(outputs, outputCount);
+		}
+	}
+	
+	if ((now - then) >= timeout)
+	{
+		INFO("timed out waiting for packets\n");
+	}
+	INFO("network: received=%lu lost=%lu concealed=%lu late=%lu duplicates=%lu resyncs=%lu\n",
+		jitter.received,
+		jitter.lost,
+		concealed,
+		jitter.late,
+		jitter.duplicates,
+		jitter.resyncs);
+	
+	if (error < 0)
+	{
+		FATAL("stream unexpectedly stopped: %s\n", Pa_GetErrorText(error));
+	}
+	
+	freeJitterBuffer(jitter);
+	free(packets);
+	return result;
+}
+
+static
+int openListener(const char* path, bool& isFifo)
+{
+	// returns a FIFO already at path opened read-write, so there's always a writer and we
+	// never see EOF, or a listening Unix socket there, or -1 with errno set
+	struct stat pathStat = {};
+	bool exists = stat(path, &pathStat) == 0;
+	isFifo = exists && S_ISFIFO(pathStat.st_mode);
+	if (isFifo)
+	{
+		return open(path, O_RDWR);
+	}
+	
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+	if (exists && S_ISSOCK(pathStat.st_mode))
+	{
+		unlink(path);	// left over from a run that didn't get to clean up
+	}
+	
+	int serverFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (serverFd >= 0 && (bind(serverFd, (const sockaddr*)&address, sizeof(address)) != 0 || listen(serverFd, kServerBacklog) != 0))
+	{
+		int bindError = errno;
+		close(serverFd);
+		errno = bindError;
+		serverFd = -1;
+	}
+	return serverFd;
+}
+
+static
+int runServer(const Options& options, Output* outputs, size_t outputCount, FrameRing& ringBuffer, Ingest& ingest, int serverFd, bool serverIsFifo, int wakeFd)
+{
+	// starts the streams right away and keeps them going, silent whenever the ring buffer
+	// is empty, while the callback writer plays each client in turn; the ingest carries on
+	// from one to the next, so back-to-back inputs play without a gap
+	int result = 0;
+	PaError error = paNoError;
+	std::chrono::duration<double> statsInterval(options.statsInterval > 0.0 ? options.statsInterval : std::numeric_limits<double>::infinity());
+	Stats* outputStats[kMaxOutputs] = {};
+	for (size_t i = 0; i < outputCount; ++i)
+	{
+		outputStats[i] = &outputs[i].stats;
+	}
+	
+	std::chrono::time_point<std::chrono::high_resolution_clock> now = std::chrono::high_resolution_clock::now();
+	std::chrono::time_point<std::chrono::high_resolution_clock> lastStats = now;
+	
+	DEBUG("starting stream: Hope you hear a pop.\n");
+	for (size_t i = 0; i < outputCount && result == 0; ++i)
+	{
+		error = Pa_StartStream(outputs[i].stream);
+		if (error != paNoError)
+		{
+			FATAL("could not start stream for device %d: %s\n", outputs[i].device, Pa_GetErrorText(error));
+		}
+	}
+	
+	unsigned long clients = 0;
+	while (result == 0 && !stopRequested.load(std::memory_order_relaxed) && (error = outputsActive(outputs, outputCount)) == 1)
+	{
+		if (serverIsFifo)
+		{
+			// only returns when told to stop, or if writers go quiet for longer than -t
+			result = runCallbackWriter(options, outputs, outputCount, ringBuffer, ingest, nullptr, nullptr, serverFd, wakeFd, 0, true);
+			continue;
+		}
+		
+		switch (waitForInput(wakeFd, serverFd, true, pollTimeout(statsInterval, now - lastStats)))
+		{
+			case -1:
+				FATAL("error when waiting for clients\n");
+				break;
+			case 0:
+				break;
+			default:
+				{
+					int clientFd = accept(serverFd, nullptr, nullptr);
+					if (clientFd < 0)
+					{
+						if (errno != EINTR && errno != ECONNABORTED)
+						{
+							WARN("could not accept client: %s\n", strerror(errno));
+						}
+						break;
+					}
+					INFO("playing client %lu\n", ++clients);
+					result = runCallbackWriter(options, outputs, outputCount, ringBuffer, ingest, nullptr, nullptr, clientFd, wakeFd, 0, true);
+					close(clientFd);
+				}
+				break;
+		}
+		
+		now = std::chrono::high_resolution_clock::now();
+		if (now - lastStats >= statsInterval)
+		{
+			printStats(outputStats, outputCount, options.statsJSON);
+			lastStats = now;
+		}
+		if (timingRequested.exchange(false))
+		{
+			printOutputTiming(outputs, outputCount);
+		}
+	}
+	
+	if (error < 0)
+	{
+		FATAL("stream unexpectedly stopped: %s\n", Pa_GetErrorText(error));
+	}
+	else if (stopRequested.load(std::memory_order_relaxed))
+	{
+		INFO("stopping server after %lu clients\n", clients);
+	}
+	
+	return result;
+}
+
+static const size_t kControlLineBytes = 256;	// anything longer is thrown away
+static const double kDeclickTime = 5.0;		// milliseconds any gain change but a fade ramps over
+static const float kMaxGain = 4.0f;			// +12dB
+
+struct ControlInput
+{
+	// what the control thread needs: where commands come from, which stream callbacks
+	// they go to, and the gain and mute they add up to so far
+	const Options* options;
+	int fd;
+	bool isFifo;
+	int stopFd;
+	GainControl* controls[kMaxOutputs];
+	size_t controlCount;
+	double sampleRate;
+	float gain;
+	bool muted;
+};
+
+static
+bool parseGain(const char* arg, float& gain)
+{
+	// linear, or in decibels with a dB suffix
+	char* end = nullptr;
+	double value = arg != nullptr ? strtod(arg, &end) : 0.0;
+	if (arg == nullptr || end == arg)
+	{
+		return false;
+	}
+	if (tolower(end[0]) == 'd' && tolower(end[1]) == 'b')
+	{
+		value = std::pow(10.0, value / 20.0);
+		end += 2;
+	}
+	if (*end != '\0' || !(value >= 0.0))
+	{
+		return false;
+	}
+	gain = (float)std::min(value, (double)kMaxGain);
+	return true;
+}
+
+static
+void postGain(ControlInput& input, float target, double milliseconds)
+{
+	const Options& options = *input.options;
+	GainCommand command = { target, (unsigned long)(milliseconds * input.sampleRate / 1000.0) };
+	for (size_t i = 0; i < input.controlCount; ++i)
+	{
+		if (ringWrite(input.controls[i]->commands, &command, 1) != 1)
+		{
+			WARN("stream callback isn't taking gain commands, dropping one\n");
+		}
+	}
+}
+
+static
+void runControlCommand(ControlInput& input, char* line)
+{
+	// gain <gain>, fade <gain> <milliseconds>, mute, or unmute; a mute holds on to the
+	// gain, so gain changes made while muted are heard once unmuted
+	const Options& options = *input.options;
+	const char* kSeparators = " \t\r";
+	char* rest = nullptr;
+	char* command = strtok_r(line, kSeparators, &rest);
+	float gain = 0.0f;
+	if (command == nullptr)
+	{
+		return;
+	}
+	else if (strcmp(command, "gain") == 0 && parseGain(strtok_r(nullptr, kSeparators, &rest), gain))
+	{
+		input.gain = gain;
+		postGain(input, input.muted ? 0.0f : input.gain, kDeclickTime);
+	}
+	else if (strcmp(command, "fade") == 0 && parseGain(strtok_r(nullptr, kSeparators, &rest), gain))
+	{
+		const char* time = strtok_r(nullptr, kSeparators, &rest);
+		double milliseconds = time != nullptr ? atof(time) : -1.0;
+		if (milliseconds < 0.0)
+		{
+			WARN("fade needs a time in milliseconds\n");
+			return;
+		}
+		input.gain = gain;
+		postGain(input, input.muted ? 0.0f : input.gain, milliseconds);
+	}
+	else if (strcmp(command, "mute") == 0)
+	{
+		input.muted = true;
+		postGain(input, 0.0f, kDeclickTime);
+	}
+	else if (strcmp(command, "unmute") == 0)
+	{
+		input.muted = false;
+		postGain(input, input.gain, kDeclickTime);
+	}
+	else
+	{
+		WARN("ignoring control command %s\n", command);
+		return;
+	}
+	DEBUG("control: %s, gain %g%s\n", command, input.gain, input.muted ? " (muted)" : "");
+}
+
+static
+void runControlThread(ControlInput* input)
+{
+	// reads commands a line at a time from the FIFO, or from one connection to the socket
+	// at a time, until the stop pipe hangs up
+	const Options& options = *input->options;
+	char line[kControlLineBytes];
+	size_t length = 0;
+	bool discarding = false;	// the rest of a line too long to take
+	int clientFd = input->isFifo ? input->fd : -1;
+	for (;;)
+	{
+		pollfd fds[2] =
+		{
+			{ input->stopFd, POLLIN, 0 },
+			{ clientFd != -1 ? clientFd : input->fd, POLLIN, 0 },
+		};
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			ERROR("error when waiting for control commands: %s\n", strerror(errno));
+			break;
+		}
+		if (fds[0].revents != 0)
+		{
+			break;
+		}
+		if (fds[1].revents == 0)
+		{
+			continue;
+		}
+		
+		if (clientFd == -1)
+		{
+			clientFd = accept(input->fd, nullptr, nullptr);
+			length = 0;
+			discarding = false;
+			continue;
+		}
+		
+		ssize_t bytesRead = read(clientFd, line + length, sizeof(line) - 1 - length);
+		if (bytesRead <= 0)
+		{
+			if (bytesRead < 0 && (errno == EINTR || errno == EAGAIN))
+			{
+				continue;
+			}
+			if (!input->isFifo)
+			{
+				close(clientFd);
+				clientFd = -1;
+			}
+			continue;
+		}
+		length += (size_t)bytesRead;
+		
+		char* start = line;
+		char* newline = nullptr;
+		while ((newline = (char*)memchr(start, '\n', length - (size_t)(start - line))) != nullptr)
+		{
+			*newline = '\0';
+			if (!discarding)
+			{
+				runControlCommand(*input, start);
+			}
+			discarding = false;
+			start = newline + 1;
+		}
+		length -= (size_t)(start - line);
+		memmove(line, start, length);
+		if (length == sizeof(line) - 1)
+		{
+			if (!discarding)
+			{
+				WARN("control command too long, ignoring it\n");
+			}
+			discarding = true;
+			length = 0;
+		}
+	}
+	if (clientFd != -1 && !input->isFifo)
+	{
+		close(clientFd);
+	}
+}
+
+static
+int runBlockingWriter(const Options& options, PaStream* stream, uint8_t* buffer, size_t bufferFrames, Ingest& ingest, Tee* tee, size_t prefillFrames, Stats& stats, int wakeFd)
+{
+	int result = 0;
+	PaError error = paNoError;
+	size_t frameSize = ingest.frameSize;
+	uint8_t* input = ingest.buffer != nullptr ? ingest.buffer : buffer;	// what we read into, and maybe process out of
+	size_t inputFrames = ingest.buffer != nullptr ? ingest.bufferFrames : bufferFrames;
+	size_t prefillInputFrames = std::min(inputFramesFor(ingest, prefillFrames), inputFrames);
+	std::chrono::duration<double> timeout(options.timeout);
+	std::chrono::duration<double> statsInterval(options.statsInterval > 0.0 ? options.statsInterval : std::numeric_limits<double>::infinity());
+	
+	std::chrono::time_point<std::chrono::high_resolution_clock> now = std::chrono::high_resolution_clock::now();
+	std::chrono::time_point<std::chrono::high_resolution_clock> then = now;
+	std::chrono::time_point<std::chrono::high_resolution_clock> lastStats = now;
+	
+	DEBUG("entering blocking write loop with a prefill of %zu frames and timeout of %gs\n",
+		prefillFrames,
+		timeout.count());
+	
+	size_t bytesStaged = ingest.bytesPreloaded;	// data read from stdin but not yet handed to PortAudio
+	ingest.bytesPreloaded = 0;
+	bool stdinOpen = true;
+	bool streamStarted = false;
+	
+	// when draining, we keep going after EOF until we've written everything staged, then
+	// Pa_StopStream plays it out
+	while (result == 0 &&
+		(stdinOpen || (options.drain && (bytesStaged >= frameSize || !ingestDrained(ingest, bytesStaged)))) &&
+		(!stdinOpen || (now - then) < timeout) &&
+		(!streamStarted || (error = Pa_IsStreamActive(stream)) == 1))
+	{
+		if (!stdinOpen && ingest.buffer != nullptr)
+		{
+			flushStaging(ingest, bytesStaged);
+		}
+		size_t framesStaged = bytesStaged / frameSize;
+		if (!streamStarted && (framesStaged >= prefillInputFrames || !stdinOpen))
+		{
+			DEBUG("starting stream: Hope you hear a pop.\n");
+			error = Pa_StartStream(stream);
+			if (error != paNoError)
+			{
+				FATAL("could not start stream: %s\n", Pa_GetErrorText(error));
+			}
+			streamStarted = true;
+			continue;
+		}
+		
+		size_t framesWanted = inputFrames;
+		size_t framesConsumed = 0;
+		if (streamStarted && framesStaged > 0)
+		{
+			framesConsumed = framesStaged;
+			size_t framesOut = framesStaged;
+			if (ingest.buffer != nullptr)
+			{
+				framesOut = processInput(ingest, input, framesStaged, buffer, bufferFrames, framesConsumed);
+			}
+			
+			// this blocks while the device catches up, which is what throttles us
+			error = framesOut > 0 ? Pa_WriteStream(stream, buffer, (unsigned long)framesOut) : paNoError;
+			if (error == paOutputUnderflowed)
+			{
+				stats.underruns.fetch_add(1, std::memory_order_relaxed);
+				WARN("output underflowed!\n");
+			}
+			else if (error != paNoError)
+			{
+				FATAL("could not write to stream: %s\n", Pa_GetErrorText(error));
+				break;
+			}
+			stats.framesPlayed.fetch_add(framesOut, std::memory_order_relaxed);
+			
+			bytesStaged -= framesConsumed * frameSize;
+			memmove(input, input + framesConsumed * frameSize, bytesStaged);	// keep any partial frame, or input that didn't fit
+			framesStaged -= framesConsumed;
+		}
+		if (streamStarted)
+		{
+			// only take about as much as the device can accept right away and leave the rest
+			// in the pipe, rather than queueing it up here and adding latency
+			signed long writeAvailable = Pa_GetStreamWriteAvailable(stream);
+			size_t framesWritable = std::max((size_t)std::max(writeAvailable, 0L), (size_t)options.framesPerBuffer);
+			framesWanted = std::min(inputFramesFor(ingest, framesWritable), inputFrames);
+		}
+		if (!stdinOpen)
+		{
+			if (framesConsumed == 0)
+			{
+				break;	// nothing more is coming of whatever's left
+			}
+			continue;
+		}
+		if (framesStaged > 0 && bytesStaged >= framesWanted * frameSize)
+		{
+			continue;	// still have more than we want staged from last time
+		}
+		
+		switch (waitForInput(wakeFd, STDIN_FILENO, true, minTimeout(pollTimeout(timeout, now - then), pollTimeout(statsInterval, now - lastStats))))
+		{
+			case -1:
+				FATAL("error when waiting for input pipe\n");
+				break;
+			case 0:
+				break;
+			default:
+				{
+					size_t bytesPending = bytesStaged % frameSize;
+					size_t bytes = inputWanted(ingest, framesWanted * frameSize - bytesStaged);
+					ssize_t bytesRead = bytes > 0 ? readTee(tee, STDIN_FILENO, input + bytesStaged, bytes) : 0;
+					inputTaken(ingest, bytesRead);
+					stats.readCalls.fetch_add(1, std::memory_order_relaxed);
+					if (bytesRead < 0 && errno != EINTR && errno != EAGAIN)
+					{
+						FATAL("error when reading input pipe\n");
+					}
+					if (bytesRead > 0)
+					{
+						bytesStaged += (size_t)bytesRead;
+						stats.bytesRead.fetch_add((unsigned long long)bytesRead, std::memory_order_relaxed);
+						stats.framesWritten.fetch_add((bytesPending + (size_t)bytesRead) / frameSize, std::memory_order_relaxed);
+					}
+					stdinOpen = bytesRead != 0;	// check for EOF
+					then = std::chrono::high_resolution_clock::now();	// reset our timeout timer after we successfully read from stdin
+				}
+				break;
+		}
+		
+		now = std::chrono::high_resolution_clock::now();
+		if (now - lastStats >= statsInterval)
+		{
+			Stats* outputStats = &stats;
+			printStats(&outputStats, 1, options.statsJSON);
+			lastStats = now;
+		}
+		if (timingRequested.exchange(false))
+		{
+			INFO("no callback timing with the blocking engine\n");
+		}
+	}
+	
+	if (stdinOpen && (now - then) >= timeout)
+	{
+		INFO("timed out waiting for input pipe\n");
+	}
+	else if (!stdinOpen)
+	{
+		INFO("input pipe closed\n");
+	}
+	
+	if (error < 0)
+	{
+		FATAL("stream unexpectedly stopped: %s\n", Pa_GetErrorText(error));
+	}
+	
+	return result;
+}
+
+struct MappedInput
+{
+	uint8_t* base;	// the whole file, as mapped
+	size_t size;
+	size_t offset;	// where stdin's file position was, which is where playback starts
+};
+
+static const double kMappedReadahead = 2.0;	// seconds of the file to keep paged in ahead of the callback
+static const int kMappedPollMs = 100;
+
+static
+int runMappedWriter(const Options& options, PaStream* stream, CallbackData& callbackData, const MappedInput& mappedInput, int wakeFd)
+{
+	// there's nothing to write when the stream callback plays straight from the mapping, so
+	// all we do is page the file in ahead of it and give back what it has finished with,
+	// keeping our footprint to a few seconds of audio regardless of the file's size
+	int result = 0;
+	PaError error = paNoError;
+	Stats& stats = *callbackData.stats;
+	size_t frameSize = callbackData.ringBuffer.frameSize;
+	size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+	size_t readahead = (size_t)(kMappedReadahead * callbackData.timing->sampleRate) * frameSize;
+	size_t released = 0;	// everything before this has been dropped
+	size_t advised = 0;		// everything before this has been asked for
+	std::chrono::duration<double> statsInterval(options.statsInterval > 0.0 ? options.statsInterval : std::numeric_limits<double>::infinity());
+	
+	std::chrono::time_point<std::chrono::high_resolution_clock> now = std::chrono::high_resolution_clock::now();
+	std::chrono::time_point<std::chrono::high_resolution_clock> lastStats = now;
+	
+	stats.framesWritten.store(callbackData.mappingFrames, std::memory_order_relaxed);
+	stats.bytesRead.store(callbackData.mappingFrames * frameSize, std::memory_order_relaxed);
+	madvise(mappedInput.base, mappedInput.size, MADV_SEQUENTIAL);
+	
+	DEBUG("playing %zu frames straight from the mapped input\n", callbackData.mappingFrames);
+	DEBUG("starting stream: Hope you hear a pop.\n");
+	error = Pa_StartStream(stream);
+	if (error != paNoError)
+	{
+		FATAL("could not start stream: %s\n", Pa_GetErrorText(error));
+	}
+	
+	while (result == 0 && (error = Pa_IsStreamActive(stream)) == 1)
+	{
+		size_t position = mappedInput.offset + callbackData.mappingCursor.load(std::memory_order_relaxed) * frameSize;
+		if (advised < mappedInput.size && advised < position + readahead / 2)
+		{
+			size_t end = std::min((position + readahead + pageSize - 1) / pageSize * pageSize, mappedInput.size);
+			madvise(mappedInput.base + advised, end - advised, MADV_WILLNEED);
+			advised = end;
+		}
+		size_t finished = position / pageSize * pageSize;
+		if (finished > released)
+		{
+			madvise(mappedInput.base + released, finished - released, MADV_DONTNEED);
+			released = finished;
+		}
+		
+		if (waitForInput(wakeFd, -1, false, minTimeout(pollTimeout(statsInterval, now - lastStats), kMappedPollMs)) < 0)
+		{
+			FATAL("error when waiting for stream\n");
+		}
+		
+		now = std::chrono::high_resolution_clock::now();
+		if (now - lastStats >= statsInterval)
+		{
+			Stats* outputStats = &stats;
+			printStats(&outputStats, 1, options.statsJSON);
+			lastStats = now;
+		}
+		if (timingRequested.exchange(false))
+		{
+			printTiming(*callbackData.timing);
+		}
+	}
+	
+	if (error < 0)
+	{
+		FATAL("stream unexpectedly stopped: %s\n", Pa_GetErrorText(error));
+	}
+	else if (result == 0)
+	{
+		INFO("reached end of input file\n");
+	}
+	
+	return result;
+}
+
+struct RenderSignal
+{
+	// the render loop sets waiting before it blocks on an input that hasn't a whole buffer
+	// ready, and whichever reader next adds to its ring clears it and pokes fds[1]
+	std::atomic<bool> waiting;
+	int fds[2];
+};
+
+static
+void signalRender(RenderSignal* render)
+{
+	// as the stream callbacks wake the writer, the fence pairing with the render loop's
+	if (render == nullptr)
+	{
+		return;
+	}
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (render->waiting.load(std::memory_order_relaxed) && render->waiting.exchange(false))
+	{
+		wakeWriter(render->fds[1]);
+	}
+}
+
+struct DecoderInput
+{
+	// what the decoder's callbacks need, which run on the decoder thread once it's going
+	int inputFd;
+	const uint8_t* peek;	// what header sniffing already read, which the decoder gets first
+	size_t peekBytes;
+	Tee* tee;				// what the rest is read through
+	int stopFd;				// hangs up when the main thread wants the decoder to give up
+	int wakeFd;
+	FrameRing* ringBuffer;
+	Output* outputs;
+	size_t outputCount;
+	Ingest* ingest;
+	size_t bytesStaged;
+	Stats* stats;
+	RenderSignal* render;	// null unless rendering, which wants to hear about every commit
+	bool stopping;			// stopFd hung up on us
+	bool failed;			// the decoder gave up on the stream
+	std::atomic<bool> finished;
+};
+
+static const int kDecoderPollMs = 10;	// how often we check on the decoder thread
+
+static
+bool waitForDecoderRoom(DecoderInput& input)
+{
+	// blocks until the stream callbacks wake us, having already been asked to; false if
+	// we're to stop instead, which the stop pipe says by hanging up
+	if (waitForInput(input.wakeFd, input.stopFd, true, -1) != 0)
+	{
+		input.stopping = true;
+	}
+	return !input.stopping;
+}
+
+static
+long decoderRead(void* context, uint8_t* buffer, size_t bytes)
+{
+	DecoderInput& input = *(DecoderInput*)context;
+	if (input.peekBytes > 0)
+	{
+		size_t count = std::min(bytes, input.peekBytes);
+		memcpy(buffer, input.peek, count);
+		input.peek += count;
+		input.peekBytes -= count;
+		return (long)count;
+	}
+	
+	pollfd fds[2] =
+	{
+		{ input.inputFd, POLLIN, 0 },
+		{ input.stopFd, POLLIN, 0 },
+	};
+	ssize_t bytesRead = -1;
+	while (!input.stopping && bytesRead < 0)
+	{
+		if (poll(fds, 2, -1) < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		if (fds[1].revents != 0)
+		{
+			input.stopping = true;
+			break;
+		}
+		bytesRead = readTee(input.tee, input.inputFd, buffer, bytes);
+		if (bytesRead < 0 && errno != EINTR && errno != EAGAIN)
+		{
+			break;
+		}
+	}
+	if (input.stats != nullptr)
+	{
+		input.stats->readCalls.fetch_add(1, std::memory_order_relaxed);
+		if (bytesRead > 0)
+		{
+			input.stats->bytesRead.fetch_add((unsigned long long)bytesRead, std::memory_order_relaxed);
+		}
+	}
+	return (long)bytesRead;
+}
+
+static
+void* decoderRoom(DecoderInput& input, size_t& frames)
+{
+	// where the decoder can put up to frames frames right now, if anywhere: straight into
+	// the ring buffer, unless the decoded format needs processing first
+	syncFanoutRing(*input.ringBuffer, input.outputs, input.outputCount);
+	Ingest& ingest = *input.ingest;
+	if (ingest.buffer != nullptr)
+	{
+		drainStaging(*input.ringBuffer, ingest, input.bytesStaged);
+		publishFanoutRing(*input.ringBuffer, input.outputs, input.outputCount);
+		size_t room = ingest.bufferFrames - input.bytesStaged / ingest.frameSize;
+		if (room == 0)
+		{
+			return nullptr;
+		}
+		frames = std::min(frames, room);
+		return ingest.buffer + input.bytesStaged;
+	}
+	
+	uint8_t* data1 = nullptr;
+	uint8_t* data2 = nullptr;
+	size_t size1 = 0;
+	size_t size2 = 0;
+	FrameRing& ringBuffer = *input.ringBuffer;
+	if (ringWriteRegions(ringBuffer, std::min(frames, ringWriteAvailable(ringBuffer)) * ringBuffer.frameSize, data1, size1, data2, size2) == 0)
+	{
+		return nullptr;
+	}
+	frames = size1 / ringBuffer.frameSize;	// the rest of it goes in next time, after the wrap
+	return data1;
+}
+
+static
+void* decoderSpace(void* context, size_t& frames)
+{
+	DecoderInput& input = *(DecoderInput*)context;
+	void* space = nullptr;
+	while ((space = decoderRoom(input, frames)) == nullptr)
+	{
+		// ask the stream callbacks to wake us once they've made room, then check again in
+		// case they already did so before they could see our request
+		input.outputs[0].callbackData.writerWaiting->store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if ((space = decoderRoom(input, frames)) != nullptr || !waitForDecoderRoom(input))
+		{
+			break;
+		}
+	}
+	return space;
+}
+
+static
+void decoderCommit(void* context, size_t frames)
+{
+	DecoderInput& input = *(DecoderInput*)context;
+	Ingest& ingest = *input.ingest;
+	if (ingest.buffer != nullptr)
+	{
+		input.bytesStaged += frames * ingest.frameSize;
+		drainStaging(*input.ringBuffer, ingest, input.bytesStaged);
+	}
+	else
+	{
+		ringAdvanceWrite(*input.ringBuffer, frames * input.ringBuffer->frameSize);
+	}
+	publishFanoutRing(*input.ringBuffer, input.outputs, input.outputCount);
+	input.stats->framesWritten.fetch_add(frames, std::memory_order_relaxed);
+	signalRender(input.render);
+}
+
+static
+void runDecoderThread(Decoder* decoder, DecoderInput* input)
+{
+	// decodes everything, then sees whatever is still staged into the ring buffer
+	input->failed = !runDecoder(*decoder) && !input->stopping;
+	Ingest& ingest = *input->ingest;
+	while (!input->failed && !input->stopping && ingest.buffer != nullptr && input->bytesStaged >= ingest.frameSize)
+	{
+		size_t bytesStaged = input->bytesStaged;
+		syncFanoutRing(*input->ringBuffer, input->outputs, input->outputCount);
+		drainStaging(*input->ringBuffer, ingest, input->bytesStaged);
+		publishFanoutRing(*input->ringBuffer, input->outputs, input->outputCount);
+		signalRender(input->render);
+		if (input->bytesStaged == bytesStaged)
+		{
+			input->outputs[0].callbackData.writerWaiting->store(true);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			syncFanoutRing(*input->ringBuffer, input->outputs, input->outputCount);
+			if (ringWriteAvailable(*input->ringBuffer) == 0)
+			{
+				waitForDecoderRoom(*input);
+			}
+		}
+	}
+	input->finished.store(true, std::memory_order_release);
+	signalRender(input->render);
+}
+
+static
+int runDecoderWriter(const Options& options, Output* outputs, size_t outputCount, FrameRing& ringBuffer, Ingest& ingest, Decoder& decoder, DecoderInput& input, int wakeFd, size_t prefillFrames)
+{
+	// compressed input is decoded on a thread of its own, since the codec libraries want to
+	// pull input and push frames on their own schedule; it writes straight into the ring
+	// buffer (or the staging area, if the decoded format still needs processing) and waits
+	// on the stream callbacks as runCallbackWriter would, which leaves us to start the
+	// streams once it's prefilled them and to report on how it's all going
+	int result = 0;
+	PaError error = paNoError;
+	Stats& stats = outputs[0].stats;
+	std::chrono::duration<double> timeout(options.timeout);
+	std::chrono::duration<double> statsInterval(options.statsInterval > 0.0 ? options.statsInterval : std::numeric_limits<double>::infinity());
+	Stats* outputStats[kMaxOutputs] = {};
+	for (size_t i = 0; i < outputCount; ++i)
+	{
+		outputStats[i] = &outputs[i].stats;
+	}
+	
+	int stopPipe[2] = { -1, -1 };
+	if (pipe(stopPipe) != 0)
+	{
+		FATAL("could not create decoder stop pipe\n");
+		return result;
+	}
+	input.stopFd = stopPipe[0];
+	input.wakeFd = wakeFd;
+	input.ringBuffer = &ringBuffer;
+	input.outputs = outputs;
+	input.outputCount = outputCount;
+	input.ingest = &ingest;
+	input.stats = &stats;
+	
+	std::chrono::time_point<std::chrono::high_resolution_clock> now = std::chrono::high_resolution_clock::now();
+	std::chrono::time_point<std::chrono::high_resolution_clock> then = now;
+	std::chrono::time_point<std::chrono::high_resolution_clock> lastStats = now;
+	
+	DEBUG("starting %s decoder thread with a prefill of %ld frames and timeout of %gs\n",
+		codecName(decoder.codec),
+		(long)prefillFrames,
+		timeout.count());
+	std::thread decoderThread(runDecoderThread, &decoder, &input);
+	
+	bool streamStarted = false;
+	bool finished = false;
+	unsigned long long bytesSeen = 0;
+	unsigned long underrunsSeen[kMaxOutputs] = {};
+	while (result == 0 && (!finished || !streamStarted) && (now - then) < timeout && (!streamStarted || (error = outputsActive(outputs, outputCount)) == 1))
+	{
+		finished = input.finished.load(std::memory_order_acquire);
+		if (!streamStarted && (ringReadAvailable(outputs[0].callbackData.ringBuffer) >= prefillFrames || finished))
+		{
+			DEBUG("starting stream: Hope you hear a pop.\n");
+			for (size_t i = 0; i < outputCount && result == 0; ++i)
+			{
+				error = Pa_StartStream(outputs[i].stream);
+				if (error != paNoError)
+				{
+					FATAL("could not start stream for device %d: %s\n", outputs[i].device, Pa_GetErrorText(error));
+				}
+			}
+			streamStarted = true;
+			continue;
+		}
+		
+		for (size_t i = 0; i < outputCount; ++i)
+		{
+			Stats& output = outputs[i].stats;
+			unsigned long underruns = output.underruns.load(std::memory_order_relaxed) + output.partialCallbacks.load(std::memory_order_relaxed);
+			if (underruns != underrunsSeen[i])
+			{
+				WARN("ring buffer starved for device %d! (%lu underruns so far)\n", outputs[i].device, underruns);
+				underrunsSeen[i] = underruns;
+			}
+		}
+		
+		if (waitForInput(-1, -1, false, minTimeout(pollTimeout(statsInterval, now - lastStats), kDecoderPollMs)) < 0)
+		{
+			FATAL("error when waiting for decoder\n");
+		}
+		
+		now = std::chrono::high_resolution_clock::now();
+		unsigned long long bytesRead = stats.bytesRead.load(std::memory_order_relaxed);
+		if (bytesRead != bytesSeen || finished)
+		{
+			then = now;	// reset our timeout timer whenever the decoder gets more input
+			bytesSeen = bytesRead;
+		}
+		if (now - lastStats >= statsInterval)
+		{
+			printStats(outputStats, outputCount, options.statsJSON);
+			lastStats = now;
+		}
+		if (timingRequested.exchange(false))
+		{
+			printOutputTiming(outputs, outputCount);
+		}
+	}
+	
+	if ((now - then) >= timeout)
+	{
+		INFO("timed out waiting for input pipe\n");
+	}
+	
+	// the decoder may be blocked on input or on room in the ring buffer, and either way
+	// hanging up on it makes it give up
+	close(stopPipe[1]);
+	decoderThread.join();
+	close(stopPipe[0]);
+	input.stopFd = -1;
+	
+	if (input.failed)
+	{
+		FATAL("could not decode %s input\n", codecName(decoder.codec));
+	}
+	else if (error < 0)
+	{
+		FATAL("stream unexpectedly stopped: %s\n", Pa_GetErrorText(error));
+	}
+	else if (result == 0 && finished)
+	{
+		INFO("reached end of %s input\n", codecName(decoder.codec));
+	}
+	return result;
+}
+
+static
+int runMixWriter(const Options& options, PaStream* stream, CallbackData& callbackData, MixInput* inputs, size_t inputCount, int wakeFd, size_t prefillFrames)
+{
+	// like runCallbackWriter, but reading whichever inputs are ready and have room, each
+	// into its own ring buffer, until they've all closed
+	int result = 0;
+	PaError error = paNoError;
+	Stats& stats = *callbackData.stats;
+	Stats* outputStats = &stats;
+	std::chrono::duration<double> timeout(options.timeout);
+	std::chrono::duration<double> statsInterval(options.statsInterval > 0.0 ? options.statsInterval : std::numeric_limits<double>::infinity());
+	
+	std::chrono::time_point<std::chrono::high_resolution_clock> now = std::chrono::high_resolution_clock::now();
+	std::chrono::time_point<std::chrono::high_resolution_clock> then = now;
+	std::chrono::time_point<std::chrono::high_resolution_clock> lastStats = now;
+	
+	DEBUG("entering mix writer loop for %zu inputs with a prefill of %ld frames and timeout of %gs\n",
+		inputCount,
+		(long)prefillFrames,
+		timeout.count());
+	
+	size_t inputsOpen = inputCount;
+	size_t inputsReading = inputCount;	// of those open, the ones that haven't reached EOF yet
+	bool streamStarted = false;
+	unsigned long underrunsSeen = 0;
+	while (result == 0 && inputsOpen > 0 && (inputsReading == 0 || (now - then) < timeout) && (!streamStarted || (error = Pa_IsStreamActive(stream)) == 1))
+	{
+		if (!streamStarted)
+		{
+			// wait until every input still open has its prefill (or as much as its ring buffer
+			// holds, since nothing makes room before the stream starts), so they start out together
+			bool prefilled = true;
+			for (size_t i = 0; i < inputCount; ++i)
+			{
+				if (inputs[i].open && ringReadAvailable(inputs[i].ringBuffer) < prefillFrames && ringWriteAvailable(inputs[i].ringBuffer) > 0)
+				{
+					prefilled = false;
+				}
+			}
+			if (prefilled)
+			{
+				DEBUG("starting stream: Hope you hear a pop.\n");
+				error = Pa_StartStream(stream);
+				if (error != paNoError)
+				{
+					FATAL("could not start stream: %s\n", Pa_GetErrorText(error));
+				}
+				streamStarted = true;
+				continue;
+			}
+		}
+		
+		unsigned long underruns = stats.underruns.load(std::memory_order_relaxed) + stats.partialCallbacks.load(std::memory_order_relaxed);
+		if (underruns != underrunsSeen)
+		{
+			WARN("mix inputs starved! (%lu underruns so far)\n", underruns);
+			underrunsSeen = underruns;
+		}
+		
+		// poll the inputs with room for more, or if none have any, ask the stream callback
+		// to wake us when one does and check once more in case it already has; before it
+		// starts, any room is enough, and none at all means they're all full and it can start.
+		// An input that's ended stays open until what it still has staged has gone in, and
+		// it's waiting on room just the same
+		size_t roomWanted = streamStarted ? callbackData.wakeThreshold : 1;
+		pollfd fds[1 + kMaxInputs];
+		size_t polled[kMaxInputs];
+		nfds_t fdCount = 1;
+		fds[0] = { wakeFd, POLLIN, 0 };
+		bool draining = inputsReading < inputsOpen;
+		for (int attempt = 0; attempt < 2 && fdCount == 1; ++attempt)
+		{
+			if (attempt > 0 && !streamStarted)
+			{
+				break;
+			}
+			if (attempt > 0 || draining)
+			{
+				callbackData.writerWaiting->store(true);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+			}
+			for (size_t i = 0; i < inputCount; ++i)
+			{
+				MixInput& input = inputs[i];
+				if (!input.open)
+				{
+					continue;
+				}
+				if (input.ingest.buffer != nullptr)
+				{
+					if (input.ended)
+					{
+						flushStaging(input.ingest, input.byteIndex);
+					}
+					drainStaging(input.ringBuffer, input.ingest, input.byteIndex);
+				}
+				if (input.ended)
+				{
+					if (ingestDrained(input.ingest, input.byteIndex))
+					{
+						input.open = false;
+						--inputsOpen;
+					}
+				}
+				else if (ringWriteAvailable(input.ringBuffer) >= roomWanted)
+				{
+					polled[fdCount - 1] = i;
+					fds[fdCount++] = { input.fd, POLLIN, 0 };
+				}
+			}
+		}
+		if (inputsOpen == 0 || (!streamStarted && fdCount == 1))
+		{
+			continue;
+		}
+		int ready = poll(fds, fdCount, minTimeout(inputsReading > 0 ? pollTimeout(timeout, now - then) : -1, pollTimeout(statsInterval, now - lastStats)));
+		if (ready < 0 && errno != EINTR)
+		{
+			FATAL("error when waiting for input pipes\n");
+		}
+		if (ready > 0 && (fds[0].revents & POLLIN))
+		{
+			drainWakePipe(wakeFd);
+		}
+		for (nfds_t f = 1; ready > 0 && f < fdCount; ++f)
+		{
+			if (fds[f].revents == 0)
+			{
+				continue;
+			}
+			MixInput& input = inputs[polled[f - 1]];
+			size_t bytesPending = input.ingest.buffer == nullptr ? ringPartialBytes(input.ringBuffer) : input.byteIndex % input.ingest.frameSize;
+			ssize_t bytesRead = input.ingest.buffer == nullptr ?
+				readRingBuffer(input.fd, input.ringBuffer, input.ingest, nullptr) :
+				readConvertRingBuffer(input.fd, input.ringBuffer, input.ingest, input.byteIndex, nullptr);
+			stats.readCalls.fetch_add(1, std::memory_order_relaxed);
+			if (bytesRead < 0 && errno != EINTR && errno != EAGAIN)
+			{
+				FATAL("error when reading input pipe %zu\n", polled[f - 1]);
+			}
+			if (bytesRead > 0)
+			{
+				stats.bytesRead.fetch_add((unsigned long long)bytesRead, std::memory_order_relaxed);
+				stats.framesWritten.fetch_add((bytesPending + (size_t)bytesRead) / input.ingest.frameSize, std::memory_order_relaxed);
+			}
+			else if (bytesRead == 0)
+			{
+				INFO("input pipe %zu closed\n", polled[f - 1]);
+				input.ended = true;
+				--inputsReading;
+			}
+			then = std::chrono::high_resolution_clock::now();	// reset our timeout timer after we successfully read from any input
+		}
+		
+		now = std::chrono::high_resolution_clock::now();
+		if (now - lastStats >= statsInterval)
+		{
+			printStats(&outputStats, 1, options.statsJSON);
+			lastStats = now;
+		}
+		if (timingRequested.exchange(false))
+		{
+			printTiming(*callbackData.timing);
+		}
+	}
+	
+	if (inputsReading > 0 && (now - then) >= timeout)
+	{
+		INFO("timed out waiting for input pipes\n");
+	}
+	else if (inputsOpen == 0)
+	{
+		INFO("all input pipes closed\n");
+	}
+	
+	if (error < 0)
+	{
+		FATAL("stream unexpectedly stopped: %s\n", Pa_GetErrorText(error));
+	}
+	
+	return result;
+}
+
+static
+bool containsIgnoringCase(const char* haystack, const char* needle)
+{
+	for (; *haystack != '\0'; ++haystack)
+	{
+		size_t i = 0;
+		while (needle[i] != '\0' && tolower((unsigned char)haystack[i]) == tolower((unsigned char)needle[i]))
+		{
+			++i;
+		}
+		if (needle[i] == '\0')
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static
+PaDeviceIndex findOutputDevice(const char* device)
+{
+	// all digits is an index; anything else is an output device name, matched exactly if
+	// possible and otherwise as the first one containing it (ignoring case)
+	char* end = nullptr;
+	long index = strtol(device, &end, 10);
+	if (*device != '\0' && *end == '\0')
+	{
+		return index >= 0 && index < Pa_GetDeviceCount() ? (PaDeviceIndex)index : paNoDevice;
+	}
+	
+	PaDeviceIndex partial = paNoDevice;
+	for (PaDeviceIndex i = 0; i < Pa_GetDeviceCount(); ++i)
+	{
+		const PaDeviceInfo* deviceInfo = Pa_GetDeviceInfo(i);
+		if (deviceInfo == nullptr || deviceInfo->maxOutputChannels <= 0)
+		{
+			continue;
+		}
+		if (strcmp(deviceInfo->name, device) == 0)
+		{
+			return i;
+		}
+		if (partial == paNoDevice && containsIgnoringCase(deviceInfo->name, device))
+		{
+			partial = i;
+		}
+	}
+	return partial;
+}
+
+static
+void listDevices(const Options& options)
+{
+	static const double kSampleRates[] = { 8000.0, 11025.0, 16000.0, 22050.0, 22256.0, 32000.0, 44100.0, 48000.0, 88200.0, 96000.0, 176400.0, 192000.0 };
+	
+	for (PaHostApiIndex i = 0; i < Pa_GetHostApiCount(); ++i)
+	{
+		const PaHostApiInfo* hostApiInfo = Pa_GetHostApiInfo(i);
+		if (hostApiInfo != nullptr)
+		{
+			printf("host API %d: %s, %d devices, default output device %d\n", i, hostApiInfo->name, hostApiInfo->deviceCount, hostApiInfo->defaultOutputDevice);
+		}
+	}
+	
+	PaDeviceIndex defaultDevice = Pa_GetDefaultOutputDevice();
+	for (PaDeviceIndex i = 0; i < Pa_GetDeviceCount(); ++i)
+	{
+		const PaDeviceInfo* deviceInfo = Pa_GetDeviceInfo(i);
+		if (deviceInfo == nullptr || deviceInfo->maxOutputChannels <= 0)
+		{
+			continue;
+		}
+		const PaHostApiInfo* hostApiInfo = Pa_GetHostApiInfo(deviceInfo->hostApi);
+		printf("%c device %d: %s (%s), %d channels, latency %g-%gms, default rate %gHz\n",
+			i == defaultDevice ? '*' : ' ',
+			i,
+			deviceInfo->name,
+			hostApiInfo != nullptr ? hostApiInfo->name : "unknown host API",
+			deviceInfo->maxOutputChannels,
+			deviceInfo->defaultLowOutputLatency * 1000.0,
+			deviceInfo->defaultHighOutputLatency * 1000.0,
+			deviceInfo->defaultSampleRate
+		);
+		
+		// probed with the requested sample format and channel count (or as many as the
+		// device has), so this answers "will -r work with my other options here"
+		PaStreamParameters outputParams = {0};
+		outputParams.device = i;
+		outputParams.channelCount = std::min(options.channels, deviceInfo->maxOutputChannels);
+		outputParams.sampleFormat = options.sampleFormat;
+		outputParams.suggestedLatency = deviceInfo->defaultLowOutputLatency;
+		printf("    %d-channel rates:", outputParams.channelCount);
+		for (size_t j = 0; j < sizeof(kSampleRates) / sizeof(kSampleRates[0]); ++j)
+		{
+			if (Pa_IsFormatSupported(nullptr, &outputParams, kSampleRates[j]) == paFormatIsSupported)
+			{
+				printf(" %g", kSampleRates[j]);
+			}
+		}
+		printf("\n");
+	}
+}
+
+// whatever a device's host API needs for the -x modes; PortAudio only reads the stream
+// info while opening the stream, so this just has to live that long
+struct HostApiSetup
+{
+	void* streamInfo;	// for PaStreamParameters::hostApiSpecificStreamInfo, if any
+	bool realtimeScheduling;	// for once the stream's open
+#if defined(_WIN32)
+	PaWasapiStreamInfo wasapi;
+#elif defined(__APPLE__)
+	PaMacCoreStreamInfo macCore;
+#endif
+};
+
+static
+void setupHostApi(const Options& options, PaDeviceIndex device, HostApiSetup& setup)
+{
+	setup.streamInfo = nullptr;
+	setup.realtimeScheduling = false;
+	if (options.hostApiModes == 0)
+	{
+		return;
+	}
+	
+	const PaHostApiInfo* hostApiInfo = Pa_GetHostApiInfo(Pa_GetDeviceInfo(device)->hostApi);
+	unsigned supportedModes = 0;
+	switch (hostApiInfo->type)
+	{
+#if defined(_WIN32)
+		case paWASAPI:
+			supportedModes = kHostApiExclusive | kHostApiRealtime;
+			memset(&setup.wasapi, 0, sizeof(setup.wasapi));
+			setup.wasapi.size = sizeof(setup.wasapi);
+			setup.wasapi.hostApiType = paWASAPI;
+			setup.wasapi.version = 1;
+			if (options.hostApiModes & kHostApiExclusive)
+			{
+				setup.wasapi.flags |= paWinWasapiExclusive;
+			}
+			if (options.hostApiModes & kHostApiRealtime)
+			{
+				setup.wasapi.flags |= paWinWasapiThreadPriority;
+				setup.wasapi.threadPriority = eThreadPriorityProAudio;
+			}
+			setup.streamInfo = &setup.wasapi;
+			break;
+#elif defined(__APPLE__)
+		case paCoreAudio:
+			supportedModes = kHostApiPro;
+			if (options.hostApiModes & kHostApiPro)
+			{
+				PaMacCore_SetupStreamInfo(&setup.macCore, paMacCorePro);
+				setup.streamInfo = &setup.macCore;
+			}
+			break;
+#elif defined(PIPEPLAYER_ALSA)
+		case paALSA:
+			// ALSA's stream info only names a device, which -o can already do with its hw: names
+			supportedModes = kHostApiRealtime;
+			setup.realtimeScheduling = (options.hostApiModes & kHostApiRealtime) != 0;
+			break;
+#endif
+		default:
+			break;
+	}
+	
+	if ((options.hostApiModes & ~supportedModes) != 0)
+	{
+		WARN("ignoring -x modes that device %d's host API (%s) doesn't have\n", device, hostApiInfo->name);
+	}
+}
+
+static
+void raiseWriterPriority(const Options& options)
+{
+	// the writer spends nearly all its time blocked, so letting it preempt everything else
+	// when it does wake keeps the ring topped up however loaded the machine is
+	sched_param param = {};
+	param.sched_priority = std::min(options.writerPriority, sched_get_priority_max(SCHED_FIFO));
+	int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (error != 0)
+	{
+		WARN("could not set writer to real-time priority %d: %s\n", param.sched_priority, strerror(error));
+	}
+	else
+	{
+		INFO("writer running at real-time priority %d\n", param.sched_priority);
+	}
+}
+
+static
+const char* formatName(PaSampleFormat sampleFormat, bool bigEndian)
+{
+	switch (sampleFormat)
+	{
+		case paFloat32:
+			return bigEndian ? "fbe" : "f";
+		case paInt32:
+			return bigEndian ? "s32be" : "s32";
+		case paInt24:
+			return bigEndian ? "s24be" : "s24";
+		case paInt16:
+			return bigEndian ? "s16be" : "s16";
+		case paInt8:
+			return "s8";
+		case paUInt8:
+			return "u8";
+		default:
+			return "?";
+	}
+}
+
+static
+int initChannelMap(const Options& options, ChannelMap& map, int inputChannels)
+{
+	int result = 0;
+	if (!parseChannelMap(map, options.channelMap, inputChannels))
+	{
+		FATAL("channel map %s doesn't work with %d-channel input\n", options.channelMap, inputChannels);
+	}
+	else
+	{
+		INFO("channel map makes %d channels into %d%s\n", inputChannels, map.outputChannels, map.permutation ? " without mixing any" : "");
+	}
+	return result;
+}
+
+static const double kNullDeviceRate = 48000.0;	// what the bench and render devices run at when resampling
+static const double kRenderQueueTime = 100.0;	// milliseconds, at least, between each reader and the render loop
+
+struct RenderReader
+{
+	// one input read on a thread of its own while rendering, into ringBuffer as the writer
+	// would have; only the main input's has outputs to publish to, while a mix input's ring
+	// buffer is the one the stream callback reads
+	int fd;
+	FrameRing* ringBuffer;
+	Output* outputs;
+	size_t outputCount;
+	Ingest* ingest;
+	ClipInput* clips;
+	Tee* tee;
+	size_t byteIndex;
+	size_t wakeThreshold;
+	std::atomic<bool>* waiting;	// set before waiting on room, by whatever then makes it and pokes wakeFd
+	int wakeFd;
+	int stopFd;					// hangs up when the render loop calls it off
+	std::atomic<bool>* open;	// cleared once all of the input is in the ring buffer
+	RenderSignal* render;
+	Stats* stats;
+	std::atomic<bool> stopping;
+	int error;					// what reading failed with, if it did
+};
+
+static
+void runRenderReader(RenderReader* reader)
+{
+	// like runCallbackWriter with no clock to keep to, reading whenever there's room for
+	// more, and seeing everything staged into the ring buffer once the input's over
+	FrameRing& ringBuffer = *reader->ringBuffer;
+	Ingest& ingest = *reader->ingest;
+	Stats& stats = *reader->stats;
+	bool inputOpen = true;
+	while (!reader->stopping.load(std::memory_order_relaxed))
+	{
+		syncFanoutRing(ringBuffer, reader->outputs, reader->outputCount);
+		if (ingest.buffer != nullptr)
+		{
+			if (!inputOpen)
+			{
+				flushStaging(ingest, reader->byteIndex);
+			}
+			drainStaging(ringBuffer, ingest, reader->byteIndex);
+			publishFanoutRing(ringBuffer, reader->outputs, reader->outputCount);
+			signalRender(reader->render);
+		}
+		if (!inputOpen && ingestDrained(ingest, reader->byteIndex))
+		{
+			break;
+		}
+		
+		// ask the render loop to wake us once it's made room, then check again in case it
+		// already did so before it could see our request; a hangup on stopFd wakes us too
+		size_t roomWanted = inputOpen ? reader->wakeThreshold : 1;
+		if (ringWriteAvailable(ringBuffer) < roomWanted)
+		{
+			reader->waiting->store(true);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			syncFanoutRing(ringBuffer, reader->outputs, reader->outputCount);
+			if (ringWriteAvailable(ringBuffer) < roomWanted)
+			{
+				waitForInput(reader->wakeFd, reader->stopFd, true, -1);
+			}
+			continue;
+		}
+		if (!inputOpen || waitForInput(reader->stopFd, reader->fd, true, -1) != 1)
+		{
+			continue;
+		}
+		
+		size_t partialBytes = ingest.buffer == nullptr ? ringPartialBytes(ringBuffer) : reader->byteIndex % ingest.frameSize;
+		ssize_t bytesRead = 0;
+		if (reader->clips != nullptr)
+		{
+			bytesRead = readClipRingBuffer(reader->fd, ringBuffer, ingest, reader->byteIndex, *reader->clips);
+		}
+		else
+		{
+			bytesRead = ingest.buffer == nullptr ?
+				readRingBuffer(reader->fd, ringBuffer, ingest, reader->tee) :
+				readConvertRingBuffer(reader->fd, ringBuffer, ingest, reader->byteIndex, reader->tee);
+		}
+		publishFanoutRing(ringBuffer, reader->outputs, reader->outputCount);
+		signalRender(reader->render);
+		stats.readCalls.fetch_add(1, std::memory_order_relaxed);
+		if (bytesRead < 0 && errno != EINTR && errno != EAGAIN)
+		{
+			reader->error = errno;
+			break;
+		}
+		if (bytesRead > 0)
+		{
+			stats.bytesRead.fetch_add((unsigned long long)bytesRead, std::memory_order_relaxed);
+			stats.framesWritten.fetch_add((partialBytes + (size_t)bytesRead) / ingest.frameSize, std::memory_order_relaxed);
+		}
+		inputOpen = bytesRead != 0;	// check for EOF
+	}
+	
+	// a partial frame the input ended on is never played, so it isn't rendered either
+	if (ingest.buffer == nullptr)
+	{
+		ringDropPartialFrame(ringBuffer);
+		publishFanoutRing(ringBuffer, reader->outputs, reader->outputCount);
+	}
+	reader->open->store(false, std::memory_order_release);
+	signalRender(reader->render);
+}
+
+static
+bool writeRender(int fd, const uint8_t* bytes, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t written = write(fd, bytes, size);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		bytes += written;
+		size -= (size_t)written;
+	}
+	return true;
+}
+
+static
+int runRender(const Options& options, Output& output, FrameRing& ringBuffer, Ingest& ingest, ClipInput* clips, Tee* tee, Decoder* decoder, DecoderInput& decoderInput, MixInput* mixInputs, size_t mixInputCount, int wakeFd)
+{
+	// stands in for the device, calling the stream callback back to back on a clock of its
+	// own and writing what it makes to options.renderPath, while each input is read (or
+	// decoded) on a thread of its own, unless it's mapped and doesn't need reading. A buffer
+	// is only made once every input still going has a whole one ready, so the file has what
+	// would have played had none of them ever run dry, however long they took
+	int result = 0;
+	CallbackData& callbackData = output.callbackData;
+	Stats& stats = output.stats;
+	Stats* outputStats = &stats;
+	double streamRate = output.timing.sampleRate;
+	size_t frameSize = callbackData.ringBuffer.frameSize;
+	unsigned long bufferFrames = (unsigned long)options.framesPerBuffer;
+	PaStreamCallback* callback = mixInputCount > 0 ? mixCallback : streamCallback;
+	std::chrono::duration<double> statsInterval(options.statsInterval > 0.0 ? options.statsInterval : std::numeric_limits<double>::infinity());
+	
+	// a .wav gets a header, with its sizes filled in at the end if the file can go back to it
+	size_t pathLength = strlen(options.renderPath);
+	bool wave = pathLength >= 4 && containsIgnoringCase(options.renderPath + pathLength - 4, ".wav");
+	SampleFormat outputFormat = { options.sampleFormat, options.sampleSize, hostIsBigEndian() };
+	uint8_t waveHeader[kWaveHeaderBytes];
+	if (wave && !makeWaveHeader(waveHeader, outputFormat, options.channels, streamRate, 0))
+	{
+		FATAL("WAV can't hold %s, so render it raw instead\n", formatName(outputFormat.sampleFormat, outputFormat.bigEndian));
+		return result;
+	}
+	DEBUG("opening %s to render to\n", options.renderPath);
+	int renderFd = open(options.renderPath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (renderFd < 0)
+	{
+		FATAL("could not open %s to render to: %s\n", options.renderPath, strerror(errno));
+		return result;
+	}
+	
+	uint8_t* outputBuffer = (uint8_t*)malloc(bufferFrames * frameSize);
+	RenderSignal render = {};
+	render.fds[0] = render.fds[1] = -1;
+	int stopPipe[2] = { -1, -1 };
+	if (outputBuffer == nullptr)
+	{
+		FATAL("could not allocate memory for render buffer\n");
+	}
+	else if (!openWakePipe(render.fds) || pipe(stopPipe) != 0)
+	{
+		FATAL("could not create render pipes\n");
+	}
+	
+	// a mix input's reader waits on a flag and a pipe of its own, since it's us making room,
+	// not the stream callback; the main input's waits on the stream callback's, as usual
+	RenderReader readers[kMaxInputs] = {};
+	std::atomic<bool> roomWaiting[kMaxInputs] = {};
+	int roomPipes[kMaxInputs][2];
+	std::atomic<bool> inputOpen(true);
+	bool mapped = callbackData.mapping != nullptr;
+	size_t readerCount = mixInputCount > 0 ? mixInputCount : (decoder != nullptr || mapped ? 0 : 1);
+	for (size_t i = 0; i < kMaxInputs; ++i)
+	{
+		roomPipes[i][0] = roomPipes[i][1] = -1;
+	}
+	for (size_t i = 0; i < readerCount && result == 0; ++i)
+	{
+		RenderReader& reader = readers[i];
+		if (mixInputCount > 0)
+		{
+			MixInput& input = mixInputs[i];
+			if (!openWakePipe(roomPipes[i]))
+			{
+				FATAL("could not create render pipes\n");
+				break;
+			}
+			reader.fd = input.fd;
+			reader.ringBuffer = &input.ringBuffer;
+			reader.ingest = &input.ingest;
+			reader.byteIndex = input.byteIndex;
+			reader.waiting = &roomWaiting[i];
+			reader.wakeFd = roomPipes[i][0];
+			reader.open = &input.open;
+		}
+		else
+		{
+			reader.fd = STDIN_FILENO;
+			reader.ringBuffer = &ringBuffer;
+			reader.outputs = &output;
+			reader.outputCount = 1;
+			reader.ingest = &ingest;
+			reader.clips = clips;
+			reader.tee = tee;
+			reader.byteIndex = ingest.bytesPreloaded;
+			reader.waiting = callbackData.writerWaiting;
+			reader.wakeFd = wakeFd;
+			reader.open = &inputOpen;
+			ingest.bytesPreloaded = 0;
+		}
+		reader.wakeThreshold = callbackData.wakeThreshold;
+		reader.stopFd = stopPipe[0];
+		reader.render = &render;
+		reader.stats = &stats;
+	}
+	if (result == 0 && wave && !writeRender(renderFd, waveHeader, kWaveHeaderBytes))
+	{
+		FATAL("could not write to %s: %s\n", options.renderPath, strerror(errno));
+	}
+	
+	std::thread readerThreads[kMaxInputs];
+	std::thread decoderThread;
+	if (result == 0)
+	{
+		DEBUG("rendering %zu input(s) to %s%s, %lu frames at a time\n",
+			std::max(mixInputCount, (size_t)1),
+			options.renderPath,
+			wave ? " as WAV" : "",
+			bufferFrames);
+		for (size_t i = 0; i < readerCount; ++i)
+		{
+			readerThreads[i] = std::thread(runRenderReader, &readers[i]);
+		}
+		if (decoder != nullptr)
+		{
+			decoderInput.stopFd = stopPipe[0];
+			decoderInput.wakeFd = wakeFd;
+			decoderInput.ringBuffer = &ringBuffer;
+			decoderInput.outputs = &output;
+			decoderInput.outputCount = 1;
+			decoderInput.ingest = &ingest;
+			decoderInput.stats = &stats;
+			decoderInput.render = &render;
+			decoderThread = std::thread(runDecoderThread, decoder, &decoderInput);
+		}
+	}
+	
+	unsigned long long framesRendered = 0;
+	bool askedToWake = false;
+	PaStreamCallbackTimeInfo timeInfo = {};
+	std::chrono::time_point<std::chrono::high_resolution_clock> start = std::chrono::high_resolution_clock::now();
+	std::chrono::time_point<std::chrono::high_resolution_clock> lastStats = start;
+	while (result == 0)
+	{
+		// whether each input is still going comes before what it has queued, so one that's
+		// over is seen with everything it queued before it was
+		size_t inputCount = std::max(mixInputCount, (size_t)1);
+		bool anyOpen = false;
+		bool ready = true;
+		size_t mostQueued = 0;
+		for (size_t i = 0; i < inputCount; ++i)
+		{
+			bool open = false;
+			size_t queued = 0;
+			if (mixInputCount > 0)
+			{
+				open = mixInputs[i].open.load(std::memory_order_acquire);
+				queued = ringReadAvailable(mixInputs[i].ringBuffer);
+			}
+			else if (mapped)
+			{
+				queued = callbackData.mappingFrames - callbackData.mappingCursor.load(std::memory_order_relaxed);
+			}
+			else
+			{
+				open = decoder != nullptr ? !decoderInput.finished.load(std::memory_order_acquire) : inputOpen.load(std::memory_order_acquire);
+				queued = ringReadAvailable(callbackData.ringBuffer);
+			}
+			anyOpen = anyOpen || open;
+			ready = ready && (!open || queued >= bufferFrames);
+			mostQueued = std::max(mostQueued, queued);
+		}
+		if (!ready)
+		{
+			// ask the readers to wake us once one of them has queued more, then check again
+			// in case one already did so before it could see our request
+			if (!askedToWake)
+			{
+				render.waiting.store(true);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				askedToWake = true;
+			}
+			else
+			{
+				if (waitForInput(render.fds[0], -1, false, -1) < 0)
+				{
+					FATAL("error when waiting for input\n");
+				}
+				askedToWake = false;
+			}
+			continue;
+		}
+		if (!anyOpen && mostQueued == 0)
+		{
+			break;
+		}
+		
+		// once the inputs are all over, the last of them goes out in whatever's left of a buffer
+		unsigned long frames = anyOpen ? bufferFrames : (unsigned long)std::min((size_t)bufferFrames, mostQueued);
+		callbackData.draining.store(!anyOpen, std::memory_order_release);
+		timeInfo.currentTime = (PaTime)framesRendered / streamRate;
+		timeInfo.outputBufferDacTime = timeInfo.currentTime + (PaTime)frames / streamRate;
+		callback(nullptr, outputBuffer, frames, &timeInfo, 0, &callbackData);
+		framesRendered += frames;
+		
+		// the mix callback only wakes the writer, so waking the mix readers is up to us
+		if (mixInputCount > 0)
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			for (size_t i = 0; i < mixInputCount; ++i)
+			{
+				if (roomWaiting[i].load(std::memory_order_relaxed) &&
+					ringWriteAvailable(mixInputs[i].ringBuffer) >= callbackData.wakeThreshold &&
+					roomWaiting[i].exchange(false))
+				{
+					wakeWriter(roomPipes[i][1]);
+				}
+			}
+		}
+		
+		if (!writeRender(renderFd, outputBuffer, (size_t)frames * frameSize))
+		{
+			FATAL("could not write to %s: %s\n", options.renderPath, strerror(errno));
+		}
+		
+		if (options.statsInterval > 0.0)
+		{
+			std::chrono::time_point<std::chrono::high_resolution_clock> now = std::chrono::high_resolution_clock::now();
+			if (now - lastStats >= statsInterval)
+			{
+				printStats(&outputStats, 1, options.statsJSON);
+				lastStats = now;
+			}
+		}
+		if (timingRequested.exchange(false))
+		{
+			printTiming(output.timing);
+		}
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	
+	// a reader or the decoder may be blocked on input or on room in its ring buffer, and
+	// either way hanging up on it makes it give up
+	for (size_t i = 0; i < readerCount; ++i)
+	{
+		readers[i].stopping.store(true, std::memory_order_relaxed);
+	}
+	if (stopPipe[1] != -1)
+	{
+		close(stopPipe[1]);
+	}
+	for (size_t i = 0; i < readerCount; ++i)
+	{
+		if (readerThreads[i].joinable())
+		{
+			readerThreads[i].join();
+		}
+		if (readers[i].error != 0)
+		{
+			FATAL("error when reading input pipe %zu: %s\n", i, strerror(readers[i].error));
+		}
+	}
+	if (decoderThread.joinable())
+	{
+		decoderThread.join();
+		if (decoderInput.failed)
+		{
+			FATAL("could not decode %s input\n", codecName(decoder->codec));
+		}
+	}
+	if (stopPipe[0] != -1)
+	{
+		close(stopPipe[0]);
+	}
+	decoderInput.stopFd = -1;
+	
+	uint64_t dataBytes = framesRendered * frameSize;
+	if (result == 0 && wave && makeWaveHeader(waveHeader, outputFormat, options.channels, streamRate, dataBytes) &&
+		pwrite(renderFd, waveHeader, kWaveHeaderBytes, 0) != (ssize_t)kWaveHeaderBytes && errno != ESPIPE)
+	{
+		WARN("could not fill in the sizes in %s's WAV header, so it doesn't say how long it is\n", options.renderPath);
+	}
+	if (close(renderFd) != 0 && result == 0)
+	{
+		FATAL("could not write to %s: %s\n", options.renderPath, strerror(errno));
+	}
+	
+	if (result == 0)
+	{
+		fprintf(stdout,
+			options.statsJSON ?
+				"{\"render\":\"%s\",\"output\":\"%s\",\"channels\":%d,\"rate\":%g,\"frames\":%llu,\"audio\":%.3f,\"elapsed\":%.3f,\"framesPerSecond\":%.0f,\"realtime\":%.1f}\n" :
+				"render: %s output=%s channels=%d rate=%gHz frames=%llu audio=%.3fs elapsed=%.3fs frames/s=%.0f realtime=%.1fx\n",
+			options.renderPath,
+			formatName(outputFormat.sampleFormat, false),
+			options.channels,
+			streamRate,
+			framesRendered,
+			framesRendered / streamRate,
+			elapsed,
+			elapsed > 0.0 ? framesRendered / elapsed : 0.0,
+			elapsed > 0.0 ? framesRendered / elapsed / streamRate : 0.0
+		);
+		fflush(stdout);
+	}
+	
+	for (size_t i = 0; i < kMaxInputs; ++i)
+	{
+		closeWakePipe(roomPipes[i]);
+	}
+	closeWakePipe(render.fds);
+	free(outputBuffer);
+	return result;
+}
+
+static
+int runBench(const Options& options)
+{
+	// feeds generated input down a pipe through the same ingest and ring buffer as the
+	// callback writer, and calls streamCallback back to back on a clock of its own, as a
+	// null device with no sound card to wait on; the device runs at 48kHz when resampling
+	int result = 0;
+	double streamRate = options.resampleQuality != kResampleOff ? kNullDeviceRate : options.sampleRate;
+	ChannelMap channelMap;
+	int outputChannels = options.channels;
+	if (options.channelMap != nullptr)
+	{
+		result = initChannelMap(options, channelMap, options.channels);
+		outputChannels = channelMap.outputChannels;
+	}
+	size_t frameSize = (size_t)options.sampleSize * outputChannels;
+	unsigned long queueFrames = (unsigned long)(options.queueTime * streamRate / 1000.0);
+	size_t ringBufferSize = std::max(queueFrames, (unsigned long)options.framesPerBuffer);
+	
+	Ingest ingest = {};
+	SampleFormat inputFormat = { options.inputSampleFormat, options.inputSampleSize, options.inputBigEndian };
+	SampleFormat outputFormat = { options.sampleFormat, options.sampleSize, hostIsBigEndian() };
+	if (result == 0)
+	{
+		result = initIngest(options, ingest, inputFormat, outputFormat, options.channels, options.channelMap != nullptr ? &channelMap : nullptr, options.sampleRate, streamRate,
+			streamRate != options.sampleRate || options.driftTarget > 0.0, false, ringBufferSize, 0);
+	}
+	
+	unsigned long silenceFrames = (unsigned long)options.framesPerBuffer;
+	size_t sampleBufferSize = ringBufferSize * frameSize;
+	void* sampleBuffer = allocRingMemory(sampleBufferSize);
+	uint8_t* silenceBuffer = (uint8_t*)PaUtil_AllocateMemory((long)(silenceFrames * frameSize));
+	uint8_t* outputBuffer = (uint8_t*)malloc(options.framesPerBuffer * frameSize);
+	if (result == 0 && (sampleBuffer == nullptr || silenceBuffer == nullptr || outputBuffer == nullptr))
+	{
+		FATAL("could not allocate memory for benchmark\n");
+	}
+	
+	// the input is a full-scale sine in the input format, written by a child process as
+	// fast as we'll take it, so our side of the pipe sees real read() calls
+	int inputPipe[2] = { -1, -1 };
+	pid_t generator = -1;
+	if (result == 0)
+	{
+		if (pipe(inputPipe) != 0 || (generator = fork()) < 0)
+		{
+			FATAL("could not start benchmark input generator\n");
+		}
+		else if (generator == 0)
+		{
+			close(inputPipe[0]);
+			const size_t kPatternFrames = 4096;
+			const double kPi = 3.14159265358979323846;
+			float* sine = (float*)malloc(sizeof(float) * kPatternFrames * options.channels);
+			uint8_t* pattern = (uint8_t*)malloc(kPatternFrames * ingest.frameSize);
+			if (sine == nullptr || pattern == nullptr)
+			{
+				_exit(1);
+			}
+			for (size_t i = 0; i < kPatternFrames * options.channels; ++i)
+			{
+				sine[i] = (float)std::sin(2.0 * kPi * 64.0 * (double)(i / options.channels) / kPatternFrames);
+			}
+			fromFloatFunction(inputFormat)(sine, pattern, kPatternFrames * options.channels);
+			while (write(inputPipe[1], pattern, kPatternFrames * ingest.frameSize) > 0)
+			{
+			}
+			_exit(0);
+		}
+		close(inputPipe[1]);
+	}
+	
+	Stats stats = {};
+	stats.minFill = std::numeric_limits<long>::max();
+	stats.maxFill = -1;
+	Timing timing = {};
+	timing.sampleRate = streamRate;
+	std::atomic<bool> writerWaiting(false);	// never set, since we never wait for the callback
+	CallbackData callbackData = {};
+	FrameRing& ringBuffer = callbackData.ringBuffer;	// with just the one output, the writer can share its view
+	if (result == 0)
+	{
+		makeSilence(options.sampleFormat, options.sampleSize, silenceBuffer, silenceFrames * outputChannels);
+		initRing(ringBuffer, frameSize, ringBufferSize, sampleBuffer);
+		callbackData.silence = silenceBuffer;
+		callbackData.silenceFrames = silenceFrames;
+		callbackData.stats = &stats;
+		callbackData.timing = &timing;
+		callbackData.writerWaiting = &writerWaiting;
+		callbackData.wakeThreshold = std::max(ringBufferSize / 2, (size_t)1);
+		callbackData.wakeFd = -1;
+	}
+	
+	Histogram callbackCost = {};	// in nanoseconds
+	unsigned long long framesWanted = (unsigned long long)(options.benchTime * streamRate);
+	unsigned long long framesPlayed = 0;
+	size_t byteIndex = 0;
+	PaStreamCallbackTimeInfo timeInfo = {};
+	std::chrono::time_point<std::chrono::high_resolution_clock> start = std::chrono::high_resolution_clock::now();
+	while (result == 0 && framesPlayed < framesWanted)
+	{
+		// refill the way the writer does once a callback wakes it, until the ring is full
+		if (ringWriteAvailable(ringBuffer) >= callbackData.wakeThreshold)
+		{
+			if (ingest.buffer != nullptr)
+			{
+				drainStaging(ringBuffer, ingest, byteIndex);
+			}
+			while (result == 0 && ringWriteAvailable(ringBuffer) > 0)
+			{
+				size_t bytesPending = ingest.buffer == nullptr ? ringPartialBytes(ringBuffer) : byteIndex % ingest.frameSize;
+				ssize_t bytesRead = ingest.buffer == nullptr ?
+					readRingBuffer(inputPipe[0], ringBuffer, ingest, nullptr) :
+					readConvertRingBuffer(inputPipe[0], ringBuffer, ingest, byteIndex, nullptr);
+				stats.readCalls.fetch_add(1, std::memory_order_relaxed);
+				if (bytesRead < 0 && errno == EAGAIN)
+				{
+					break;	// enough staged to fill it already
+				}
+				if (bytesRead == 0 || (bytesRead < 0 && errno != EINTR))
+				{
+					FATAL("benchmark input generator stopped\n");
+				}
+				if (bytesRead > 0)
+				{
+					stats.bytesRead.fetch_add((unsigned long long)bytesRead, std::memory_order_relaxed);
+					stats.framesWritten.fetch_add((bytesPending + (size_t)bytesRead) / ingest.frameSize, std::memory_order_relaxed);
+				}
+			}
+		}
+		
+		timeInfo.currentTime = (PaTime)framesPlayed / streamRate;
+		timeInfo.outputBufferDacTime = timeInfo.currentTime + (PaTime)options.framesPerBuffer / streamRate;
+		std::chrono::time_point<std::chrono::high_resolution_clock> before = std::chrono::high_resolution_clock::now();
+		streamCallback(nullptr, outputBuffer, (unsigned long)options.framesPerBuffer, &timeInfo, 0, &callbackData);
+		std::chrono::time_point<std::chrono::high_resolution_clock> after = std::chrono::high_resolution_clock::now();
+		histogramRecord(callbackCost, (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(after - before).count());
+		framesPlayed += (unsigned long long)options.framesPerBuffer;
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	
+	if (result == 0)
+	{
+		unsigned long long readCalls = stats.readCalls.load(std::memory_order_relaxed);
+		fprintf(stdout,
+			options.statsJSON ?
+				"{\"input\":\"%s\",\"output\":\"%s\",\"channels\":%d,\"map\":\"%s\",\"buffer\":%ld,\"framesPerSecond\":%.0f,\"realtime\":%.1f,\"readsPerFrame\":%.6f,\"callbackP50\":%llu,\"callbackP99\":%llu,\"callbackP999\":%llu,\"callbackMax\":%llu,\"underruns\":%lu}\n" :
+				"bench: input=%s output=%s channels=%d map=%s buffer=%ld frames/s=%.0f realtime=%.1fx reads/frame=%.6f callback p50=%lluns p99=%lluns p99.9=%lluns max=%lluns underruns=%lu\n",
+			formatName(inputFormat.sampleFormat, inputFormat.bigEndian),
+			formatName(outputFormat.sampleFormat, false),
+			options.channels,
+			options.channelMap != nullptr ? options.channelMap : "none",
+			options.framesPerBuffer,
+			elapsed > 0.0 ? framesPlayed / elapsed : 0.0,
+			elapsed > 0.0 ? framesPlayed / elapsed / streamRate : 0.0,
+			framesPlayed > 0 ? (double)readCalls / framesPlayed : 0.0,
+			histogramPercentile(callbackCost, 50.0),
+			histogramPercentile(callbackCost, 99.0),
+			histogramPercentile(callbackCost, 99.9),
+			callbackCost.max.load(std::memory_order_relaxed),
+			stats.underruns.load(std::memory_order_relaxed) + stats.partialCallbacks.load(std::memory_order_relaxed)
+		);
+		fflush(stdout);
+	}
+	
+	if (inputPipe[0] != -1)
+	{
+		close(inputPipe[0]);	// the generator dies of SIGPIPE on its next write
+	}
+	if (generator > 0)
+	{
+		waitpid(generator, nullptr, 0);
+	}
+	free(outputBuffer);
+	if (silenceBuffer != nullptr)
+	{
+		PaUtil_FreeMemory(silenceBuffer);
+	}
+	if (sampleBuffer != nullptr)
+	{
+		freeRingMemory(sampleBuffer, sampleBufferSize);
+	}
+	freeIngest(options, ingest);
+	return result;
+}
+
+static
+void takeInputFormat(Options& options, const SampleFormat& format, int channels, double sampleRate)
+{
+	// what a header or decoder says the input is, overriding the command line; the output
+	// follows it too, unless it was given its own format
+	options.channels = channels;
+	options.sampleRate = sampleRate;
+	options.inputSampleFormat = format.sampleFormat;
+	options.inputSampleSize = format.sampleSize;
+	options.inputBigEndian = format.bigEndian;
+	if (!options.outputFormatSet)
+	{
+		options.sampleFormat = format.sampleFormat;
+		options.sampleSize = format.sampleSize;
+	}
+}
+
+static
+void takeClipFormat(Options& options, const InputHeader& header)
+{
+	// the stream is whatever the first clip is, except where -c, -f or -r say otherwise; the
+	// clip reader starts out as though the input were already in the stream's own format
+	if (!options.channelsSet)
+	{
+		options.channels = header.channels;
+	}
+	if (!options.sampleRateSet)
+	{
+		options.sampleRate = header.sampleRate;
+	}
+	if (!options.outputFormatSet)
+	{
+		options.sampleFormat = header.format.sampleFormat;
+		options.sampleSize = header.format.sampleSize;
+	}
+	options.inputSampleFormat = options.sampleFormat;
+	options.inputSampleSize = options.sampleSize;
+	options.inputBigEndian = hostIsBigEndian();
+}
+
+// the steps of starting up that -T reports on, in the order main() usually finishes them;
+// with -Q, waiting for input overlaps PortAudio's, so it may come sooner
+enum StartupStep
+{
+	kStartupOptions,
+	kStartupInitialize,
+	kStartupDevices,
+	kStartupInput,
+	kStartupBuffers,
+	kStartupStreams,
+	kStartupWriter,
+	kStartupStepCount
+};
+
+struct StartupProfile
+{
+	std::chrono::time_point<std::chrono::high_resolution_clock> start;
+	std::chrono::time_point<std::chrono::high_resolution_clock> steps[kStartupStepCount];	// the epoch for steps we never got to
+};
+
+static
+void markStartup(StartupProfile& profile, StartupStep step)
+{
+	profile.steps[step] = std::chrono::high_resolution_clock::now();
+}
+
+static
+void printStartupProfile(const StartupProfile& profile, const Output* outputs, size_t outputCount)
+{
+	static const char* const kStepNames[kStartupStepCount] =
+	{
+		"options parsed",
+		"PortAudio initialized",
+		"devices found",
+		"input arrived",
+		"buffers allocated",
+		"streams opened",
+		"writer started",
+	};
+	
+	fprintf(stdout, "startup profile, in milliseconds since starting:\n");
+	for (size_t i = 0; i < kStartupStepCount; ++i)
+	{
+		if (profile.steps[i].time_since_epoch().count() != 0)
+		{
+			fprintf(stdout, "\t%s: %.3f\n", kStepNames[i], std::chrono::duration<double, std::milli>(profile.steps[i] - profile.start).count());
+		}
+	}
+	
+	// the callbacks only know when they happened, not whether we'd got that far by then
+	for (size_t i = 0; i < outputCount; ++i)
+	{
+		const Timing& timing = outputs[i].timing;
+		long long ticks[2] = { timing.firstCallback.load(std::memory_order_relaxed), timing.firstAudio.load(std::memory_order_relaxed) };
+		const char* names[2] = { "first callback", "first callback with input" };
+		for (size_t j = 0; j < 2; ++j)
+		{
+			if (ticks[j] != 0)
+			{
+				std::chrono::time_point<std::chrono::high_resolution_clock> when{std::chrono::high_resolution_clock::duration(ticks[j])};
+				double ms = std::chrono::duration<double, std::milli>(when - profile.start).count();
+				if (outputCount > 1)
+				{
+					fprintf(stdout, "\t%s on device %d: %.3f\n", names[j], outputs[i].device, ms);
+				}
+				else
+				{
+					fprintf(stdout, "\t%s: %.3f\n", names[j], ms);
+				}
+			}
+		}
+	}
+	fflush(stdout);
+}
+
+// with -Q, the input side of starting up happens on a thread of its own while the main
+// thread waits on PortAudio: first waiting for the input's first chunk and looking for a
+// header in it, and then, once there's somewhere to put it, reading ahead while the
+// streams open
+struct FastOpen
+{
+	const Options* options;
+	StartupProfile* profile;
+	int stopPipe[2];	// poked to call off waiting for input
+	std::atomic<bool> stopping;
+	std::thread thread;
+	
+	// what the header peek found
+	uint8_t* peek;
+	size_t peekBytes;
+	InputHeader header;
+	int peeked;
+	
+	// where the read-ahead goes: straight into the ring buffer, or into the ingest's staging
+	// buffer if the input needs processing first
+	FrameRing* ringBuffer;
+	Output* outputs;
+	size_t outputCount;
+	Ingest* ingest;
+	Tee* tee;
+};
+
+static
+int peekHeader(const Options& options, int stopFd, uint8_t* peek, size_t& peekBytes, InputHeader& header)
+{
+	// 1 with the input's first chunk in peek, 0 if none came in time, or -1 if sniffHeader
+	// couldn't make sense of it
+	if (waitForInput(stopFd, STDIN_FILENO, true, pollTimeout(std::chrono::duration<double>(options.timeout), std::chrono::duration<double>(0.0))) != 1)
+	{
+		return 0;
+	}
+	return sniffHeader(STDIN_FILENO, peek, peekBytes, header) ? 1 : -1;
+}
+
+static
+void runHeaderPeek(FastOpen* fastOpen)
+{
+	fastOpen->peeked = peekHeader(*fastOpen->options, fastOpen->stopPipe[0], fastOpen->peek, fastOpen->peekBytes, fastOpen->header);
+	markStartup(*fastOpen->profile, kStartupInput);
+}
+
+static
+void runReadAhead(FastOpen* fastOpen)
+{
+	// reads until there's no more room, the input runs dry, or the streams are open and the
+	// writer takes over; an EOF or error is left for the writer's own first read to find
+	Ingest& ingest = *fastOpen->ingest;
+	FrameRing& ringBuffer = *fastOpen->ringBuffer;
+	Stats& stats = fastOpen->outputs[0].stats;
+	size_t stagingBytes = ingest.bufferFrames * ingest.frameSize;
+	while (!fastOpen->stopping.load(std::memory_order_relaxed))
+	{
+		bool room = ingest.buffer != nullptr ? ingest.bytesPreloaded < stagingBytes : ringWriteAvailable(ringBuffer) > 0;
+		if (!room || waitForInput(fastOpen->stopPipe[0], STDIN_FILENO, true, -1) != 1)
+		{
+			break;
+		}
+		
+		size_t partialBytes = ingest.buffer == nullptr ? ringPartialBytes(ringBuffer) : ingest.bytesPreloaded % ingest.frameSize;
+		ssize_t bytesRead = 0;
+		if (ingest.buffer != nullptr)
+		{
+			size_t bytes = inputWanted(ingest, stagingBytes - ingest.bytesPreloaded);
+			bytesRead = bytes > 0 ? readTee(fastOpen->tee, STDIN_FILENO, ingest.buffer + ingest.bytesPreloaded, bytes) : 0;
+			if (bytesRead > 0)
+			{
+				ingest.bytesPreloaded += (size_t)bytesRead;
+			}
+			inputTaken(ingest, bytesRead);
+		}
+		else
+		{
+			bytesRead = readRingBuffer(STDIN_FILENO, ringBuffer, ingest, fastOpen->tee);
+			publishFanoutRing(ringBuffer, fastOpen->outputs, fastOpen->outputCount);
+		}
+		stats.readCalls.fetch_add(1, std::memory_order_relaxed);
+		if (bytesRead <= 0)
+		{
+			if (bytesRead == 0 || (errno != EINTR && errno != EAGAIN))
+			{
+				break;
+			}
+			continue;
+		}
+		stats.bytesRead.fetch_add((unsigned long long)bytesRead, std::memory_order_relaxed);
+		stats.framesWritten.fetch_add((partialBytes + (size_t)bytesRead) / ingest.frameSize, std::memory_order_relaxed);
+	}
+}
+
+static
+void stopFastOpen(FastOpen& fastOpen)
+{
+	if (fastOpen.thread.joinable())
+	{
+		fastOpen.stopping.store(true, std::memory_order_relaxed);
+		wakeWriter(fastOpen.stopPipe[1]);
+		fastOpen.thread.join();
+		fastOpen.stopping.store(false, std::memory_order_relaxed);
+		drainWakePipe(fastOpen.stopPipe[0]);
+	}
+}
+
+static
+bool teesToStdout(const char* path)
+{
+	// a tee going to stdout, either by number or by some name for whatever stdout is, like
+	// /dev/stdout, has it all to itself, or everything we'd print would end up in the input
+	char* end = nullptr;
+	long descriptor = strtol(path, &end, 10);
+	if (*path != '\0' && *end == '\0')
+	{
+		return descriptor == STDOUT_FILENO;
+	}
+	struct stat target = {};
+	struct stat output = {};
+	return stat(path, &target) == 0 && fstat(STDOUT_FILENO, &output) == 0 &&
+		target.st_dev == output.st_dev && target.st_ino == output.st_ino;
+}
+
+int main(int argc, char* argv[])
+{
+	StartupProfile profile = {};
+	profile.start = std::chrono::high_resolution_clock::now();
+	
+	Options options;
+	int result = getOpts(argc, argv, options);
+	if (result != 0)
+	{
+		return result;
+	}
+	markStartup(profile, kStartupOptions);
+	
+	if (options.benchTime > 0.0)
+	{
+		return runBench(options);
+	}
+	bool rendering = options.renderPath != nullptr && !options.listDevices;	// to a file, with no PortAudio at all
+	
+	// when the tee is stdout, it keeps the descriptor stdout was, and everything printed goes
+	// to stderr instead, from here on
+	const char* teeTarget = options.teePath;
+	char teeStdout[24];
+	if (options.teePath != nullptr && teesToStdout(options.teePath))
+	{
+		fflush(stdout);
+		int teeFd = dup(STDOUT_FILENO);
+		if (teeFd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+		{
+			FATAL("could not move stdout out of the way of teeing input to it\n");
+		}
+		else
+		{
+			setvbuf(stdout, nullptr, _IOLBF, 0);
+			snprintf(teeStdout, sizeof(teeStdout), "%d", teeFd);
+			teeTarget = teeStdout;
+		}
+	}
+	
+	if (options.inputPath != nullptr)
+	{
+		DEBUG("opening input file %s\n", options.inputPath);
+		int inputFd = open(options.inputPath, O_RDONLY);
+		if (inputFd < 0 || dup2(inputFd, STDIN_FILENO) < 0)
+		{
+			FATAL("could not open input file %s\n", options.inputPath);
+		}
+		if (inputFd > STDIN_FILENO)
+		{
+			close(inputFd);
+		}
+	}
+	
+	// a header knows what the input is better than the command line does, so we look at the
+	// first chunk of input for one before sizing anything; a raw stream costs just the read
+	// we'd have made anyway, and what's left of the chunk is played as though we hadn't. Who
+	// knows how long the input will take to show up, so with -Q, we wait for it while
+	// PortAudio gets going
+	uint8_t headerPeek[kHeaderPeekBytes];
+	bool peekInput = result == 0 && options.readHeader && !options.listDevices && options.serverPath == nullptr && options.networkAddress == nullptr;
+	FastOpen fastOpen = {};
+	fastOpen.stopPipe[0] = -1;
+	fastOpen.stopPipe[1] = -1;
+	if (result == 0 && options.fastOpen && !options.listDevices)
+	{
+		DEBUG("creating fast open stop pipe\n");
+		if (!openWakePipe(fastOpen.stopPipe))
+		{
+			FATAL("could not create fast open stop pipe\n");
+		}
+		else if (peekInput)
+		{
+			fastOpen.options = &options;
+			fastOpen.profile = &profile;
+			fastOpen.peek = headerPeek;
+			fastOpen.thread = std::thread(runHeaderPeek, &fastOpen);
+		}
+	}
+	
+	PaError error = paNoError;
+	if (result == 0 && !rendering)
+	{
+		DEBUG("initializing PortAudio\n");
+		error = Pa_Initialize();
+		if (error != paNoError)
+		{
+			FATAL("could not initialize PortAudio: %s\n", Pa_GetErrorText(error));
+		}
+		markStartup(profile, kStartupInitialize);
+	}
+	
+	Output outputs[kMaxOutputs] = {};
+	size_t outputCount = std::max(options.deviceCount, (size_t)1);
+	if (result == 0 && options.deviceCount == 0 && !rendering)
+	{
+		DEBUG("getting default output device\n");
+		outputs[0].device = Pa_GetDefaultOutputDevice();
+		if (outputs[0].device == paNoDevice)
+		{
+			FATAL("could not detect default output device\n");
+		}
+		INFO("default output device is %d\n", outputs[0].device);
+	}
+	if (result == 0 && options.listDevices)
+	{
+		listDevices(options);
+		Pa_Terminate();
+		return 0;
+	}
+	
+	for (size_t i = 0; i < options.deviceCount && result == 0; ++i)
+	{
+		outputs[i].device = findOutputDevice(options.devices[i]);
+		const PaDeviceInfo* deviceInfo = Pa_GetDeviceInfo(outputs[i].device);
+		if (outputs[i].device == paNoDevice)
+		{
+			FATAL("no output device matches %s\n", options.devices[i]);
+		}
+		else if (deviceInfo == nullptr || deviceInfo->maxOutputChannels <= 0)
+		{
+			FATAL("device %d is not an output device\n", outputs[i].device);
+		}
+		else
+		{
+			INFO("output device %zu is %d (%s)\n", i, outputs[i].device, deviceInfo->name);
+		}
+	}
+	if (result == 0)
+	{
+		markStartup(profile, kStartupDevices);
+	}
+	
+	size_t peekBytes = 0;
+	InputHeader header = {};
+	int peeked = 0;
+	if (fastOpen.thread.joinable())
+	{
+		if (result != 0)
+		{
+			stopFastOpen(fastOpen);	// no sense waiting for input we'll never play
+		}
+		else
+		{
+			fastOpen.thread.join();
+		}
+		peekBytes = fastOpen.peekBytes;
+		header = fastOpen.header;
+		peeked = fastOpen.peeked;
+	}
+	else if (result == 0 && peekInput)
+	{
+		peeked = peekHeader(options, -1, headerPeek, peekBytes, header);
+		markStartup(profile, kStartupInput);
+	}
+	
+	uint64_t dataBytes = 0;
+	bool compressed = false;
+	bool clipped = false;
+	Codec codec = kCodecFlac;
+	if (result == 0 && peeked != 0)
+	{
+		if (peeked < 0)
+		{
+			if (header.type != kHeaderNone)
+			{
+				FATAL("could not read %s header, or its audio isn't PCM we can play\n", headerTypeName(header.type));
+			}
+			else
+			{
+				FATAL("error when reading input pipe\n");
+			}
+		}
+		else if (header.type == kHeaderFlac || header.type == kHeaderOgg)
+		{
+			compressed = true;
+			codec = header.type == kHeaderFlac ? kCodecFlac : kCodecOpus;
+		}
+		else if (header.type == kHeaderClip)
+		{
+			clipped = true;
+			takeClipFormat(options, header);
+			INFO("clip input: the first is %d channels of %s%zu-bit %s at %gHz, and they all play as %d channels of %zu-bit %s at %gHz\n",
+				header.channels,
+				header.format.bigEndian ? "big-endian " : "",
+				header.format.sampleSize * CHAR_BIT,
+				header.format.sampleFormat == paFloat32 ? "float" : "integer",
+				header.sampleRate,
+				options.channels,
+				options.sampleSize * CHAR_BIT,
+				options.sampleFormat == paFloat32 ? "float" : "integer",
+				options.sampleRate);
+		}
+		else if (header.type != kHeaderNone)
+		{
+			takeInputFormat(options, header.format, header.channels, header.sampleRate);
+			dataBytes = header.dataBytes;
+			INFO("%s header: input is %d channels of %s%zu-bit %s at %gHz\n",
+				headerTypeName(header.type),
+				header.channels,
+				header.format.bigEndian ? "big-endian " : "",
+				header.format.sampleSize * CHAR_BIT,
+				header.format.sampleFormat == paFloat32 ? "float" : "integer",
+				header.sampleRate);
+		}
+		
+		// a file just goes back to where the audio starts, so it can still be mapped
+		if (peekBytes > 0 && lseek(STDIN_FILENO, -(off_t)peekBytes, SEEK_CUR) >= 0)
+		{
+			peekBytes = 0;
+		}
+		else if (dataBytes > 0 && peekBytes > dataBytes)
+		{
+			peekBytes = (size_t)dataBytes;	// a short data chunk can end inside what came in with the header
+		}
+	}
+	
+	// a tee picks up wherever the header left off, starting with the rest of what came in
+	// with it, and from then on sees everything the writer (or decoder) reads
+	Tee tee = {};
+	tee.fd = -1;
+	if (result == 0 && options.teePath != nullptr)
+	{
+		if (options.serverPath != nullptr || options.networkAddress != nullptr || options.mixInputCount > 0)
+		{
+			FATAL("can only tee input from stdin or -i, without mixing it\n");
+		}
+		else
+		{
+			DEBUG("opening %s to tee input to\n", options.teePath);
+			size_t teeFrameSize = compressed || clipped ? 1 : options.inputSampleSize * options.channels;
+			bool opened = openTee(tee, teeTarget, STDIN_FILENO, options.teePolicy, teeFrameSize);
+			int error = errno;
+			if (teeTarget != options.teePath)
+			{
+				close(atoi(teeTarget));	// the tee has its own copy of what was stdout
+			}
+			if (!opened)
+			{
+				FATAL("could not open %s to tee input to: %s\n", options.teePath, strerror(error));
+			}
+			else
+			{
+				signal(SIGPIPE, SIG_IGN);	// so whatever's reading the tee going away just stops it
+				writeTee(tee, headerPeek, peekBytes);
+				INFO("teeing input to %s%s\n", options.teePath, tee.zeroCopy ? "" : ", copying it");
+			}
+		}
+	}
+	Tee* inputTee = tee.fd != -1 ? &tee : nullptr;
+	
+	// compressed input's decoder reads as far as the stream's format now, and the rest on
+	// a thread of its own once we're playing
+	Decoder decoder = {};
+	DecoderInput decoderInput = {};
+	decoderInput.stopFd = -1;
+	if (result == 0 && compressed)
+	{
+		decoderInput.inputFd = STDIN_FILENO;
+		decoderInput.peek = headerPeek;
+		decoderInput.peekBytes = peekBytes;
+		decoderInput.tee = inputTee;
+		peekBytes = 0;	// the decoder's now
+		if (!codecAvailable(codec))
+		{
+			FATAL("input is %s, which this build can't decode\n", codecName(codec));
+		}
+		else if (options.mixInputCount > 0)
+		{
+			FATAL("can't mix %s input\n", codecName(codec));
+		}
+		else if (!openDecoder(decoder, codec, decoderRead, decoderSpace, decoderCommit, &decoderInput))
+		{
+			FATAL("could not decode %s input\n", codecName(codec));
+		}
+		else
+		{
+			takeInputFormat(options, decoder.format, decoder.channels, decoder.sampleRate);
+			if (options.engine != kEngineCallback)
+			{
+				WARN("decoding needs the callback engine, using it\n");
+				options.engine = kEngineCallback;
+			}
+			INFO("%s input: decoding %d channels of %zu-bit %s at %gHz\n",
+				codecName(codec),
+				decoder.channels,
+				decoder.format.sampleSize * CHAR_BIT,
+				decoder.format.sampleFormat == paFloat32 ? "float" : "integer",
+				decoder.sampleRate);
+		}
+	}
+	
+	// clips are read one at a time by the callback writer, each made to fit the stream on
+	// its way into the ring buffer, starting with whatever came in with the first one's header
+	ClipInput clipInput = {};
+	if (result == 0 && clipped)
+	{
+		clipInput.peek = headerPeek;
+		clipInput.peekBytes = peekBytes;
+		clipInput.tee = inputTee;
+		peekBytes = 0;	// the clip reader's now
+		if (options.mixInputCount > 0)
+		{
+			FATAL("can't mix clip input\n");
+		}
+		else if (options.channelMap != nullptr)
+		{
+			FATAL("can't map the channels of clip input, each clip's are made to fit the stream's\n");
+		}
+		else if (options.driftTarget > 0.0)
+		{
+			FATAL("can't hold a queue depth against clip input, whose rate changes from one clip to the next\n");
+		}
+		else if (options.engine != kEngineCallback)
+		{
+			WARN("clip input needs the callback engine, using it\n");
+			options.engine = kEngineCallback;
+		}
+	}
+	
+	// with the input's channels known for sure, a channel map says what the device gets
+	// instead, and from here on options.channels is that
+	int inputChannels = options.channels;
+	ChannelMap channelMap;
+	const ChannelMap* map = nullptr;
+	if (result == 0 && options.channelMap != nullptr)
+	{
+		result = initChannelMap(options, channelMap, inputChannels);
+		if (result == 0)
+		{
+			map = &channelMap;
+			options.channels = channelMap.outputChannels;
+		}
+	}
+	
+	// everything from here on is sized in device frames, which only differ from input
+	// frames if we're resampling or mapping channels; with several devices, they all run at
+	// the first one's rate
+	double streamRate = options.sampleRate;
+	if (result == 0 && options.resampleQuality != kResampleOff && rendering)
+	{
+		streamRate = kNullDeviceRate;
+		INFO("rendering at %gHz\n", streamRate);
+	}
+	else if (result == 0 && options.resampleQuality != kResampleOff)
+	{
+		streamRate = Pa_GetDeviceInfo(outputs[0].device)->defaultSampleRate;
+		INFO("device's native sample rate is %gHz\n", streamRate);
+	}
+	
+	// rendering hands over between threads rather than to a device, which a deeper queue
+	// lets them do in bigger gulps
+	size_t frameSize = (size_t)options.sampleSize * options.channels;
+	double queueTime = rendering ? std::max(options.queueTime, kRenderQueueTime) : options.queueTime;
+	unsigned long queueFrames = (unsigned long)(queueTime * streamRate / 1000.0);
+	unsigned long peekFrames = (unsigned long)((peekBytes + frameSize - 1) / frameSize);	// what we've read already has to fit
+	unsigned long packetFrames = options.networkAddress != nullptr ?	// and so does a whole packet, which goes in all or nothing
+		(unsigned long)std::ceil((double)kMaxPacketBytes / (options.inputSampleSize * inputChannels) * streamRate / options.sampleRate) : 0;
+	size_t ringBufferSize = std::max(std::max(std::max(queueFrames, (unsigned long)options.framesPerBuffer), peekFrames), packetFrames);
+	size_t prefillFrames = std::min((size_t)(options.prefillTime * streamRate / 1000.0), ringBufferSize);
+	size_t sampleBufferSize = ringBufferSize * frameSize;
+	void* sampleBuffer = nullptr;
+	if (result == 0)
+	{
+		DEBUG("allocating %zu frame (%zu byte) ring buffer\n", ringBufferSize, sampleBufferSize);
+		sampleBuffer = allocRingMemory(sampleBufferSize);
+		if (sampleBuffer == nullptr)
+		{
+			FATAL("could not allocate memory for ring buffer\n");
+		}
+	}
+	
+	Ingest ingest = {};
+	SampleFormat inputFormat = { options.inputSampleFormat, options.inputSampleSize, options.inputBigEndian };
+	SampleFormat outputFormat = { options.sampleFormat, options.sampleSize, hostIsBigEndian() };
+	if (result == 0 && options.mixInputCount == 0)
+	{
+		result = initIngest(options, ingest, inputFormat, outputFormat, inputChannels, map, options.sampleRate, streamRate,
+			streamRate != options.sampleRate || options.driftTarget > 0.0, clipped, ringBufferSize, peekBytes);
+		if (dataBytes > 0)
+		{
+			ingest.bytesLeft = dataBytes - peekBytes;	// for when the input isn't mapped, so reading it is all that can stop at the chunks after the audio
+		}
+	}
+	if (result == 0 && clipped)
+	{
+		clipInput.options = &options;
+		clipInput.format = inputFormat;
+		clipInput.channels = inputChannels;
+		clipInput.sampleRate = options.sampleRate;
+		clipInput.outputFormat = outputFormat;
+		clipInput.outputChannels = options.channels;
+		clipInput.streamRate = streamRate;
+		clipInput.ringFrames = ringBufferSize;
+	}
+	
+	// when mixing, the main input is just the first of the inputs, and all of them are
+	// processed into float for the stream callback to sum
+	MixInput mixInputs[kMaxInputs] = {};
+	size_t mixInputCount = options.mixInputCount > 0 ? options.mixInputCount + 1 : 0;
+	for (size_t i = 0; i < mixInputCount && result == 0; ++i)
+	{
+		MixInput& input = mixInputs[i];
+		SampleFormat format = inputFormat;
+		double rate = options.sampleRate;
+		int channels = options.channels;
+		input.fd = STDIN_FILENO;
+		input.gain = 1.0f;
+		input.channels = options.channels;
+		if (i > 0)
+		{
+			const InputSpec& spec = options.mixInputs[i - 1];
+			if (spec.sampleSize != 0)
+			{
+				format.sampleFormat = spec.sampleFormat;
+				format.sampleSize = spec.sampleSize;
+				format.bigEndian = spec.bigEndian;
+			}
+			rate = spec.sampleRate > 0.0 ? spec.sampleRate : rate;
+			input.gain = spec.gain;
+			channels = spec.channels > 0 ? spec.channels : channels;
+			
+			DEBUG("opening mix input %s\n", spec.path);
+			input.fd = open(spec.path, O_RDONLY);
+			if (input.fd < 0)
+			{
+				FATAL("could not open mix input %s\n", spec.path);
+				break;
+			}
+		}
+		
+		// an input with more or fewer channels than the stream is downmixed or spread out to
+		// fit it on its way in, as a clip would be
+		const ChannelMap* map = nullptr;
+		if (channels != options.channels)
+		{
+			if (!fitChannelMap(input.map, channels, options.channels))
+			{
+				FATAL("mix input %zu's %d channels can't be made into %d\n", i, channels, options.channels);
+				break;
+			}
+			map = &input.map;
+		}
+		
+		SampleFormat floatFormat = { paFloat32, sizeof(float), hostIsBigEndian() };
+		result = initIngest(options, input.ingest, format, floatFormat, channels, map, rate, streamRate, rate != streamRate, false, ringBufferSize, i == 0 ? peekBytes : 0);
+		if (i == 0 && dataBytes > 0)
+		{
+			input.ingest.bytesLeft = dataBytes - peekBytes;
+		}
+		if (result == 0)
+		{
+			size_t ringBytes = ringBufferSize * input.channels * sizeof(float);
+			DEBUG("allocating %zu frame (%zu byte) ring buffer for mix input %zu\n", ringBufferSize, ringBytes, i);
+			input.ringMemory = allocRingMemory(ringBytes);
+			if (input.ringMemory == nullptr)
+			{
+				FATAL("could not allocate memory for ring buffer\n");
+			}
+			else
+			{
+				initRing(input.ringBuffer, input.channels * sizeof(float), ringBufferSize, input.ringMemory);
+				input.open = true;
+			}
+		}
+	}
+	
+	// a regular file that needs no processing can be played straight from a mapping,
+	// starting wherever stdin's file position was left
+	MappedInput mappedInput = { nullptr, 0, 0 };
+	struct stat inputStat = {};
+	if (result == 0 && options.engine == kEngineCallback && outputCount == 1 && mixInputCount == 0 && ingest.buffer == nullptr && !compressed && options.serverPath == nullptr && options.networkAddress == nullptr && inputTee == nullptr &&
+		fstat(STDIN_FILENO, &inputStat) == 0 && S_ISREG(inputStat.st_mode))
+	{
+		off_t offset = lseek(STDIN_FILENO, 0, SEEK_CUR);
+		mappedInput.offset = offset > 0 ? (size_t)offset : 0;
+		mappedInput.size = (size_t)inputStat.st_size;
+		if (dataBytes > 0)
+		{
+			mappedInput.size = (size_t)std::min((uint64_t)mappedInput.size, mappedInput.offset + dataBytes);	// not any chunks after the audio
+		}
+		if (mappedInput.size > mappedInput.offset)
+		{
+			DEBUG("mapping %zu byte input file\n", mappedInput.size);
+			void* base = mmap(nullptr, mappedInput.size, PROT_READ, MAP_PRIVATE, STDIN_FILENO, 0);
+			if (base == MAP_FAILED)
+			{
+				WARN("could not map input file, reading it instead\n");
+			}
+			else
+			{
+				mappedInput.base = (uint8_t*)base;
+			}
+		}
+	}
+	
+	std::atomic<bool> writerWaiting(false);
+	FrameRing ringBuffer = {};	// the writer's view of the outputs' shared ring buffer memory
+	for (size_t i = 0; i < outputCount; ++i)
+	{
+		Output& output = outputs[i];
+		output.stats.minFill = std::numeric_limits<long>::max();
+		output.stats.maxFill = -1;
+		output.timing.sampleRate = streamRate;
+		output.callbackData.stats = &output.stats;
+		output.callbackData.timing = &output.timing;
+		output.callbackData.writerWaiting = &writerWaiting;
+	}
+	if (mappedInput.base != nullptr)
+	{
+		outputs[0].callbackData.mapping = mappedInput.base + mappedInput.offset;
+		outputs[0].callbackData.mappingFrames = (mappedInput.size - mappedInput.offset) / frameSize;
+	}
+	int wakePipe[2] = { -1, -1 };
+	uint8_t* silenceBuffer = nullptr;
+	if (result == 0)
+	{
+		initRing(ringBuffer, frameSize, ringBufferSize, sampleBuffer);
+		
+		// enough silence to pad out most callbacks in one go, so the callback never has to build any itself
+		unsigned long silenceFrames = (unsigned long)std::max(options.framesPerBuffer, 256L);
+		size_t silenceBufferSize = silenceFrames * frameSize;
+		DEBUG("allocating %lu frame (%zu byte) silence buffer\n", silenceFrames, silenceBufferSize);
+		silenceBuffer = (uint8_t*)PaUtil_AllocateMemory((long)silenceBufferSize);
+		if (silenceBuffer == nullptr)
+		{
+			FATAL("could not allocate memory for silence buffer\n");
+		}
+		else
+		{
+			makeSilence(options.sampleFormat, options.sampleSize, silenceBuffer, silenceFrames * options.channels);
+		}
+		
+		for (size_t i = 0; i < outputCount; ++i)
+		{
+			CallbackData& callbackData = outputs[i].callbackData;
+			initRing(callbackData.ringBuffer, frameSize, ringBufferSize, sampleBuffer);
+			callbackData.wakeThreshold = std::max(ringBufferSize / 2, (size_t)1);	// refill in big gulps rather than a frame at a time
+			callbackData.silence = silenceBuffer;
+			callbackData.silenceFrames = silenceFrames;
+		}
+	}
+	
+	float* mixBuffer = nullptr;
+	if (result == 0 && mixInputCount > 0)
+	{
+		CallbackData& callbackData = outputs[0].callbackData;
+		callbackData.mixBufferFrames = (unsigned long)std::max(options.framesPerBuffer, 256L);
+		DEBUG("allocating %lu frame mix buffer for %zu inputs\n", callbackData.mixBufferFrames, mixInputCount);
+		mixBuffer = (float*)PaUtil_AllocateMemory((long)(sizeof(float) * callbackData.mixBufferFrames * options.channels));
+		if (mixBuffer == nullptr)
+		{
+			FATAL("could not allocate memory for mix buffer\n");
+		}
+		callbackData.mixInputs = mixInputs;
+		callbackData.mixInputCount = mixInputCount;
+		callbackData.mixBuffer = mixBuffer;
+		callbackData.channels = options.channels;
+		callbackData.fromFloat = fromFloatFunction(outputFormat);
+	}
 	
-	int opt = -1;
-	// all options have required arguments except '-h'
-	while ((opt = getopt(argc, argv, ":hc:f:r:b:d:t:v:")) != -1)
+	// each stream callback gets its own queue of gain commands, and its own ramp
+	GainControl gainControls[kMaxOutputs] = {};
+	if (result == 0 && options.controlPath != nullptr)
 	{
-		switch (opt)
+		for (size_t i = 0; i < outputCount && result == 0; ++i)
 		{
-			case 'h':
-				printUsage();
-				exit(0);
-			case 'c':
-				options.channels = getIntArg(opt, defaults.channels);
-				break;
-			case 'f':
-				{
-					size_t i = 0;
-					for (; i < kFormatOptsCount; ++i)
-					{
-						FormatOptMapping& mapping = formatOptMap[i];
-						if (strcmp(mapping.optarg, optarg) == 0)
-						{
-							options.sampleFormat = mapping.sampleFormat;
-							options.sampleSize = mapping.sampleSize;
-							break;
-						}
-					}
-					if (i == kFormatOptsCount)
-					{
-						for (i = 0; i < kFormatOptsCount; ++i)
-						{
-							FormatOptMapping& mapping = formatOptMap[i];
-							if (mapping.sampleFormat == defaults.sampleFormat)
-							{
-								fprintf(stderr, "argument %s to option '-%c' is invalid, using default: %s\n", optarg, opt, mapping.optarg);
-								break;
-							}
-						}
-					}
-				}
-				break;
-			case 'r':
-				options.sampleRate = getDoubleArg(opt, defaults.sampleRate);
-				break;
-			case 'b':
-				options.framesPerBuffer = getIntArg(opt, defaults.framesPerBuffer);
-				break;
-			case 'd':
+			GainControl& control = gainControls[i];
+			initRing(control.commands, sizeof(GainCommand), kGainCommands, control.commandMemory);
+			control.gain = 1.0f;
+			control.target = 1.0f;
+			control.channels = options.channels;
+			control.toFloat = toFloatFunction(outputFormat);
+			control.fromFloat = fromFloatFunction(outputFormat);
+			if (mixInputCount == 0)
+			{
+				control.bufferFrames = (unsigned long)std::max(options.framesPerBuffer, 256L);
+				DEBUG("allocating %lu frame gain buffer for output %zu\n", control.bufferFrames, i);
+				control.buffer = (float*)PaUtil_AllocateMemory((long)(sizeof(float) * control.bufferFrames * options.channels));
+				if (control.buffer == nullptr)
 				{
-					size_t i = 0;
-					for (; i < kDisableOptsCount; ++i)
-					{
-						DisableOptMapping& mapping = disableOptMap[i];
-						if (strcmp(mapping.optarg, optarg) == 0)
-						{
-							options.streamFlags |= mapping.streamFlags;
-							break;
-						}
-					}
-					if (i == kDisableOptsCount)
-					{
-						fprintf(stderr, "argument %s to option '-%c' is invalid\n", optarg, opt);
-					}
+					FATAL("could not allocate memory for gain buffer\n");
 				}
-				break;
-			case 't':
-				options.timeout = getDoubleArg(opt, defaults.timeout);
-				break;
-			case 'v':
-				options.verbosity = getIntArg(opt, defaults.verbosity);
-				break;
-			case ':':
-				fprintf(stderr, "missing argument for option '-%c'\n", optopt);
-				printUsage();
-				return 1;
-			case '?':
-				fprintf(stderr, "unknown option: -%c\n", optopt);
-				printUsage();
-				return 1;
+			}
+			outputs[i].callbackData.gainControl = &control;
 		}
 	}
 	
-	return 0;
-}
-
-int main(int argc, char* argv[])
-{
-	Options options;
-	int result = getOpts(argc, argv, options);
-	if (result != 0)
+	// whatever we read past the header goes where the writer's first read would have put it
+	if (result == 0 && peekBytes > 0)
 	{
-		return result;
+		if (mixInputCount > 0)
+		{
+			memcpy(mixInputs[0].ingest.buffer, headerPeek, peekBytes);
+			mixInputs[0].byteIndex = peekBytes;
+		}
+		else if (ingest.buffer != nullptr)
+		{
+			memcpy(ingest.buffer, headerPeek, peekBytes);
+			ingest.bytesPreloaded = peekBytes;
+		}
+		else
+		{
+			memcpy(sampleBuffer, headerPeek, peekBytes);
+			ingest.bytesPreloaded = peekBytes;
+			if (options.engine == kEngineCallback)
+			{
+				// it's in the ring buffer already, a partial frame and all
+				ringAdvanceWrite(ringBuffer, peekBytes);
+				publishFanoutRing(ringBuffer, outputs, outputCount);
+				ingest.bytesPreloaded = 0;
+			}
+		}
 	}
-	
-#define PRINT(level, file, ...) if (options.verbosity >= level) { fprintf(file, __VA_ARGS__); }
-#define DEBUG(...) PRINT(4, stdout, __VA_ARGS__)
-#define INFO(...) PRINT(3, stdout, __VA_ARGS__)
-#define WARN(...) PRINT(2, stderr, __VA_ARGS__)
-#define ERROR(...) PRINT(1, stderr, __VA_ARGS__)
-#define FATAL(...) ERROR(__VA_ARGS__) result = 1;
-	
-	size_t frameSize = (size_t)options.sampleSize * options.channels;
-	uint8_t* pipeBuffer = nullptr;
-	if (result == 0)
+	if (result == 0 && clipped)
 	{
-		DEBUG("allocating %zu byte pipe buffer\n", frameSize);
-		pipeBuffer = (uint8_t*)malloc(frameSize);	// staging area for incoming sound data from stdin
-		if (pipeBuffer == nullptr)
+		// nothing more has to be read to play these
+		size_t bytesStaged = 0;
+		ssize_t bytesRead = 0;
+		while (clipInput.peekBytes > 0 && (bytesRead = readClipRingBuffer(-1, ringBuffer, ingest, bytesStaged, clipInput)) > 0)
+		{
+		}
+		if (bytesRead < 0 && errno != EAGAIN)
 		{
-			FATAL("could not allocate memory for pipe buffer\n");
+			FATAL("could not play clip input\n");
 		}
+		publishFanoutRing(ringBuffer, outputs, outputCount);
+		ingest.bytesPreloaded = bytesStaged;
+	}
+	if (result == 0)
+	{
+		markStartup(profile, kStartupBuffers);
+	}
+	
+	// opening a stream can take as long as initializing did, which is plenty of time to
+	// get the first of the input in ahead of the writer; it's only the plain callback
+	// writer that reads stdin as it comes, though, so it's only for that one
+	if (result == 0 && fastOpen.stopPipe[0] != -1 && options.engine == kEngineCallback && mixInputCount == 0 && !compressed && !clipped &&
+		mappedInput.base == nullptr && options.serverPath == nullptr && options.networkAddress == nullptr)
+	{
+		DEBUG("reading ahead while the streams open\n");
+		fastOpen.ringBuffer = &ringBuffer;
+		fastOpen.outputs = outputs;
+		fastOpen.outputCount = outputCount;
+		fastOpen.ingest = &ingest;
+		fastOpen.tee = inputTee;
+		fastOpen.thread = std::thread(runReadAhead, &fastOpen);
 	}
 	
-	ring_buffer_size_t ringBufferSize = nextPowerOfTwo((unsigned long)options.framesPerBuffer);	// PA's ring buffer needs to have a power-of-two number of elements
-	size_t sampleBufferSize = (size_t)ringBufferSize * frameSize;
-	void* sampleBuffer = nullptr;
 	if (result == 0)
 	{
-		DEBUG("allocating %d frame (%zu byte) ring buffer\n", ringBufferSize, sampleBufferSize);
-		sampleBuffer = PaUtil_AllocateMemory((long)sampleBufferSize);
-		if (sampleBuffer == nullptr)
+		DEBUG("creating writer wakeup pipe\n");
+		if (!openWakePipe(wakePipe))
 		{
-			FATAL("could not allocate memory for ring buffer\n");
+			FATAL("could not create writer wakeup pipe\n");
+		}
+		for (size_t i = 0; i < outputCount; ++i)
+		{
+			outputs[i].callbackData.wakeFd = wakePipe[1];
 		}
+		signalWakeFd = wakePipe[1];
+		
+		struct sigaction action = {};
+		action.sa_handler = requestTiming;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGUSR1, &action, nullptr);
 	}
 	
-	PaError error = paNoError;
-	CallbackData callbackData = {0};
-	if (result == 0)
+	int serverFd = -1;
+	bool serverIsFifo = false;
+	if (result == 0 && options.serverPath != nullptr)
 	{
-		PaUtil_InitializeRingBuffer(&callbackData.ringBuffer, frameSize, ringBufferSize, sampleBuffer);
-		if (options.sampleFormat == paUInt8)
+		DEBUG("opening server at %s\n", options.serverPath);
+		serverFd = openListener(options.serverPath, serverIsFifo);
+		if (serverFd < 0)
 		{
-			// center is zero for all formats except unsigned 8-bit, where it is 128
-			callbackData.silenceByte = 0x80;
+			FATAL("could not serve on %s: %s\n", options.serverPath, strerror(errno));
 		}
-		
-		DEBUG("initializing PortAudio\n");
-		error = Pa_Initialize();
-		if (error != paNoError)
+		else
 		{
-			FATAL("could not initialize PortAudio: %s\n", Pa_GetErrorText(error));
+			INFO("serving on %s %s\n", serverIsFifo ? "FIFO" : "socket", options.serverPath);
 		}
 	}
 	
-	PaStreamParameters outputParams = {0};
-	if (result == 0)
+	int networkFd = -1;
+	if (result == 0 && options.networkAddress != nullptr)
 	{
-		DEBUG("getting default output device\n");
-		outputParams.device = Pa_GetDefaultOutputDevice();
-		if (outputParams.device == paNoDevice)
+		DEBUG("opening receiver at %s\n", options.networkAddress);
+		networkFd = openReceiver(options);
+		if (networkFd < 0)
 		{
-			FATAL("could not detect default output device\n");
+			result = 1;
+		}
+		else
+		{
+			INFO("receiving RTP on %s\n", options.networkAddress);
 		}
-		INFO("default output device is %d\n", outputParams.device);
 	}
 	
-	PaStream* stream = nullptr;
-	if (result == 0)
+	if (serverFd != -1 || networkFd != -1)
+	{
+		// neither ever sees the end of its input, so these are how they're told to stop
+		struct sigaction action = {};
+		action.sa_handler = requestStop;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGINT, &action, nullptr);
+		sigaction(SIGTERM, &action, nullptr);
+	}
+	
+	for (size_t i = 0; i < outputCount && result == 0 && !rendering; ++i)
 	{
+		Output& output = outputs[i];
+		PaStreamParameters outputParams = {0};
+		outputParams.device = output.device;
 		outputParams.channelCount = options.channels;
 		outputParams.sampleFormat = options.sampleFormat;
-		outputParams.suggestedLatency = Pa_GetDeviceInfo(outputParams.device)->defaultLowOutputLatency;
+		outputParams.suggestedLatency = options.suggestedLatency >= 0.0 ? options.suggestedLatency : Pa_GetDeviceInfo(outputParams.device)->defaultLowOutputLatency;
+		
+		HostApiSetup hostApiSetup;
+		setupHostApi(options, output.device, hostApiSetup);
+		outputParams.hostApiSpecificStreamInfo = hostApiSetup.streamInfo;
 		
-		DEBUG("opening %d-channel %s %zu-bit %s %gHz stream with buffer size %zu frames (%zu bytes), flags %lu\n",
+		DEBUG("opening %d-channel %s %zu-bit %s %gHz stream on device %d with buffer size %zu frames (%zu bytes), suggested latency %gms, flags %lu\n",
 			outputParams.channelCount,
 			options.sampleFormat == paUInt8 ? "unsigned" : "signed",
 			options.sampleSize * CHAR_BIT,
 			options.sampleFormat == paFloat32 ? "float" : "integer",
-			options.sampleRate,
+			streamRate,
+			outputParams.device,
 			options.framesPerBuffer,
 			options.framesPerBuffer * frameSize,
+			outputParams.suggestedLatency * 1000.0,
 			options.streamFlags
 		);
 		error = Pa_OpenStream(
-			&stream,
+			&output.stream,
 			nullptr,
 			&outputParams,
-			options.sampleRate,
+			streamRate,
 			options.framesPerBuffer,
 			options.streamFlags,
-			streamCallback,
-			&callbackData
+			options.engine == kEngineCallback ? (mixInputCount > 0 ? mixCallback : streamCallback) : nullptr,
+			options.engine == kEngineCallback ? &output.callbackData : nullptr
 		);
 		if (error != paNoError)
 		{
 			FATAL("could not open stream: %s\n", Pa_GetErrorText(error));
 		}
+		else
+		{
+			// the host API is free to round the suggestion to whatever it can actually do
+			const PaStreamInfo* streamInfo = Pa_GetStreamInfo(output.stream);
+			if (streamInfo != nullptr)
+			{
+				INFO("stream on device %d has output latency %gms\n", output.device, streamInfo->outputLatency * 1000.0);
+			}
+			
+#if defined(PIPEPLAYER_ALSA)
+			if (hostApiSetup.realtimeScheduling)
+			{
+				PaAlsa_EnableRealtimeScheduling(output.stream, 1);
+			}
+#endif
+		}
+		
+		if (result == 0 && options.engine == kEngineCallback)
+		{
+			error = Pa_SetStreamFinishedCallback(output.stream, streamFinished);
+			if (error != paNoError)
+			{
+				FATAL("could not set stream finished callback: %s\n", Pa_GetErrorText(error));
+			}
+		}
 	}
-	
+	stopFastOpen(fastOpen);	// the writer's from here
 	if (result == 0)
 	{
-		DEBUG("starting stream: Hope you hear a pop.\n");
-		error = Pa_StartStream(stream);
-		if (error != paNoError)
+		markStartup(profile, kStartupStreams);
+	}
+	
+	// gain commands come in on a thread of their own, so they work the same whichever
+	// writer is running
+	ControlInput controlInput = {};
+	controlInput.fd = -1;
+	int controlStopPipe[2] = { -1, -1 };
+	std::thread controlThread;
+	if (result == 0 && options.controlPath != nullptr)
+	{
+		DEBUG("opening control channel at %s\n", options.controlPath);
+		controlInput.fd = openListener(options.controlPath, controlInput.isFifo);
+		if (controlInput.fd < 0)
+		{
+			FATAL("could not take control commands on %s: %s\n", options.controlPath, strerror(errno));
+		}
+		else if (pipe(controlStopPipe) != 0)
+		{
+			FATAL("could not create control stop pipe\n");
+		}
+		else
 		{
-			FATAL("could not start stream: %s\n", Pa_GetErrorText(error));
+			controlInput.options = &options;
+			controlInput.stopFd = controlStopPipe[0];
+			controlInput.controlCount = outputCount;
+			for (size_t i = 0; i < outputCount; ++i)
+			{
+				controlInput.controls[i] = &gainControls[i];
+			}
+			controlInput.sampleRate = streamRate;
+			controlInput.gain = 1.0f;
+			controlThread = std::thread(runControlThread, &controlInput);
+			INFO("taking control commands on %s %s\n", controlInput.isFifo ? "FIFO" : "socket", options.controlPath);
 		}
 	}
 	
+	if (result == 0 && options.writerPriority > 0)
+	{
+		raiseWriterPriority(options);
+	}
+	
 	if (result == 0)
 	{
-		std::chrono::duration<double> frameTime(options.framesPerBuffer / options.sampleRate);
-		std::chrono::duration<double> sleepTime(frameTime / 2.0);
-		std::chrono::duration<double> timeout(options.timeout);
-		
-		std::chrono::time_point<std::chrono::high_resolution_clock> now = std::chrono::high_resolution_clock::now();
-		std::chrono::time_point<std::chrono::high_resolution_clock> then = now;
-		
-		DEBUG("entering main loop with a sleep time of %lldms and timeout of %gs\n",
-			std::chrono::duration_cast<std::chrono::milliseconds>(sleepTime).count(),
-			timeout.count());
-		
-		size_t byteIndex = 0;
-		bool stdinOpen = true;
-		while (stdinOpen && (now - then) < timeout && (error = Pa_IsStreamActive(stream)) == 1)
+		markStartup(profile, kStartupWriter);
+		if (rendering)
 		{
-			bool canGetByte = true;
-			ring_buffer_size_t framesAvailable = PaUtil_GetRingBufferWriteAvailable(&callbackData.ringBuffer);
-			if (framesAvailable == callbackData.ringBuffer.bufferSize)
+			result = runRender(options, outputs[0], ringBuffer, ingest, clipped ? &clipInput : nullptr, inputTee, compressed ? &decoder : nullptr, decoderInput, mixInputs, mixInputCount, wakePipe[0]);
+			if (options.verbosity >= 3)
 			{
-				WARN("ring buffer starved!\n");
+				printOutputTiming(outputs, outputCount);
 			}
-			while (canGetByte && framesAvailable > 0 && byteIndex < frameSize)
+		}
+		else if (options.engine == kEngineBlocking)
+		{
+			result = runBlockingWriter(options, outputs[0].stream, (uint8_t*)sampleBuffer, ringBufferSize, ingest, inputTee, prefillFrames, outputs[0].stats, wakePipe[0]);
+		}
+		else if (mixInputCount > 0)
+		{
+			result = runMixWriter(options, outputs[0].stream, outputs[0].callbackData, mixInputs, mixInputCount, wakePipe[0], prefillFrames);
+			if (options.verbosity >= 3)
 			{
-				switch (stdinReady())
-				{
-					case -1:
-						FATAL("error when checking input pipe\n");
-						break;
-					case 0:
-						WARN("can't get bytes anymore\n");
-						canGetByte = false;
-						break;
-					default:
-						stdinOpen = read(STDIN_FILENO, &pipeBuffer[byteIndex++], 1) > 0;	// stage our data, but also check for EOF
-						if (byteIndex == frameSize)
-						{
-							PaUtil_WriteRingBuffer(&callbackData.ringBuffer, pipeBuffer, 1);	// because we can't read() directly into the ring buffer
-							--framesAvailable;
-							byteIndex = 0;
-						}
-						then = now;	// reset our timeout timer after we successfully read from stdin
-						break;
-				}
+				printOutputTiming(outputs, outputCount);
 			}
-			
-			std::this_thread::sleep_for(sleepTime);
-			now = std::chrono::high_resolution_clock::now();
 		}
-		
-		if (stdinOpen && (now - then) < timeout)
+		else if (networkFd != -1)
+		{
+			result = runNetworkWriter(options, outputs, outputCount, ringBuffer, ingest, networkFd, wakePipe[0], prefillFrames);
+			if (options.verbosity >= 3)
+			{
+				printOutputTiming(outputs, outputCount);
+			}
+		}
+		else if (serverFd != -1)
 		{
-			INFO("timed out waiting for input pipe\n");
+			result = runServer(options, outputs, outputCount, ringBuffer, ingest, serverFd, serverIsFifo, wakePipe[0]);
+			if (options.verbosity >= 3)
+			{
+				printOutputTiming(outputs, outputCount);
+			}
 		}
-		else if (!stdinOpen)
+		else if (compressed)
 		{
-			INFO("input pipe closed\n");
+			result = runDecoderWriter(options, outputs, outputCount, ringBuffer, ingest, decoder, decoderInput, wakePipe[0], prefillFrames);
+			if (options.verbosity >= 3)
+			{
+				printOutputTiming(outputs, outputCount);
+			}
 		}
-		
-		if (error < 0)
+		else if (mappedInput.base != nullptr)
+		{
+			result = runMappedWriter(options, outputs[0].stream, outputs[0].callbackData, mappedInput, wakePipe[0]);
+			if (options.verbosity >= 3)
+			{
+				printOutputTiming(outputs, outputCount);
+			}
+		}
+		else
 		{
-			FATAL("stream unexpectedly stopped: %s\n", Pa_GetErrorText(error));
+			result = runCallbackWriter(options, outputs, outputCount, ringBuffer, ingest, clipped ? &clipInput : nullptr, inputTee, STDIN_FILENO, wakePipe[0], prefillFrames, false);
+			if (options.verbosity >= 3)
+			{
+				printOutputTiming(outputs, outputCount);
+			}
 		}
 	}
 	
-	if (stream != nullptr)
+	if (result == 0 && options.drain && !rendering)
 	{
-		DEBUG("closing stream\n");
-		error = Pa_CloseStream(stream);
-		if (error != paNoError)
+		result = drainOutputs(options, outputs, outputCount, wakePipe[0]);
+	}
+	
+	if (options.profileStartup)
+	{
+		printStartupProfile(profile, outputs, outputCount);
+	}
+	
+	for (size_t i = 0; i < outputCount; ++i)
+	{
+		if (outputs[i].stream != nullptr)
+		{
+			DEBUG("closing stream\n");
+			error = Pa_CloseStream(outputs[i].stream);
+			if (error != paNoError)
+			{
+				ERROR("could not close stream: %s\n", Pa_GetErrorText(error));
+			}
+		}
+	}
+	
+	if (!rendering)
+	{
+		DEBUG("terminating PortAudio\n");
+		Pa_Terminate();
+	}
+	
+	if (controlThread.joinable())
+	{
+		DEBUG("stopping control thread\n");
+		close(controlStopPipe[1]);	// hanging up wakes it
+		controlThread.join();
+		close(controlStopPipe[0]);
+	}
+	if (controlInput.fd != -1)
+	{
+		DEBUG("closing control channel\n");
+		close(controlInput.fd);
+		if (!controlInput.isFifo)
+		{
+			unlink(options.controlPath);
+		}
+	}
+	for (size_t i = 0; i < outputCount; ++i)
+	{
+		if (gainControls[i].buffer != nullptr)
+		{
+			PaUtil_FreeMemory(gainControls[i].buffer);
+		}
+	}
+	
+	if (serverFd != -1 || networkFd != -1)
+	{
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+	}
+	if (serverFd != -1)
+	{
+		DEBUG("closing server\n");
+		close(serverFd);
+		if (!serverIsFifo)
+		{
+			unlink(options.serverPath);
+		}
+	}
+	if (networkFd != -1)
+	{
+		DEBUG("closing receiver\n");
+		close(networkFd);
+	}
+	
+	if (inputTee != nullptr)
+	{
+		DEBUG("closing tee\n");
+		closeTee(tee);
+		signal(SIGPIPE, SIG_DFL);
+		if (tee.error != 0)
 		{
-			ERROR("could not close stream: %s\n", Pa_GetErrorText(error));
+			WARN("teeing input to %s stopped early: %s\n", options.teePath, strerror(tee.error));
 		}
+		if (tee.drops > 0)
+		{
+			WARN("tee to %s couldn't keep up, and dropped %llu bytes of input in %lu drop(s)\n", options.teePath, (unsigned long long)tee.bytesDropped, tee.drops);
+		}
+		INFO("teed %llu bytes of input to %s, %llu of them copied\n",
+			(unsigned long long)(tee.bytesTeed + tee.bytesCopied),
+			options.teePath,
+			(unsigned long long)tee.bytesCopied);
+	}
+	
+	if (fastOpen.stopPipe[0] != -1)
+	{
+		DEBUG("closing fast open stop pipe\n");
+		closeWakePipe(fastOpen.stopPipe);
 	}
 	
-	DEBUG("terminating PortAudio\n");
-	Pa_Terminate();
+	if (wakePipe[0] != -1)
+	{
+		DEBUG("closing writer wakeup pipe\n");
+		signal(SIGUSR1, SIG_DFL);
+		signalWakeFd = -1;
+		closeWakePipe(wakePipe);
+	}
 	
 	if (sampleBuffer != nullptr)
 	{
 		DEBUG("freeing ring buffer\n");
-		PaUtil_FreeMemory(sampleBuffer);
+		freeRingMemory(sampleBuffer, sampleBufferSize);
+	}
+	
+	if (silenceBuffer != nullptr)
+	{
+		DEBUG("freeing silence buffer\n");
+		PaUtil_FreeMemory(silenceBuffer);
+	}
+	
+	if (mappedInput.base != nullptr)
+	{
+		DEBUG("unmapping input file\n");
+		munmap(mappedInput.base, mappedInput.size);
+	}
+	
+	if (decoder.state != nullptr)
+	{
+		DEBUG("closing %s decoder\n", codecName(decoder.codec));
+		closeDecoder(decoder);
+	}
+	
+	freeIngest(options, ingest);
+	
+	for (size_t i = 0; i < mixInputCount; ++i)
+	{
+		MixInput& input = mixInputs[i];
+		if (input.fd > STDIN_FILENO)
+		{
+			close(input.fd);
+		}
+		if (input.ringMemory != nullptr)
+		{
+			freeRingMemory(input.ringMemory, ringBufferSize * input.channels * sizeof(float));
+		}
+		freeIngest(options, input.ingest);
 	}
 	
-	if (pipeBuffer != nullptr)
+	if (mixBuffer != nullptr)
 	{
-		DEBUG("freeing pipe buffer\n");
-		free(pipeBuffer);
+		DEBUG("freeing mix buffer\n");
+		PaUtil_FreeMemory(mixBuffer);
 	}
 	
 	return result;
@@ -0,0 +1,448 @@
+/* remap.cpp
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "remap.h"
+
+#include <cstdint>		// int32_t, uint8_t
+#include <cstdlib>		// strtof, strtol
+#include <cstring>		// strcmp
+
+#include "simd.h"
+
+// vector kernels for the matrix, for output channel counts that either fill whole vectors
+// a frame at a time or pack evenly into one several frames at a time; each returns how
+// many frames it handled, leaving the rest to the scalar loop
+
+#if PIPEPLAYER_AVX2
+
+static
+size_t remapVector(const ChannelMap& map, const float* input, float* output, size_t frames)
+{
+	const int inputChannels = map.inputChannels;
+	const int outputChannels = map.outputChannels;
+	size_t f = 0;
+	if (outputChannels % 8 == 0)
+	{
+		for (; f < frames; ++f)
+		{
+			const float* in = input + f * inputChannels;
+			float* out = output + f * outputChannels;
+			for (int o = 0; o < outputChannels; o += 8)
+			{
+				__m256 sum = _mm256_setzero_ps();
+				for (int i = 0; i < inputChannels; ++i)
+				{
+					sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_broadcast_ss(in + i), _mm256_loadu_ps(&map.columns[i][o])));
+				}
+				_mm256_storeu_ps(out + o, sum);
+			}
+		}
+	}
+	else if (8 % outputChannels == 0)
+	{
+		// each lane gathers its input channel from the frame its output channel belongs to
+		const size_t group = 8 / outputChannels;
+		int32_t offsets[8];
+		for (int k = 0; k < 8; ++k)
+		{
+			offsets[k] = (k / outputChannels) * inputChannels;
+		}
+		const __m256i index = _mm256_loadu_si256((const __m256i*)offsets);
+		for (; f + group <= frames; f += group)
+		{
+			const float* in = input + f * inputChannels;
+			__m256 sum = _mm256_setzero_ps();
+			for (int i = 0; i < inputChannels; ++i)
+			{
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_i32gather_ps(in + i, index, sizeof(float)), _mm256_loadu_ps(map.tiles[i])));
+			}
+			_mm256_storeu_ps(output + f * outputChannels, sum);
+		}
+	}
+	return f;
+}
+
+#elif PIPEPLAYER_SSE2
+
+static inline
+__m128 groupSamples(const float* in, int channel, int inputChannels, size_t group)
+{
+	// input channel from each of group frames, spread over as many lanes as it has outputs
+	const float* s = in + channel;
+	if (group == 2)
+	{
+		return _mm_set_ps(s[inputChannels], s[inputChannels], s[0], s[0]);
+	}
+	return _mm_set_ps(s[3 * inputChannels], s[2 * inputChannels], s[inputChannels], s[0]);
+}
+
+static
+size_t remapVector(const ChannelMap& map, const float* input, float* output, size_t frames)
+{
+	const int inputChannels = map.inputChannels;
+	const int outputChannels = map.outputChannels;
+	size_t f = 0;
+	if (outputChannels % 4 == 0)
+	{
+		for (; f < frames; ++f)
+		{
+			const float* in = input + f * inputChannels;
+			float* out = output + f * outputChannels;
+			for (int o = 0; o < outputChannels; o += 4)
+			{
+				__m128 sum = _mm_setzero_ps();
+				for (int i = 0; i < inputChannels; ++i)
+				{
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(in[i]), _mm_loadu_ps(&map.columns[i][o])));
+				}
+				_mm_storeu_ps(out + o, sum);
+			}
+		}
+	}
+	else if (4 % outputChannels == 0)
+	{
+		const size_t group = 4 / outputChannels;
+		for (; f + group <= frames; f += group)
+		{
+			const float* in = input + f * inputChannels;
+			__m128 sum = _mm_setzero_ps();
+			for (int i = 0; i < inputChannels; ++i)
+			{
+				sum = _mm_add_ps(sum, _mm_mul_ps(groupSamples(in, i, inputChannels, group), _mm_loadu_ps(map.tiles[i])));
+			}
+			_mm_storeu_ps(output + f * outputChannels, sum);
+		}
+	}
+	return f;
+}
+
+#elif PIPEPLAYER_NEON
+
+static inline
+float32x4_t groupSamples(const float* in, int channel, int inputChannels, size_t group)
+{
+	// input channel from each of group frames, spread over as many lanes as it has outputs
+	const float* s = in + channel;
+	if (group == 2)
+	{
+		return vcombine_f32(vdup_n_f32(s[0]), vdup_n_f32(s[inputChannels]));
+	}
+	float32x4_t samples = vdupq_n_f32(s[0]);
+	samples = vsetq_lane_f32(s[inputChannels], samples, 1);
+	samples = vsetq_lane_f32(s[2 * inputChannels], samples, 2);
+	return vsetq_lane_f32(s[3 * inputChannels], samples, 3);
+}
+
+static
+size_t remapVector(const ChannelMap& map, const float* input, float* output, size_t frames)
+{
+	const int inputChannels = map.inputChannels;
+	const int outputChannels = map.outputChannels;
+	size_t f = 0;
+	if (outputChannels % 4 == 0)
+	{
+		for (; f < frames; ++f)
+		{
+			const float* in = input + f * inputChannels;
+			float* out = output + f * outputChannels;
+			for (int o = 0; o < outputChannels; o += 4)
+			{
+				float32x4_t sum = vdupq_n_f32(0.0f);
+				for (int i = 0; i < inputChannels; ++i)
+				{
+					sum = vfmaq_n_f32(sum, vld1q_f32(&map.columns[i][o]), in[i]);
+				}
+				vst1q_f32(out + o, sum);
+			}
+		}
+	}
+	else if (4 % outputChannels == 0)
+	{
+		const size_t group = 4 / outputChannels;
+		for (; f + group <= frames; f += group)
+		{
+			const float* in = input + f * inputChannels;
+			float32x4_t sum = vdupq_n_f32(0.0f);
+			for (int i = 0; i < inputChannels; ++i)
+			{
+				sum = vfmaq_f32(sum, groupSamples(in, i, inputChannels, group), vld1q_f32(map.tiles[i]));
+			}
+			vst1q_f32(output + f * outputChannels, sum);
+		}
+	}
+	return f;
+}
+
+#else
+
+static
+size_t remapVector(const ChannelMap& map, const float* input, float* output, size_t frames)
+{
+	return 0;
+}
+
+#endif
+
+static
+void setDownmix(ChannelMap& map, const int* left, const int* right, int count)
+{
+	// the usual downmix to stereo: each side's front, plus the center and each of its
+	// surrounds at -3dB, leaving out the LFE; scaled so a full-scale input can't clip
+	const float kMinus3dB = 0.70710678f;
+	map.outputChannels = 2;
+	map.gains[0][left[0]] = map.gains[1][right[0]] = 1.0f;
+	for (int i = 1; i < count; ++i)
+	{
+		map.gains[0][left[i]] = map.gains[1][right[i]] = kMinus3dB;
+	}
+	
+	float scale = 1.0f / (1.0f + (count - 1) * kMinus3dB);
+	for (int o = 0; o < 2; ++o)
+	{
+		for (int i = 0; i < map.inputChannels; ++i)
+		{
+			map.gains[o][i] *= scale;
+		}
+	}
+}
+
+static
+bool parseMatrix(ChannelMap& map, const char* spec)
+{
+	const char* p = spec;
+	for (int o = 0; ; ++o)
+	{
+		if (o == kMaxMapChannels)
+		{
+			return false;
+		}
+		
+		for (;;)
+		{
+			// a term is a channel index, or a gain, a '*' and a channel index
+			char* end = nullptr;
+			float gain = strtof(p, &end);
+			if (end == p)
+			{
+				return false;
+			}
+			if (*end == '*')
+			{
+				p = end + 1;
+			}
+			else
+			{
+				gain = 1.0f;
+			}
+			
+			long channel = strtol(p, &end, 10);
+			if (end == p || channel < 0 || channel >= map.inputChannels)
+			{
+				return false;
+			}
+			map.gains[o][channel] += gain;
+			p = end;
+			if (*p != '+')
+			{
+				break;
+			}
+			++p;
+		}
+		
+		if (*p == '\0')
+		{
+			map.outputChannels = o + 1;
+			return true;
+		}
+		else if (*p != ',')
+		{
+			return false;
+		}
+		++p;
+	}
+}
+
+static
+void finishMap(ChannelMap& map)
+{
+	// works out the rest of what's in a ChannelMap from its gains
+	int inputChannels = map.inputChannels;
+	map.permutation = true;
+	for (int o = 0; o < map.outputChannels; ++o)
+	{
+		int nonzero = 0;
+		for (int i = 0; i < inputChannels; ++i)
+		{
+			map.columns[i][o] = map.gains[o][i];
+			if (map.gains[o][i] != 0.0f)
+			{
+				map.sources[o] = i;
+				++nonzero;
+			}
+		}
+		if (nonzero != 1 || map.gains[o][map.sources[o]] != 1.0f)
+		{
+			map.permutation = false;
+		}
+	}
+	for (int i = 0; i < inputChannels; ++i)
+	{
+		for (int k = 0; k < kMapLanes; ++k)
+		{
+			map.tiles[i][k] = map.gains[k % map.outputChannels][i];
+		}
+	}
+}
+
+bool parseChannelMap(ChannelMap& map, const char* spec, int inputChannels)
+{
+	map = ChannelMap();
+	if (inputChannels < 1 || inputChannels > kMaxMapChannels)
+	{
+		return false;
+	}
+	map.inputChannels = inputChannels;
+	
+	// the presets take their layouts in WAV channel order
+	if (strcmp(spec, "5.1") == 0)
+	{
+		// FL FR FC LFE SL SR
+		const int left[] = { 0, 2, 4 };
+		const int right[] = { 1, 2, 5 };
+		if (inputChannels != 6)
+		{
+			return false;
+		}
+		setDownmix(map, left, right, 3);
+	}
+	else if (strcmp(spec, "7.1") == 0)
+	{
+		// FL FR FC LFE BL BR SL SR
+		const int left[] = { 0, 2, 4, 6 };
+		const int right[] = { 1, 2, 5, 7 };
+		if (inputChannels != 8)
+		{
+			return false;
+		}
+		setDownmix(map, left, right, 4);
+	}
+	else if (strcmp(spec, "mono") == 0)
+	{
+		map.outputChannels = 1;
+		for (int i = 0; i < inputChannels; ++i)
+		{
+			map.gains[0][i] = 1.0f / inputChannels;
+		}
+	}
+	else if (!parseMatrix(map, spec))
+	{
+		return false;
+	}
+	finishMap(map);
+	return true;
+}
+
+bool fitChannelMap(ChannelMap& map, int inputChannels, int outputChannels)
+{
+	map = ChannelMap();
+	if (inputChannels < 1 || inputChannels > kMaxMapChannels || outputChannels < 1 || outputChannels > kMaxMapChannels)
+	{
+		return false;
+	}
+	if (outputChannels == 2 && (inputChannels == 6 || inputChannels == 8))
+	{
+		return parseChannelMap(map, inputChannels == 6 ? "5.1" : "7.1", inputChannels);
+	}
+	if (outputChannels == 1)
+	{
+		return parseChannelMap(map, "mono", inputChannels);
+	}
+	
+	map.inputChannels = inputChannels;
+	map.outputChannels = outputChannels;
+	for (int o = 0; o < outputChannels; ++o)
+	{
+		if (inputChannels == 1 || o < inputChannels)
+		{
+			map.gains[o][inputChannels == 1 ? 0 : o] = 1.0f;
+		}
+	}
+	finishMap(map);
+	return true;
+}
+
+
+void remapFloat(const ChannelMap& map, const float* input, float* output, size_t frames)
+{
+	for (size_t f = remapVector(map, input, output, frames); f < frames; ++f)
+	{
+		const float* in = input + f * map.inputChannels;
+		float* out = output + f * map.outputChannels;
+		for (int o = 0; o < map.outputChannels; ++o)
+		{
+			float sum = 0.0f;
+			for (int i = 0; i < map.inputChannels; ++i)
+			{
+				sum += map.gains[o][i] * in[i];
+			}
+			out[o] = sum;
+		}
+	}
+}
+
+template<size_t kSize>
+struct Sample
+{
+	uint8_t bytes[kSize];
+};
+
+template<size_t kSize>
+static
+void permuteSamples(const ChannelMap& map, const void* input, void* output, size_t frames)
+{
+	// sized copies the compiler can do in a register, rather than memcpy per sample
+	const Sample<kSize>* in = (const Sample<kSize>*)input;
+	Sample<kSize>* out = (Sample<kSize>*)output;
+	for (size_t f = 0; f < frames; ++f)
+	{
+		for (int o = 0; o < map.outputChannels; ++o)
+		{
+			out[o] = in[map.sources[o]];
+		}
+		in += map.inputChannels;
+		out += map.outputChannels;
+	}
+}
+
+void remapSamples(const ChannelMap& map, const void* input, void* output, size_t frames, size_t sampleSize)
+{
+	switch (sampleSize)
+	{
+		case 1:
+			permuteSamples<1>(map, input, output, frames);
+			break;
+		case 2:
+			permuteSamples<2>(map, input, output, frames);
+			break;
+		case 3:
+			permuteSamples<3>(map, input, output, frames);
+			break;
+		case 4:
+			permuteSamples<4>(map, input, output, frames);
+			break;
+	}
+}
@@ -0,0 +1,63 @@
+/* remap.h
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPEPLAYER_REMAP_H
+#define PIPEPLAYER_REMAP_H
+
+#include <cstddef>		// size_t
+
+static const int kMaxMapChannels = 32;
+static const int kMapLanes = 8;	// the widest vector the kernels use, in floats
+
+// a matrix making each output channel a weighted sum of the input's channels, for picking,
+// reordering, or downmixing channels before the device sees them
+struct ChannelMap
+{
+	int inputChannels;
+	int outputChannels;
+	float gains[kMaxMapChannels][kMaxMapChannels];	// [output][input]
+	
+	// when every output channel is an input channel just as it is, sources says which, and
+	// the samples can be moved around in whatever format they're in without any arithmetic
+	bool permutation;
+	int sources[kMaxMapChannels];
+	
+	// the gains again, laid out for the vector kernels: each input channel's gains into every
+	// output channel, and the same repeated across kMapLanes for outputs narrower than that
+	float columns[kMaxMapChannels][kMaxMapChannels];	// [input][output]
+	float tiles[kMaxMapChannels][kMapLanes];			// [input][lane]
+};
+
+// spec is a preset (5.1 or 7.1 for a downmix of that layout to stereo, or mono for an even
+// downmix of anything) or a comma-separated list of output channels, each a +-separated sum
+// of input channel indices from zero, optionally as gain*index; returns false if spec is
+// malformed or doesn't fit inputChannels
+bool parseChannelMap(ChannelMap& map, const char* spec, int inputChannels);
+
+// a map for input that just has a different number of channels than the output: mono goes
+// to every channel, anything goes to mono as an even downmix and 5.1 or 7.1 to stereo as
+// their presets do, and otherwise channels stay in order, with any extra outputs silent
+bool fitChannelMap(ChannelMap& map, int inputChannels, int outputChannels);
+
+// make frames of map.outputChannels out of frames of map.inputChannels; the buffers may not
+// overlap, and neither needs any particular alignment
+void remapFloat(const ChannelMap& map, const float* input, float* output, size_t frames);
+
+// only for a permutation, but works on samples of any format sampleSize bytes long
+void remapSamples(const ChannelMap& map, const void* input, void* output, size_t frames, size_t sampleSize);
+
+#endif
@@ -0,0 +1,288 @@
+/* resample.cpp
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "resample.h"
+
+#include <algorithm>	// std::max, std::min
+#include <cmath>		// ceil, floor, sin, sqrt
+#include <cstdlib>		// free, malloc
+#include <cstring>		// memmove, memset
+
+#include "simd.h"
+
+struct QualitySetup
+{
+	int taps;				// at unity ratio; downsampling stretches this to hold the transition band
+	int phases;
+	double beta;			// Kaiser window shape
+	double rolloff;			// passband edge as a fraction of the output Nyquist frequency
+};
+
+static const QualitySetup kQualitySetups[] =
+{
+	{ 0, 0, 0.0, 0.0 },		// kResampleOff
+	{ 8, 64, 5.0, 0.85 },
+	{ 16, 128, 6.0, 0.90 },
+	{ 32, 256, 8.0, 0.94 },
+	{ 64, 512, 9.5, 0.97 },
+};
+
+static const int kMaxTaps = 512;
+
+static
+double besselI0(double x)
+{
+	// the power series converges quickly for the betas we use
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 50; ++k)
+	{
+		const double factor = x / (2.0 * k);
+		term *= factor * factor;
+		sum += term;
+		if (term < sum * 1e-12)
+		{
+			break;
+		}
+	}
+	return sum;
+}
+
+static
+double windowedSinc(double distance, double cutoff, double halfWidth, double beta)
+{
+	const double kPi = 3.14159265358979323846;
+	const double t = distance / halfWidth;
+	if (t <= -1.0 || t >= 1.0)
+	{
+		return 0.0;
+	}
+	const double x = kPi * cutoff * distance;
+	const double sinc = (x == 0.0) ? 1.0 : sin(x) / x;
+	return cutoff * sinc * besselI0(beta * sqrt(1.0 - t * t)) / besselI0(beta);
+}
+
+#if PIPEPLAYER_AVX2
+
+static
+float dotProduct(const float* a, const float* b, int count)
+{
+	__m256 sum = _mm256_setzero_ps();
+	for (int i = 0; i < count; i += 8)
+	{
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+	}
+	__m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+	half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+	half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+	return _mm_cvtss_f32(half);
+}
+
+#elif PIPEPLAYER_SSE2
+
+static
+float dotProduct(const float* a, const float* b, int count)
+{
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+	for (int i = 0; i < count; i += 8)
+	{
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+	__m128 sum = _mm_add_ps(sum0, sum1);
+	sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+	sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+	return _mm_cvtss_f32(sum);
+}
+
+#elif PIPEPLAYER_NEON
+
+static
+float dotProduct(const float* a, const float* b, int count)
+{
+	float32x4_t sum0 = vdupq_n_f32(0.0f);
+	float32x4_t sum1 = vdupq_n_f32(0.0f);
+	for (int i = 0; i < count; i += 8)
+	{
+		sum0 = vfmaq_f32(sum0, vld1q_f32(a + i), vld1q_f32(b + i));
+		sum1 = vfmaq_f32(sum1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+	}
+	return vaddvq_f32(vaddq_f32(sum0, sum1));
+}
+
+#else
+
+static
+float dotProduct(const float* a, const float* b, int count)
+{
+	float sum = 0.0f;
+	for (int i = 0; i < count; ++i)
+	{
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+#endif
+
+bool initResampler(Resampler& resampler, int channels, double inputRate, double outputRate,
+	ResampleQuality quality, size_t maxInputFrames)
+{
+	const QualitySetup& setup = kQualitySetups[quality];
+	const double cutoff = std::min(1.0, outputRate / inputRate) * setup.rolloff;
+	
+	// keep the transition band the same width in output terms when downsampling, and round
+	// up to whole vectors so the dot product never needs a tail
+	int taps = outputRate < inputRate ? (int)ceil(setup.taps * inputRate / outputRate) : setup.taps;
+	taps = std::min((taps + 7) & ~7, kMaxTaps);
+	
+	resampler.channels = channels;
+	resampler.step = inputRate / outputRate;
+	resampler.taps = taps;
+	resampler.phases = setup.phases;
+	resampler.historyFrames = maxInputFrames + taps;
+	resampler.filter = (float*)malloc(sizeof(float) * (setup.phases + 1) * taps);
+	resampler.kernel = (float*)malloc(sizeof(float) * taps);
+	resampler.history = (float*)malloc(sizeof(float) * resampler.historyFrames * channels);
+	if (resampler.filter == nullptr || resampler.kernel == nullptr || resampler.history == nullptr)
+	{
+		freeResampler(resampler);
+		return false;
+	}
+	
+	// row p holds the taps for an output frame p / phases of the way past an input frame, the
+	// tap at index half - 1 being that input frame itself; each row is normalized to unity
+	// gain at DC so interpolating between rows can't introduce ripple of its own
+	const int half = taps / 2;
+	for (int p = 0; p <= setup.phases; ++p)
+	{
+		float* row = resampler.filter + p * taps;
+		const double fraction = (double)p / setup.phases;
+		double sum = 0.0;
+		for (int i = 0; i < taps; ++i)
+		{
+			const double coefficient = windowedSinc(i - (half - 1) - fraction, cutoff, half, setup.beta);
+			row[i] = (float)coefficient;
+			sum += coefficient;
+		}
+		for (int i = 0; i < taps; ++i)
+		{
+			row[i] = (float)(row[i] / sum);
+		}
+	}
+	
+	// prime the history with silence so the first output frame lines up with the first input
+	memset(resampler.history, 0, sizeof(float) * resampler.historyFrames * channels);
+	resampler.frames = half - 1;
+	resampler.position = half - 1;
+	return true;
+}
+
+void freeResampler(Resampler& resampler)
+{
+	free(resampler.filter);
+	free(resampler.kernel);
+	free(resampler.history);
+	resampler.filter = nullptr;
+	resampler.kernel = nullptr;
+	resampler.history = nullptr;
+}
+
+size_t resamplerInputSpace(Resampler& resampler)
+{
+	// slide out whatever input no future output frame can reach
+	const size_t oldest = (size_t)floor(resampler.position) - (resampler.taps / 2 - 1);
+	const size_t drop = std::min(oldest, resampler.frames);
+	if (drop > 0)
+	{
+		const size_t keep = resampler.frames - drop;
+		for (int c = 0; c < resampler.channels; ++c)
+		{
+			float* row = resampler.history + c * resampler.historyFrames;
+			memmove(row, row + drop, sizeof(float) * keep);
+		}
+		resampler.frames = keep;
+		resampler.position -= drop;
+	}
+	return resampler.historyFrames - resampler.frames;
+}
+
+size_t resamplerInputNeeded(const Resampler& resampler, size_t outputFrames)
+{
+	// the last of the output frames needs input up to half its filter past where it falls
+	if (outputFrames == 0)
+	{
+		return 0;
+	}
+	const size_t newest = (size_t)floor(resampler.position + (outputFrames - 1) * resampler.step) + resampler.taps / 2;
+	return newest >= resampler.frames ? newest + 1 - resampler.frames : 0;
+}
+
+size_t resamplerWrite(Resampler& resampler, const float* input, size_t frames)
+{
+	frames = std::min(frames, resamplerInputSpace(resampler));
+	const int channels = resampler.channels;
+	for (int c = 0; c < channels; ++c)
+	{
+		float* row = resampler.history + c * resampler.historyFrames + resampler.frames;
+		for (size_t i = 0; i < frames; ++i)
+		{
+			row[i] = input[i * channels + c];
+		}
+	}
+	resampler.frames += frames;
+	return frames;
+}
+
+size_t resamplerRead(Resampler& resampler, float* output, size_t frames)
+{
+	const int taps = resampler.taps;
+	const int half = taps / 2;
+	const int channels = resampler.channels;
+	size_t produced = 0;
+	while (produced < frames)
+	{
+		// the newest input frame this output frame needs is half frames past its base
+		const size_t base = (size_t)resampler.position;
+		if (base + half >= resampler.frames)
+		{
+			break;
+		}
+		
+		const double phase = (resampler.position - base) * resampler.phases;
+		const int index = (int)phase;
+		const float blend = (float)(phase - index);
+		const float* a = resampler.filter + index * taps;
+		const float* b = a + taps;
+		for (int i = 0; i < taps; ++i)
+		{
+			resampler.kernel[i] = a[i] + blend * (b[i] - a[i]);
+		}
+		
+		const size_t start = base - (half - 1);
+		for (int c = 0; c < channels; ++c)
+		{
+			const float* row = resampler.history + c * resampler.historyFrames + start;
+			output[produced * channels + c] = dotProduct(resampler.kernel, row, taps);
+		}
+		
+		resampler.position += resampler.step;
+		++produced;
+	}
+	return produced;
+}
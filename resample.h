@@ -0,0 +1,66 @@
+/* resample.h
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPEPLAYER_RESAMPLE_H
+#define PIPEPLAYER_RESAMPLE_H
+
+#include <cstddef>		// size_t
+
+enum ResampleQuality
+{
+	kResampleOff,
+	kResampleLow,
+	kResampleMedium,
+	kResampleHigh,
+	kResampleBest,
+};
+
+// a streaming polyphase windowed-sinc resampler over interleaved float frames; everything it
+// needs is allocated up front by initResampler, so writing and reading are safe on a hot path
+struct Resampler
+{
+	int channels;
+	double step;			// input frames per output frame
+	int taps;				// filter length, a multiple of 8
+	int phases;				// filter rows per input frame; we interpolate between adjacent rows
+	float* filter;			// (phases + 1) rows of taps coefficients
+	float* kernel;			// the coefficients for the output frame being computed
+	float* history;			// planar: one row of historyFrames input samples per channel
+	size_t historyFrames;
+	size_t frames;			// input frames currently held in each history row
+	double position;		// where the next output frame falls, in input frames into history
+};
+
+// maxInputFrames is the most input resamplerWrite will ever be asked to hold at once;
+// returns false if allocation fails
+bool initResampler(Resampler& resampler, int channels, double inputRate, double outputRate,
+	ResampleQuality quality, size_t maxInputFrames);
+
+void freeResampler(Resampler& resampler);
+
+// how many input frames resamplerWrite can take right now
+size_t resamplerInputSpace(Resampler& resampler);
+
+// how many more input frames it takes before resamplerRead can produce outputFrames, which
+// besides their share of the input is however much of the filter's reach it's still short of
+size_t resamplerInputNeeded(const Resampler& resampler, size_t outputFrames);
+
+// return the number of frames actually taken or produced
+size_t resamplerWrite(Resampler& resampler, const float* input, size_t frames);
+size_t resamplerRead(Resampler& resampler, float* output, size_t frames);
+
+#endif
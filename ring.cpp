@@ -0,0 +1,177 @@
+/* ring.cpp
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "ring.h"
+
+#include <algorithm>	// std::min
+#include <cstring>		// memcpy
+#include <sys/mman.h>	// madvise, mlock, mmap, munmap, MADV_HUGEPAGE, MAP_ANONYMOUS, MAP_FAILED, MAP_PRIVATE, PROT_READ, PROT_WRITE
+#include <unistd.h>		// sysconf, _SC_PAGESIZE
+
+static const size_t kHugePageSize = 2 * 1024 * 1024;	// what transparent huge pages come in on x86-64 and most of arm64
+
+static
+size_t ringOffset(const FrameRing& ring, size_t index)
+{
+	return index >= ring.bytes ? index - ring.bytes : index;
+}
+
+static
+size_t ringAdvance(const FrameRing& ring, size_t index, size_t bytes)
+{
+	// an index and how far it moves are each less than twice the size, so once is enough
+	index += bytes;
+	return index >= 2 * ring.bytes ? index - 2 * ring.bytes : index;
+}
+
+void* allocRingMemory(size_t bytes)
+{
+	void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+	{
+		return nullptr;
+	}
+#if defined(MADV_HUGEPAGE)
+	if (bytes >= kHugePageSize)
+	{
+		madvise(memory, bytes, MADV_HUGEPAGE);	// just advice, which may not be taken
+	}
+#endif
+	
+	// locking faults the pages in too, but RLIMIT_MEMLOCK often won't allow it, in which
+	// case touching them is the best we can do; they could still be swapped out
+	if (mlock(memory, bytes) != 0)
+	{
+		size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+		for (size_t i = 0; i < bytes; i += pageSize)
+		{
+			((volatile uint8_t*)memory)[i] = 0;
+		}
+	}
+	return memory;
+}
+
+void freeRingMemory(void* memory, size_t bytes)
+{
+	munmap(memory, bytes);
+}
+
+void initRing(FrameRing& ring, size_t frameSize, size_t frames, void* memory)
+{
+	ring.writeIndex.store(0, std::memory_order_relaxed);
+	ring.readIndex.store(0, std::memory_order_relaxed);
+	ring.buffer = (uint8_t*)memory;
+	ring.bytes = frames * frameSize;
+	ring.frameSize = frameSize;
+}
+
+size_t ringReadAvailable(const FrameRing& ring)
+{
+	// acquiring the write index makes sure we see the frames it covers
+	size_t writeIndex = ring.writeIndex.load(std::memory_order_acquire);
+	return ringSpan(ring, ring.readIndex.load(std::memory_order_relaxed), writeIndex) / ring.frameSize;
+}
+
+size_t ringWriteAvailable(const FrameRing& ring)
+{
+	// and acquiring the read index that the consumer is done with the frames it frees
+	size_t readIndex = ring.readIndex.load(std::memory_order_acquire);
+	return (ring.bytes - ringSpan(ring, readIndex, ring.writeIndex.load(std::memory_order_relaxed))) / ring.frameSize;
+}
+
+size_t ringPartialBytes(const FrameRing& ring)
+{
+	// twice the size is still a whole number of frames, so going back to zero keeps this
+	return ring.writeIndex.load(std::memory_order_relaxed) % ring.frameSize;
+}
+
+size_t ringSpan(const FrameRing& ring, size_t from, size_t to)
+{
+	return to >= from ? to - from : to + 2 * ring.bytes - from;
+}
+
+size_t ringReadRegions(const FrameRing& ring, size_t frames, const uint8_t*& data1, size_t& frames1, const uint8_t*& data2, size_t& frames2)
+{
+	// the ring is a whole number of frames, so a frame never straddles the wrap
+	size_t bytes = std::min(frames, ringReadAvailable(ring)) * ring.frameSize;
+	size_t offset = ringOffset(ring, ring.readIndex.load(std::memory_order_relaxed));
+	size_t bytes1 = std::min(bytes, ring.bytes - offset);
+	data1 = ring.buffer + offset;
+	frames1 = bytes1 / ring.frameSize;
+	data2 = ring.buffer;
+	frames2 = (bytes - bytes1) / ring.frameSize;
+	return frames1 + frames2;
+}
+
+void ringAdvanceRead(FrameRing& ring, size_t frames)
+{
+	// releasing our copies out of the frames before the producer can reuse them
+	ring.readIndex.store(ringAdvance(ring, ring.readIndex.load(std::memory_order_relaxed), frames * ring.frameSize), std::memory_order_release);
+}
+
+size_t ringWriteRegions(const FrameRing& ring, size_t bytes, uint8_t*& data1, size_t& bytes1, uint8_t*& data2, size_t& bytes2)
+{
+	size_t writeIndex = ring.writeIndex.load(std::memory_order_relaxed);
+	size_t room = ring.bytes - ringSpan(ring, ring.readIndex.load(std::memory_order_acquire), writeIndex);
+	bytes = std::min(bytes, room);
+	size_t offset = ringOffset(ring, writeIndex);
+	bytes1 = std::min(bytes, ring.bytes - offset);
+	data1 = ring.buffer + offset;
+	bytes2 = bytes - bytes1;
+	data2 = ring.buffer;
+	return bytes;
+}
+
+void ringAdvanceWrite(FrameRing& ring, size_t bytes)
+{
+	// releasing whatever we wrote into them before the consumer can see the frames
+	ring.writeIndex.store(ringAdvance(ring, ring.writeIndex.load(std::memory_order_relaxed), bytes), std::memory_order_release);
+}
+
+size_t ringWrite(FrameRing& ring, const void* data, size_t frames)
+{
+	uint8_t* data1 = nullptr;
+	uint8_t* data2 = nullptr;
+	size_t bytes1 = 0;
+	size_t bytes2 = 0;
+	frames = std::min(frames, ringWriteAvailable(ring));
+	ringWriteRegions(ring, frames * ring.frameSize, data1, bytes1, data2, bytes2);
+	memcpy(data1, data, bytes1);
+	memcpy(data2, (const uint8_t*)data + bytes1, bytes2);
+	ringAdvanceWrite(ring, bytes1 + bytes2);
+	return frames;
+}
+
+size_t ringRead(FrameRing& ring, void* data, size_t frames)
+{
+	const uint8_t* data1 = nullptr;
+	const uint8_t* data2 = nullptr;
+	size_t frames1 = 0;
+	size_t frames2 = 0;
+	frames = ringReadRegions(ring, frames, data1, frames1, data2, frames2);
+	memcpy(data, data1, frames1 * ring.frameSize);
+	memcpy((uint8_t*)data + frames1 * ring.frameSize, data2, frames2 * ring.frameSize);
+	ringAdvanceRead(ring, frames);
+	return frames;
+}
+
+void ringDropPartialFrame(FrameRing& ring)
+{
+	// the consumer never reads past the last whole frame, so there's nothing to race
+	size_t writeIndex = ring.writeIndex.load(std::memory_order_relaxed);
+	ring.writeIndex.store(writeIndex - writeIndex % ring.frameSize, std::memory_order_relaxed);
+}
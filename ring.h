@@ -0,0 +1,81 @@
+/* ring.h
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPEPLAYER_RING_H
+#define PIPEPLAYER_RING_H
+
+#include <atomic>		// std::atomic
+#include <cstddef>		// size_t
+#include <cstdint>		// uint8_t
+
+static const size_t kCacheLineSize = 64;
+
+// a single-producer, single-consumer ring of frames between a writer and a stream
+// callback. It holds any whole number of frames, the producer's and the consumer's indices
+// each get a cache line to themselves so neither side's stores keep stealing the other's,
+// and the producer can write any number of bytes, leaving a partial frame the consumer
+// doesn't see until the rest of it arrives. The indices count bytes around the ring twice
+// over, going back to zero at twice its size, so a full ring isn't an empty one and a
+// 32-bit size_t never overflows however long a stream runs
+struct FrameRing
+{
+	alignas(kCacheLineSize) std::atomic<size_t> writeIndex;	// the producer's
+	alignas(kCacheLineSize) std::atomic<size_t> readIndex;	// the consumer's, always at a whole frame
+	alignas(kCacheLineSize) uint8_t* buffer;
+	size_t bytes;
+	size_t frameSize;
+};
+
+// memory for a ring of bytes, which stream callbacks will read without ever taking a page
+// fault: locked if we're allowed, on huge pages if it's big enough and the kernel obliges,
+// and touched throughout either way; returns null if there's no memory at all
+void* allocRingMemory(size_t bytes);
+void freeRingMemory(void* memory, size_t bytes);
+
+// an empty ring of frames frames in memory, which several rings may share as views of the
+// one ring, each with its own consumer, when the producer keeps them in step
+void initRing(FrameRing& ring, size_t frameSize, size_t frames, void* memory);
+
+// whole frames the consumer can read, and whole frames more the producer can write
+size_t ringReadAvailable(const FrameRing& ring);
+size_t ringWriteAvailable(const FrameRing& ring);
+
+// bytes the producer has written past the last whole frame
+size_t ringPartialBytes(const FrameRing& ring);
+
+// bytes from index from on to index to, for comparing indices of views of one ring
+size_t ringSpan(const FrameRing& ring, size_t from, size_t to);
+
+// where the consumer can read up to frames frames, in at most two pieces split where the
+// ring wraps; returns how many frames there are in all
+size_t ringReadRegions(const FrameRing& ring, size_t frames, const uint8_t*& data1, size_t& frames1, const uint8_t*& data2, size_t& frames2);
+void ringAdvanceRead(FrameRing& ring, size_t frames);
+
+// likewise where the producer can write up to bytes bytes, carrying on from any partial
+// frame; a region that doesn't wrap ends at a whole frame whenever the partial frame does
+size_t ringWriteRegions(const FrameRing& ring, size_t bytes, uint8_t*& data1, size_t& bytes1, uint8_t*& data2, size_t& bytes2);
+void ringAdvanceWrite(FrameRing& ring, size_t bytes);
+
+// copying counterparts of the above for whole frames, for producers that never leave a
+// partial one; they return how many fit
+size_t ringWrite(FrameRing& ring, const void* data, size_t frames);
+size_t ringRead(FrameRing& ring, void* data, size_t frames);
+
+// for the producer to take back a partial frame it won't be finishing
+void ringDropPartialFrame(FrameRing& ring);
+
+#endif
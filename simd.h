@@ -0,0 +1,34 @@
+/* simd.h
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPEPLAYER_SIMD_H
+#define PIPEPLAYER_SIMD_H
+
+// picks the widest vector instruction set the build targets, if any; there's no runtime
+// dispatch, so AVX2 needs something like -mavx2 while SSE2 comes free with x86-64
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define PIPEPLAYER_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PIPEPLAYER_SSE2 1
+#elif defined(__ARM_NEON) && defined(__aarch64__) && !defined(__ARM_BIG_ENDIAN)
+#include <arm_neon.h>
+#define PIPEPLAYER_NEON 1
+#endif
+
+#endif
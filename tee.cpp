@@ -0,0 +1,456 @@
+/* tee.cpp
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "tee.h"
+
+#include <algorithm>	// std::max, std::min
+#include <cerrno>		// errno, EAGAIN, EINTR, ENOMEM
+#include <cstdio>		// snprintf
+#include <cstdlib>		// free, malloc, strtol
+#include <cstring>		// memcpy, memmove
+#include <fcntl.h>		// fcntl, open, splice, tee, F_GETFL, F_SETFL, O_CREAT, O_NONBLOCK, O_TRUNC, O_WRONLY, SPLICE_F_MOVE, SPLICE_F_NONBLOCK
+#include <poll.h>		// poll, pollfd
+#include <sys/ioctl.h>	// ioctl, FIONREAD
+#include <sys/stat.h>	// fstat, S_ISFIFO, S_ISREG
+#include <sys/uio.h>	// iovec, readv
+#include <unistd.h>		// close, dup, write
+
+#include "io.h"			// closeWakePipe, openWakePipe
+
+static const int kMaxTeeIovecs = 2;	// all readRingBuffer ever needs
+
+static
+void releaseSink(Tee& tee)
+{
+	// a descriptor we were given back as it was handed to us, since the file description
+	// behind it, and with it O_NONBLOCK, is still whoever passed it to us's
+	if (tee.restoreFlags != -1)
+	{
+		fcntl(tee.fd, F_SETFL, tee.restoreFlags);
+		tee.restoreFlags = -1;
+	}
+	close(tee.fd);
+	tee.fd = -1;
+}
+
+static
+void stopTee(Tee& tee, int error)
+{
+	// whatever was passed on stays passed on, and the input just stops going anywhere
+	tee.error = error;
+	releaseSink(tee);
+	closeWakePipe(tee.pipe);
+	tee.pipeBytes = 0;
+}
+
+static
+int openSink(const char* path, int& restoreFlags)
+{
+	// a nonblocking descriptor for path, or if path is just a number, for whatever that
+	// descriptor is. A dup() of one would share its file status flags, so a pipe is opened
+	// again on its own where we can; a regular file never makes a write wait anyway, and
+	// anything else has its flags kept to be put back
+	restoreFlags = -1;
+	char* end = nullptr;
+	long descriptor = strtol(path, &end, 10);
+	if (*path == '\0' || *end != '\0')
+	{
+		// opening a FIFO waits for something to read it, as it would for any other writer
+		int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		int flags = fd != -1 ? fcntl(fd, F_GETFL) : -1;
+		if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)
+		{
+			int error = errno;
+			if (fd != -1)
+			{
+				close(fd);
+			}
+			errno = error;
+			return -1;
+		}
+		return fd;
+	}
+	
+	struct stat shared = {};
+	if (fstat((int)descriptor, &shared) != 0)
+	{
+		return -1;
+	}
+	if (S_ISREG(shared.st_mode))
+	{
+		return dup((int)descriptor);
+	}
+#if defined(__linux__)
+	if (S_ISFIFO(shared.st_mode))
+	{
+		char reopen[32];
+		snprintf(reopen, sizeof(reopen), "/proc/self/fd/%ld", descriptor);
+		int fd = open(reopen, O_WRONLY | O_NONBLOCK);
+		if (fd != -1)
+		{
+			return fd;
+		}
+	}
+#endif
+	
+	int flags = fcntl((int)descriptor, F_GETFL);
+	int fd = flags != -1 ? dup((int)descriptor) : -1;
+	if (fd == -1)
+	{
+		return -1;
+	}
+	if ((flags & O_NONBLOCK) == 0)
+	{
+		if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)
+		{
+			int error = errno;
+			close(fd);
+			errno = error;
+			return -1;
+		}
+		restoreFlags = flags;
+	}
+	return fd;
+}
+
+static
+bool spliceOut(Tee& tee)
+{
+	// moves what's in our pipe on to fd, without waiting; true once it's all gone
+#if defined(__linux__)
+	while (tee.pipeBytes > 0)
+	{
+		ssize_t moved = splice(tee.pipe[0], nullptr, tee.fd, nullptr, tee.pipeBytes, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (moved <= 0)
+		{
+			if (moved < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (moved < 0 && errno != EAGAIN)
+			{
+				stopTee(tee, errno);
+			}
+			return false;
+		}
+		tee.pipeBytes -= (size_t)moved;
+	}
+#endif
+	return true;
+}
+
+static
+size_t deliver(Tee& tee, const uint8_t* bytes, size_t size)
+{
+	// writes as much as fd (or our pipe on the way to it) takes without waiting
+	size_t written = 0;
+	while (written < size && tee.fd != -1)
+	{
+		ssize_t count = write(tee.pipe[1] != -1 ? tee.pipe[1] : tee.fd, bytes + written, size - written);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			if (errno != EAGAIN)
+			{
+				stopTee(tee, errno);
+			}
+			break;
+		}
+		written += (size_t)count;
+		if (tee.pipe[1] != -1)
+		{
+			tee.pipeBytes += (size_t)count;
+			spliceOut(tee);
+		}
+	}
+	return written;
+}
+
+static
+bool catchUp(Tee& tee)
+{
+	// true once fd has everything it's owed, with nothing still on its way
+	if (!spliceOut(tee))
+	{
+		return false;
+	}
+	if (tee.pendingBytes > 0)
+	{
+		size_t written = deliver(tee, tee.pending, tee.pendingBytes);
+		tee.pendingBytes -= written;
+		memmove(tee.pending, tee.pending + written, tee.pendingBytes);
+	}
+	return tee.fd != -1 && tee.pendingBytes == 0 && tee.pipeBytes == 0;
+}
+
+static
+bool waitForSink(Tee& tee, int timeoutMs)
+{
+	// false if fd still can't take more once timeoutMs is up, or a signal, like the one
+	// asking us to stop, gets in first
+	pollfd sink = { tee.fd, POLLOUT, 0 };
+	return poll(&sink, 1, timeoutMs) > 0;
+}
+
+static
+void startDrop(Tee& tee, uint64_t position)
+{
+	// fd stops getting input at position, but a frame it's already had the start of has
+	// to be finished first, or everything after the drop would be out of line
+	tee.dropping = true;
+	tee.owed = (tee.frameSize - position % tee.frameSize) % tee.frameSize;
+	++tee.drops;
+}
+
+static
+size_t teeInput(Tee& tee, int fd, size_t bytes)
+{
+	// duplicates up to bytes at the front of the input pipe on to fd, leaving them there
+	// for us to read; zero if the input's empty (or over), or if fd can't take any more,
+	// in which case it's kTeeDrop's time to start dropping
+#if defined(__linux__)
+	for (;;)
+	{
+		ssize_t teed = ::tee(fd, tee.pipe[1] != -1 ? tee.pipe[1] : tee.fd, bytes, SPLICE_F_NONBLOCK);
+		if (teed > 0)
+		{
+			if (tee.pipe[1] != -1)
+			{
+				tee.pipeBytes += (size_t)teed;
+				spliceOut(tee);
+			}
+			return (size_t)teed;
+		}
+		if (teed == 0)
+		{
+			return 0;
+		}
+		if (errno == EINTR)
+		{
+			continue;
+		}
+		if (errno != EAGAIN)
+		{
+			stopTee(tee, errno);
+			return 0;
+		}
+		
+		// the input being empty is for the read to find out about
+		int bytesPending = 0;
+		if (ioctl(fd, FIONREAD, &bytesPending) != 0 || bytesPending == 0)
+		{
+			return 0;
+		}
+		if (tee.policy == kTeeBlock && waitForSink(tee, -1))
+		{
+			catchUp(tee);
+			if (tee.fd != -1)
+			{
+				continue;
+			}
+			return 0;
+		}
+		startDrop(tee, tee.position);
+		return 0;
+	}
+#else
+	return 0;
+#endif
+}
+
+static
+void passOn(Tee& tee, const iovec* iov, int count, size_t bytes)
+{
+	// what was read without being teed first goes, in order, to finishing a frame owed from
+	// before a drop, to being dropped, or to fd the slow way
+	size_t offset = 0;
+	for (int i = 0; i < count && offset < bytes && tee.fd != -1; ++i)
+	{
+		const uint8_t* data = (const uint8_t*)iov[i].iov_base;
+		size_t length = std::min(iov[i].iov_len, bytes - offset);
+		while (length > 0 && tee.fd != -1)
+		{
+			size_t used = 0;
+			if (tee.owed > 0)
+			{
+				used = std::min(length, tee.owed);
+				memcpy(tee.pending + tee.pendingBytes, data, used);
+				tee.pendingBytes += used;
+				tee.owed -= used;
+			}
+			else if (tee.skip > 0 || tee.dropping)
+			{
+				used = tee.dropping ? length : std::min(length, tee.skip);
+				tee.skip -= std::min(used, tee.skip);
+				tee.bytesDropped += used;
+			}
+			else
+			{
+				used = deliver(tee, data, length);
+				tee.bytesCopied += used;
+				if (used < length && tee.fd != -1 && !(tee.policy == kTeeBlock && waitForSink(tee, -1)))
+				{
+					startDrop(tee, tee.position + offset + used);
+				}
+			}
+			data += used;
+			length -= used;
+			offset += used;
+		}
+	}
+}
+
+bool openTee(Tee& tee, const char* path, int inputFd, TeePolicy policy, size_t frameSize)
+{
+	tee = Tee();
+	tee.fd = -1;
+	tee.restoreFlags = -1;
+	tee.pipe[0] = tee.pipe[1] = -1;
+	tee.policy = policy;
+	tee.frameSize = std::max(frameSize, (size_t)1);
+	tee.pending = (uint8_t*)malloc(tee.frameSize);
+	if (tee.pending == nullptr)
+	{
+		errno = ENOMEM;
+		return false;
+	}
+	
+	int fd = openSink(path, tee.restoreFlags);
+	if (fd == -1)
+	{
+		int error = errno;
+		free(tee.pending);
+		tee.pending = nullptr;
+		errno = error;
+		return false;
+	}
+	tee.fd = fd;
+	
+#if defined(__linux__)
+	struct stat input = {};
+	struct stat output = {};
+	if (fstat(inputFd, &input) == 0 && S_ISFIFO(input.st_mode) && fstat(fd, &output) == 0)
+	{
+		tee.zeroCopy = S_ISFIFO(output.st_mode) || openWakePipe(tee.pipe);
+	}
+#endif
+	return true;
+}
+
+void closeTee(Tee& tee)
+{
+	if (tee.fd != -1)
+	{
+		// a blocking tee gets everything that was read, however long it takes to take it
+		while (!catchUp(tee) && tee.fd != -1 && tee.policy == kTeeBlock && waitForSink(tee, -1))
+		{
+		}
+		if (tee.fd != -1)
+		{
+			releaseSink(tee);
+		}
+		closeWakePipe(tee.pipe);
+	}
+	free(tee.pending);
+	tee.pending = nullptr;
+}
+
+ssize_t readvTee(Tee* tee, int fd, const iovec* iov, int count)
+{
+	if (tee == nullptr || tee->fd == -1)
+	{
+		return readv(fd, iov, count);
+	}
+	
+	// fd catching up after a drop, with room for more, picks up again at the next frame
+	if (tee->dropping && tee->owed == 0 && catchUp(*tee) && waitForSink(*tee, 0))
+	{
+		tee->dropping = false;
+		tee->skip = (tee->frameSize - tee->position % tee->frameSize) % tee->frameSize;
+	}
+	
+	// a read that's been teed can't go any further than the tee did, and one that's still
+	// getting to the next frame can't go past it, since the tee after it has to start there
+	iovec limited[kMaxTeeIovecs] = {};
+	count = std::min(count, kMaxTeeIovecs);
+	size_t bytes = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		limited[i] = iov[i];
+		bytes += iov[i].iov_len;
+	}
+	size_t limit = bytes;
+	if (tee->zeroCopy && !tee->dropping && tee->owed == 0)
+	{
+		if (tee->skip > 0)
+		{
+			limit = std::min(limit, tee->skip);
+		}
+		else
+		{
+			if (tee->ahead == 0)
+			{
+				tee->ahead = teeInput(*tee, fd, bytes);
+			}
+			if (tee->ahead > 0)
+			{
+				limit = std::min(limit, tee->ahead);
+			}
+		}
+	}
+	for (int i = 0; i < count; ++i)
+	{
+		limited[i].iov_len = std::min(limited[i].iov_len, limit);
+		limit -= limited[i].iov_len;
+	}
+	
+	ssize_t bytesRead = readv(fd, limited, count);
+	if (bytesRead > 0)
+	{
+		if (tee->ahead > 0)
+		{
+			size_t teed = std::min((size_t)bytesRead, tee->ahead);
+			tee->ahead -= teed;
+			tee->bytesTeed += teed;
+		}
+		else
+		{
+			passOn(*tee, limited, count, (size_t)bytesRead);
+		}
+		tee->position += (uint64_t)bytesRead;
+	}
+	return bytesRead;
+}
+
+ssize_t readTee(Tee* tee, int fd, void* buffer, size_t bytes)
+{
+	iovec iov = { buffer, bytes };
+	return readvTee(tee, fd, &iov, 1);
+}
+
+void writeTee(Tee& tee, const void* bytes, size_t size)
+{
+	if (tee.fd != -1 && size > 0)
+	{
+		iovec iov = { (void*)bytes, size };
+		passOn(tee, &iov, 1, size);
+		tee.position += size;
+	}
+}
@@ -0,0 +1,78 @@
+/* tee.h
+ * Copyright 2019 Keith Kaisershot
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PIPEPLAYER_TEE_H
+#define PIPEPLAYER_TEE_H
+
+#include <cstddef>		// size_t
+#include <cstdint>		// uint8_t, uint64_t
+#include <sys/types.h>	// ssize_t
+#include <sys/uio.h>	// iovec
+
+// passing the input on to somewhere else as it's read, so it can be recorded or played
+// elsewhere without another process copying it. On Linux, input from a pipe is tee(2)d
+// before it's read, so what's passed on never comes through user space (by way of a pipe of
+// our own and splice(2) when where it's going isn't a pipe itself); otherwise, or if more
+// shows up between the tee and the read, what we read is written on
+
+enum TeePolicy
+{
+	kTeeDrop,	// when it can't keep up, whole frames are dropped from it and playing goes on
+	kTeeBlock,	// when it can't keep up, we wait for it, and playing may starve
+};
+
+struct Tee
+{
+	int fd;					// -1 when there's no tee, or it's stopped
+	int restoreFlags;		// fd's file status flags from before we made it nonblocking, when it's shared with whoever passed it to us; -1 otherwise
+	int pipe[2];			// between a tee(2) and fd, when fd isn't a pipe
+	size_t pipeBytes;		// in that pipe, still to be spliced on
+	bool zeroCopy;			// the input's a pipe we can tee(2)
+	TeePolicy policy;
+	size_t frameSize;		// of the input, which drops are whole numbers of
+	
+	uint64_t position;		// bytes of input read through us so far
+	size_t ahead;			// teed on but not read yet, which the next reads have to match
+	bool dropping;			// fd fell behind, so input isn't going to it until it catches up
+	size_t owed;			// of the frame a drop started inside, which fd has the start of
+	size_t skip;			// of the frame a drop ended inside, which fd doesn't get the rest of
+	uint8_t* pending;		// the owed bytes, until fd takes them
+	size_t pendingBytes;
+	int error;				// what stopped the tee, if anything did
+	
+	uint64_t bytesTeed;		// passed on without copying
+	uint64_t bytesCopied;	// passed on with write()
+	uint64_t bytesDropped;
+	unsigned long drops;
+};
+
+// opens path for writing, creating a file if there's nothing there, to pass input read
+// from inputFd on to, or if path is just a number, takes a copy of that descriptor; false
+// with errno set if it can't. A descriptor that isn't reopened on its own is put back the
+// way it was by closeTee, so whoever shares it doesn't find it nonblocking afterwards. A
+// broken pipe stops the tee with EPIPE, but only if SIGPIPE is ignored
+bool openTee(Tee& tee, const char* path, int inputFd, TeePolicy policy, size_t frameSize);
+void closeTee(Tee& tee);
+
+// like readv() and read(), passing on what's read if tee isn't null and hasn't stopped
+ssize_t readvTee(Tee* tee, int fd, const iovec* iov, int count);
+ssize_t readTee(Tee* tee, int fd, void* buffer, size_t bytes);
+
+// passes on bytes that were read from the input before the tee was opened
+void writeTee(Tee& tee, const void* bytes, size_t size);
+
+#endif